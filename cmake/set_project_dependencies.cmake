@@ -2,8 +2,27 @@
 
 set(PROJECT_SOURCES
 	src/BitField.cpp
+	src/Chord_Matcher.cpp
+	src/Clock_Sync.cpp
 	src/Cyclic_Queue.cpp
 	src/Device.cpp
+	src/Event_Codec.cpp
+	src/Event_Filter.cpp
+	src/Event_Tap.cpp
+	src/Event_Tap_Reader.cpp
+	src/Flight_Recorder.cpp
+	src/Frame_Pool.cpp
+	src/Frame_Scheduler.cpp
+	src/IO_Engine.cpp
+	src/Jitter_Buffer.cpp
+	src/Latency_Histogram.cpp
+	src/Logger.cpp
+	src/Metrics.cpp
+	src/Secure_Channel.cpp
+	src/Socket_Address.cpp
+	src/State_Notifier.cpp
+	src/Target_Manager.cpp
+	src/Thread_Policy.cpp
 	src/unikey.cpp
 	src/Virtual_Device.cpp
 	src/WiFi_Client.cpp
@@ -21,6 +40,19 @@ set(PROJECT_LIBRARIES
 	${SDBUSCPP_LIBRARIES}
 	${LIBUDEV_LIBRARIES}
 )
+set(PROJECT_COMPILE_DEFINITIONS)
+
+# Optional io_uring backend for IO_Engine, which falls back to plain writes without it
+if(LIBURING_FOUND)
+	list(APPEND PROJECT_INCLUDE_DIRS ${LIBURING_INCLUDE_DIRS})
+	list(APPEND PROJECT_LIBRARIES ${LIBURING_LIBRARIES})
+	list(APPEND PROJECT_COMPILE_DEFINITIONS UNIKEY_HAVE_LIBURING)
+endif()
+
+# Optional USDT probes, which compile to nothing without sys/sdt.h (systemtap-sdt-dev)
+if(SYS_SDT_FOUND)
+	list(APPEND PROJECT_COMPILE_DEFINITIONS UNIKEY_HAVE_SDT)
+endif()
 
 set(PROJECT_EXEC_NAME ${PROJECT_NAME})
 set(PROJECT_LIB_NAME "lib${PROJECT_NAME}")
\ No newline at end of file
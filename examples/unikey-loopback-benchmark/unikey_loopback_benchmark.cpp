@@ -0,0 +1,1061 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <time.h>
+#include <vector>
+
+#include <linux/input.h>
+#include <libevdev/libevdev.h>
+#include <libevdev/libevdev-uinput.h>
+#include <fcntl.h>
+#include <sys/random.h>
+#include <sys/resource.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "BitField.hpp"
+#include "Clock_Sync.hpp"
+#include "Device.hpp"
+#include "Event_Codec.hpp"
+#include "Event_Filter.hpp"
+#include "Flight_Recorder.hpp"
+#include "Frame_Pool.hpp"
+#include "Frame_Scheduler.hpp"
+#include "IO_Engine.hpp"
+#include "Jitter_Buffer.hpp"
+#include "Latency_Histogram.hpp"
+#include "Logger.hpp"
+#include "Metrics.hpp"
+#include "Secure_Channel.hpp"
+#include "Socket_Address.hpp"
+#include "Virtual_Device.hpp"
+#include "WiFi_Client.hpp"
+#include "WiFi_Server.hpp"
+
+/*
+	Sends event frames through each transport on this host and reports the
+	per-frame delivery latency (one frame in flight at a time), the burst
+	throughput and the CPU time per frame. vsock needs the vsock_loopback
+	module: sudo modprobe vsock_loopback, and tls the kernel TLS module:
+	sudo modprobe tls
+	"uinput" writes frames to a virtual device through the I/O engine, with
+	and without io_uring, and needs access to /dev/uinput.
+	"clock" skews the sending side's clock by CLOCK_SKEW_NS, lets the
+	ping/pong probes estimate it back and reports the one-way latency the
+	receiver measures with that estimate.
+	"jitter" replays a bursty arrival trace through the jitter buffer at
+	several latency budgets and reports the spread of the output frame
+	intervals. The built-in trace models Wi-Fi power save: a 125 Hz mouse
+	whose frames are released in bursts every 20-60 ms. "jitter=FILE"
+	replays a recorded trace instead, one "capture_us arrival_us" line per
+	frame, both on the receiver's clock, or the received frames of a
+	flight recorder dump.
+	"priority" floods an emulated 2000 frames/s link with an 8 kHz mouse
+	while a key is pressed every 20 ms, and reports the key press latency
+	through the frame scheduler with a single FIFO and with priority classes.
+	"metrics" times counter increments from several threads against one
+	shared atomic counter, with and without a scraper running alongside,
+	then scrapes the HTTP endpoint once.
+	"flight" times flight recorder records from several threads, then
+	checks a dump on request, on SIGUSR1 and past the latency threshold.
+	"logging" runs frames through the default event processor as it was,
+	printing through iostream with a flush per frame, and as it is now,
+	through the logger. Output goes to a pipe drained at about 4 MB/s, like
+	a busy journal, and the time each frame holds the calling thread is
+	reported.
+	"filter" runs events through the remap filter without a profile, with
+	one, and while another thread switches between two cached profiles,
+	and reports the time per event and per switch.
+	"discovery" adds DISCOVERY_NODES virtual devices through uinput, half
+	of them keyboards and half switch-only nodes udev tags as not
+	input-capable, then times startup discovery the old way, opening and
+	probing every event node in turn, against udev enumeration followed by
+	probing only the candidates on a pool of threads. It needs access to
+	/dev/uinput.
+	For syscall counts of the transports, run under: strace -c -f
+	Usage: unikey_loopback_benchmark [tcp|tls|unix|vsock|uinput|clock|jitter[=FILE]|priority|metrics|flight|logging|filter|discovery]...
+*/
+
+struct transport
+{
+	const char* name;
+	const char* server_address;
+	const char* client_address;
+};
+
+static constexpr transport TRANSPORTS[] = {
+	{ "tcp", "tcp:127.0.0.1:42170", "tcp:127.0.0.1:42170" },
+	{ "tls", "tls:127.0.0.1:42172", "tls:127.0.0.1:42172" },
+	{ "unix", "unix:@unikey-loopback-benchmark", "unix:@unikey-loopback-benchmark" },
+	{ "vsock", "vsock:any:42171", "vsock:local:42171" }
+};
+static constexpr uint64_t FRAME_EVENTS = 8;
+static constexpr uint64_t PACED_FRAMES = 20000;
+static constexpr uint64_t BURST_FRAMES = 200000;
+static constexpr uint64_t UINPUT_FRAMES = 200000;
+static constexpr uint64_t UINPUT_BATCH = 8;	// Frames arriving together between flushes
+static constexpr const char* CLOCK_ADDRESS = "tcp:127.0.0.1:42173";
+static constexpr int64_t CLOCK_SKEW_NS = 5000000;
+static constexpr unsigned CLOCK_PROBES = 8;
+static constexpr uint64_t CLOCK_FRAMES = 2000;
+static constexpr uint64_t TRACE_FRAMES = 3000;
+static constexpr uint64_t TRACE_INTERVAL_NS = 8000000;
+static constexpr uint64_t JITTER_BUDGETS_MS[] = { 0, 20, 50, 80 };
+static constexpr const char* PRIORITY_ADDRESS = "tcp:127.0.0.1:42174";
+static constexpr uint64_t MOUSE_INTERVAL_NS = 125000;	// 8 kHz
+static constexpr uint64_t KEY_INTERVAL_NS = 20000000;
+static constexpr uint64_t LINK_FRAME_NS = 500000;	// Emulated link, 2000 frames/s
+static constexpr uint64_t FLOOD_NS = 2000000000;
+static constexpr const char* METRICS_ADDRESS = "tcp:127.0.0.1:42175";
+static constexpr unsigned COUNTING_THREADS = 4;
+static constexpr uint64_t COUNTS_PER_THREAD = 25000000;
+static constexpr uint64_t RECORDS_PER_THREAD = 2000000;
+static constexpr uint64_t FLIGHT_THRESHOLD_NS = 50000000;
+static constexpr uint64_t PROCESSOR_FRAMES = 20000;
+static constexpr unsigned DRAIN_PAUSE_US = 1000;	// Between 4 KiB reads
+static constexpr uint64_t FILTER_EVENTS = 20000000;
+static constexpr unsigned SWAP_PAUSE_US = 100;	// Between profile switches
+static constexpr unsigned DISCOVERY_NODES = 64;
+static constexpr unsigned PROBE_THREADS = 8;	// As many as discovery uses at most
+
+struct trace_frame
+{
+	uint64_t capture_ns;
+	uint64_t arrival_ns;
+};
+
+static uint64_t monotonic_ns()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static uint64_t cpu_ns()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return (uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000ull
+		+ (uint64_t)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000ull;
+}
+
+static void run_uinput_benchmark(bool use_io_uring)
+{
+	const char* name = use_io_uring ? "uinput io_uring" : "uinput direct";
+	Virtual_Device virt_dev("Unikey Loopback Benchmark");
+	BitField rel_codes(REL_CNT);
+	rel_codes.insert(REL_X);
+	virt_dev.enable_codes(EV_REL, rel_codes);
+
+	IO_Engine io_engine(use_io_uring);
+	if (use_io_uring && !io_engine.uses_io_uring())
+	{
+		std::cout << name << " is unavailable on this host" << std::endl;
+		return;
+	}
+	virt_dev.set_io_engine(&io_engine);
+
+	struct input_event ev = { };
+	ev.type = EV_REL;
+	ev.code = REL_X;
+	ev.value = 0;	// Reaches uinput but moves nothing
+
+	uint64_t cpu_start_ns = cpu_ns();
+	for (uint64_t n = 0; n < UINPUT_FRAMES; ++n)
+	{
+		virt_dev.write_frame(&ev, 1);
+		if ((n + 1) % UINPUT_BATCH == 0)
+			io_engine.flush();
+	}
+	virt_dev.set_io_engine(nullptr);
+	uint64_t cpu_frame_ns = (cpu_ns() - cpu_start_ns) / UINPUT_FRAMES;
+
+	if (io_engine.return_syscall_count() == 0)
+		std::cout << name << " could not create the virtual device" << std::endl;
+	else
+		std::cout << name << ": " << (double)io_engine.return_syscall_count() / UINPUT_FRAMES << " syscalls/frame, "
+			<< cpu_frame_ns << " ns CPU/frame" << std::endl;
+}
+
+static void run_benchmark(const transport& bench)
+{
+	WiFi_Server server(bench.server_address);
+	server.begin_listening();
+
+	WiFi_Client client;
+	if (!client.set_server_addr(bench.client_address))
+		return;
+	client.connect_to_server();
+
+	// A transport the kernel does not provide never connects, skip it instead of hanging
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(3);
+	while (!client.server_connection_status() && std::chrono::steady_clock::now() < deadline)
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	if (!client.server_connection_status())
+	{
+		std::cout << bench.name << " is unavailable on this host" << std::endl;
+		client.close_connection();
+		return;
+	}
+	server.wait_for_connection();
+
+	Latency_Histogram delivery_latency;
+	std::atomic_uint64_t frames_received{0};
+	uint64_t frame[1 + FRAME_EVENTS * sizeof(struct input_event) / sizeof(uint64_t)] = { FRAME_EVENTS };
+	uint64_t burst_ns = 0;
+
+	std::thread receiver([&]
+	{
+		uint64_t buffer[1 + FRAME_EVENTS * sizeof(struct input_event) / sizeof(uint64_t)];
+		for (uint64_t n = 0; n < PACED_FRAMES + BURST_FRAMES; ++n)
+		{
+			if (server.read_sent_data_packet(buffer) == nullptr)
+				break;
+
+			uint64_t sent_ns;
+			memcpy(&sent_ns, buffer + 1, sizeof(uint64_t));	// Stamped over the first event
+			if (n < PACED_FRAMES)
+				delivery_latency.record(monotonic_ns() - sent_ns);
+			frames_received.store(n + 1, std::memory_order_release);
+		}
+	});
+
+	for (uint64_t n = 0; n < PACED_FRAMES; ++n)
+	{
+		uint64_t sent_ns = monotonic_ns();
+		memcpy(frame + 1, &sent_ns, sizeof(uint64_t));
+		client.send_formatted_data(frame, sizeof(struct input_event));
+		while (frames_received.load(std::memory_order_acquire) <= n)
+			std::this_thread::yield();
+	}
+
+	uint64_t burst_start_ns = monotonic_ns();
+	uint64_t cpu_start_ns = cpu_ns();
+	for (uint64_t n = 0; n < BURST_FRAMES; ++n)
+		client.send_formatted_data(frame, sizeof(struct input_event));
+	receiver.join();
+	burst_ns = monotonic_ns() - burst_start_ns;
+	uint64_t cpu_frame_ns = (cpu_ns() - cpu_start_ns) / BURST_FRAMES;	// Sender and receiver together
+
+	std::cout << delivery_latency.report(std::string(bench.name) + " delivery latency");
+	if (frames_received.load(std::memory_order_acquire) == PACED_FRAMES + BURST_FRAMES)
+		std::cout << bench.name << " burst throughput: " << (BURST_FRAMES * 1000000000ull / burst_ns) << " frames/s, "
+			<< cpu_frame_ns << " ns CPU/frame" << std::endl;
+	else
+		std::cout << bench.name << " connection dropped after " << frames_received.load() << " frames" << std::endl;
+
+	client.close_connection();
+	server.close_connection();
+}
+
+static void run_clock_benchmark()
+{
+	WiFi_Server server(CLOCK_ADDRESS);
+	server.begin_listening();
+
+	WiFi_Client client;
+	client.set_server_addr(CLOCK_ADDRESS);
+	client.connect_to_server();
+	client.wait_until_connected();
+	server.wait_for_connection();
+
+	Clock_Sync::set_injected_offset(CLOCK_SKEW_NS);
+	Clock_Sync::reset_peer();
+	std::atomic_uint64_t frames_received{0};
+
+	// Answers the way forward_to_virtual_device does, minus the uinput write
+	std::thread receiver([&]
+	{
+		Event_Codec decoder;
+		std::vector<struct input_event> ev_list;
+		uint64_t buffer[1 + Event_Codec::max_encoded_size(1) / sizeof(uint64_t) + 1];
+		while (frames_received.load(std::memory_order_relaxed) < CLOCK_FRAMES && server.read_sent_data_packet(buffer) != nullptr)
+		{
+			uint64_t receive_ns = Clock_Sync::now_ns();
+			const uint8_t* p_frame = (const uint8_t*)(buffer + 1);
+			uint64_t ping[3];
+			int64_t offset_ns = 0;
+			uint64_t rtt_ns = 0;
+			uint64_t capture_ns = 0;
+
+			switch (Event_Codec::return_frame_kind(p_frame, buffer[0]))
+			{
+				case Event_Codec::FRAME_PING:
+					if (Event_Codec::decode_ping(p_frame, buffer[0], ping[0]))
+					{
+						ping[1] = receive_ns;
+						ping[2] = Clock_Sync::now_ns();
+						server.send_reply(ping, sizeof(ping));
+					}
+					break;
+				case Event_Codec::FRAME_CLOCK:
+					if (Event_Codec::decode_clock(p_frame, buffer[0], offset_ns, rtt_ns))
+						Clock_Sync::set_peer_estimate(offset_ns, rtt_ns);
+					break;
+				default:
+					if (decoder.decode(p_frame, buffer[0], ev_list, &capture_ns))
+					{
+						Clock_Sync::record_frame(Clock_Sync::to_local_clock(capture_ns));
+						frames_received.fetch_add(1, std::memory_order_release);
+					}
+					break;
+			}
+		}
+	});
+
+	Clock_Estimator estimator;
+	uint8_t message[sizeof(uint64_t) + Event_Codec::max_encoded_size(1)];
+	for (unsigned n = 0; n < CLOCK_PROBES; ++n)
+	{
+		uint64_t pong[3];
+		uint64_t t1 = Clock_Sync::sender_now_ns();
+		*(uint64_t*)message = Event_Codec::encode_ping(t1, message + sizeof(uint64_t));
+		client.send_formatted_data(message, sizeof(uint8_t));
+		if (client.receive_reply(pong, sizeof(pong), 1000) && pong[0] == t1)
+			estimator.add_sample(t1, pong[1], pong[2], Clock_Sync::sender_now_ns());
+	}
+
+	int64_t offset_ns = 0;
+	uint64_t rtt_ns = 0;
+	if (estimator.return_estimate(offset_ns, rtt_ns))
+	{
+		*(uint64_t*)message = Event_Codec::encode_clock(offset_ns, rtt_ns, message + sizeof(uint64_t));
+		client.send_formatted_data(message, sizeof(uint8_t));
+	}
+
+	Event_Codec encoder;
+	struct input_event ev = { };
+	ev.type = EV_REL;
+	ev.code = REL_X;
+	for (uint64_t n = 0; n < CLOCK_FRAMES; ++n)
+	{
+		*(uint64_t*)message = encoder.encode(&ev, 1, message + sizeof(uint64_t), Clock_Sync::sender_now_ns());
+		client.send_formatted_data(message, sizeof(uint8_t));
+		while (frames_received.load(std::memory_order_acquire) <= n)
+			std::this_thread::yield();
+	}
+	receiver.join();
+
+	std::cout << "clock skew: injected " << CLOCK_SKEW_NS / 1000 << "us, estimated " << -offset_ns / 1000 << "us" << std::endl;
+	std::cout << Clock_Sync::return_report();
+	Clock_Sync::set_injected_offset(0);
+
+	client.close_connection();
+	server.close_connection();
+}
+
+static std::vector<trace_frame> generate_bursty_trace()
+{
+	std::vector<trace_frame> trace;
+	uint64_t random_state = 0x9E3779B97F4A7C15ull;	// Fixed seed, every run replays the same trace
+	auto next_random = [&](uint64_t range)
+	{
+		random_state ^= random_state << 13;
+		random_state ^= random_state >> 7;
+		random_state ^= random_state << 17;
+		return random_state % range;
+	};
+
+	uint64_t release_ns = 0;
+	uint64_t last_arrival_ns = 0;
+	for (uint64_t n = 0; n < TRACE_FRAMES; ++n)
+	{
+		uint64_t capture_ns = 1000000000 + n * TRACE_INTERVAL_NS;
+		while (release_ns < capture_ns)
+			release_ns += 20000000 + next_random(40000000);
+		uint64_t arrival_ns = std::max(release_ns + 1000000 + next_random(500000), last_arrival_ns);
+		trace.push_back({ capture_ns, arrival_ns });
+		last_arrival_ns = arrival_ns;
+	}
+	return trace;
+}
+
+static std::vector<trace_frame> load_trace(const char* filepath)
+{
+	std::vector<trace_frame> trace;
+	std::ifstream file(filepath, std::ios::binary);
+
+	// Flight recorder dumps hold both times of each received frame
+	flight_header header = { };
+	if (file.read((char*)&header, sizeof(header)) && header.magic == FLIGHT_MAGIC && header.record_size == sizeof(flight_record))
+	{
+		flight_record record;
+		for (uint64_t n = 0; n < header.record_count && file.read((char*)&record, sizeof(record)); ++n)
+		{
+			if (record.stage == Flight_Recorder::RECEIVE && record.latency_ns != 0)
+				trace.push_back({ record.stage_ns - record.latency_ns, record.stage_ns });
+		}
+		return trace;
+	}
+	file.clear();
+	file.seekg(0);
+
+	uint64_t capture_us = 0;
+	uint64_t arrival_us = 0;
+	while (file >> capture_us >> arrival_us)
+		trace.push_back({ capture_us * 1000, arrival_us * 1000 });
+	return trace;
+}
+
+// Plays the trace through a jitter buffer in simulated time, as forward_to_virtual_device schedules it
+static void run_jitter_benchmark(const std::vector<trace_frame>& trace, uint64_t budget_ms)
+{
+	Jitter_Buffer jitter_buffer;
+	jitter_buffer.set_budget(budget_ms * 1000000);
+	std::vector<struct input_event> ev_list;
+	std::vector<uint64_t> capture_times;
+	std::vector<uint64_t> output_times;
+	uint64_t capture_ns = 0;
+
+	auto output = [&](uint64_t at_ns)
+	{
+		capture_times.push_back(capture_ns);
+		output_times.push_back(at_ns);
+	};
+
+	for (const trace_frame& frame : trace)
+	{
+		for (uint64_t due_ns; (due_ns = jitter_buffer.return_next_due()) <= frame.arrival_ns;)
+		{
+			jitter_buffer.pop(ev_list, capture_ns);
+			output(due_ns);
+		}
+
+		struct input_event ev = { };
+		ev.type = EV_REL;
+		ev.code = REL_X;
+		ev.value = 1;
+		ev_list.assign(1, ev);
+		if (!jitter_buffer.push(ev_list, frame.capture_ns, frame.arrival_ns))
+		{
+			uint64_t late_capture_ns = frame.capture_ns;
+			while (jitter_buffer.pop(ev_list, capture_ns))
+				output(frame.arrival_ns);
+			capture_ns = late_capture_ns;
+			output(frame.arrival_ns);
+		}
+	}
+	for (uint64_t due_ns; (due_ns = jitter_buffer.return_next_due()) != Jitter_Buffer::NOT_DUE;)
+	{
+		jitter_buffer.pop(ev_list, capture_ns);
+		output(due_ns);
+	}
+
+	double interval_sum = 0;
+	double interval_square_sum = 0;
+	uint64_t latency_sum = 0;
+	for (std::size_t n = 0; n < output_times.size(); ++n)
+	{
+		latency_sum += output_times[n] - capture_times[n];
+		if (n == 0)
+			continue;
+		double interval_ms = (output_times[n] - output_times[n - 1]) / 1e6;
+		interval_sum += interval_ms;
+		interval_square_sum += interval_ms * interval_ms;
+	}
+	double interval_cnt = output_times.size() - 1;
+	double mean_ms = interval_sum / interval_cnt;
+
+	std::cout << "jitter budget " << budget_ms << " ms: interval mean " << mean_ms << " ms, stddev "
+		<< std::sqrt(std::max(0.0, interval_square_sum / interval_cnt - mean_ms * mean_ms)) << " ms, mean latency "
+		<< latency_sum / output_times.size() / 1000 << " us" << std::endl;
+}
+
+static void run_priority_benchmark(bool is_prioritized)
+{
+	const char* name = is_prioritized ? "priority classes" : "single FIFO";
+	WiFi_Server server(PRIORITY_ADDRESS);
+	server.begin_listening();
+
+	WiFi_Client client;
+	client.set_server_addr(PRIORITY_ADDRESS);
+	client.connect_to_server();
+	client.wait_until_connected();
+	server.wait_for_connection();
+
+	Frame_Scheduler scheduler;
+	scheduler.set_prioritized(is_prioritized);
+	std::atomic_bool is_flooding{true};
+	Latency_Histogram key_latency;
+	uint64_t motion_queued = 0;
+	uint64_t held_back = 0;
+	std::atomic_uint64_t motion_received{0};
+
+	// Stands in for the capture threads, stamping each frame with the time it is queued
+	auto queue_frame = [&](const struct input_event* ev_list, uint64_t event_cnt)
+	{
+		void* p_frame = Frame_Pool::acquire();
+		uint64_t* p_event_count = (uint64_t*)p_frame;
+		struct input_event* event_queue = (struct input_event*)(p_event_count + 1);
+		uint64_t now_ns = monotonic_ns();
+		for (uint64_t n = 0; n < event_cnt; ++n)
+		{
+			event_queue[n] = ev_list[n];
+			event_queue[n].input_event_sec = now_ns / 1000000000;
+			event_queue[n].input_event_usec = now_ns % 1000000000 / 1000;
+		}
+		*p_event_count = event_cnt;
+		Frame_Pool::set_queued_time(p_frame, now_ns);
+
+		// A full queue holds the producer back, like it does the capture threads
+		Frame_Scheduler::Frame_Class frame_class = Frame_Scheduler::classify(p_frame);
+		if (!scheduler.push(p_frame, frame_class))
+		{
+			++held_back;
+			do
+				scheduler.wait_for_room(frame_class);
+			while (!scheduler.push(p_frame, frame_class));
+		}
+	};
+
+	std::thread receiver([&]
+	{
+		uint64_t* p_data = nullptr;
+		while ((p_data = (uint64_t*)server.read_sent_data_packet()) != nullptr)
+		{
+			const struct input_event* event_queue = (const struct input_event*)(p_data + 1);
+			if (*p_data != 0 && event_queue[0].type == EV_KEY)
+				key_latency.record(monotonic_ns() - ((uint64_t)event_queue[0].input_event_sec * 1000000000 + event_queue[0].input_event_usec * 1000ull));
+			else if (*p_data != 0)
+				motion_received.fetch_add(1, std::memory_order_relaxed);
+			free(p_data);
+		}
+	});
+
+	// Stands in for the watchdog, sending over a link that takes LINK_FRAME_NS per frame
+	std::thread sender([&]
+	{
+		uint64_t next_send_ns = 0;
+		uint64_t frame_cnt = 0;
+		while (is_flooding.load(std::memory_order_acquire) || scheduler.size())
+		{
+			uint64_t now_ns = monotonic_ns();
+			if (now_ns < next_send_ns)
+				std::this_thread::sleep_for(std::chrono::nanoseconds(next_send_ns - now_ns));
+
+			void* p_frame = scheduler.pop(frame_cnt);
+			if (p_frame == nullptr)
+			{
+				std::this_thread::sleep_for(std::chrono::microseconds(50));
+				continue;
+			}
+			client.send_formatted_data(p_frame, sizeof(struct input_event));
+			next_send_ns = monotonic_ns() + LINK_FRAME_NS;
+			Frame_Pool::release(p_frame);
+		}
+	});
+
+	struct input_event mouse_events[2] = { };
+	mouse_events[0].type = EV_REL;
+	mouse_events[0].code = REL_X;
+	mouse_events[0].value = 1;
+	mouse_events[1].type = EV_REL;
+	mouse_events[1].code = REL_Y;
+	mouse_events[1].value = 1;
+	struct input_event key_event = { };
+	key_event.type = EV_KEY;
+	key_event.code = KEY_A;
+
+	uint64_t start_ns = monotonic_ns();
+	uint64_t next_mouse_ns = start_ns;
+	uint64_t next_key_ns = start_ns + KEY_INTERVAL_NS;
+	for (uint64_t now_ns = start_ns; now_ns < start_ns + FLOOD_NS; now_ns = monotonic_ns())
+	{
+		if (now_ns >= next_key_ns)
+		{
+			key_event.value = !key_event.value;
+			queue_frame(&key_event, 1);
+			next_key_ns += KEY_INTERVAL_NS;
+		}
+		if (now_ns >= next_mouse_ns)
+		{
+			queue_frame(mouse_events, 2);
+			++motion_queued;
+			next_mouse_ns += MOUSE_INTERVAL_NS;
+		}
+		uint64_t wake_ns = std::min(next_key_ns, next_mouse_ns);
+		now_ns = monotonic_ns();
+		if (wake_ns > now_ns)
+			std::this_thread::sleep_for(std::chrono::nanoseconds(wake_ns - now_ns));
+	}
+	is_flooding.store(false, std::memory_order_release);
+	sender.join();
+	client.close_connection();
+	receiver.join();
+	server.close_connection();
+
+	std::cout << key_latency.report(std::string(name) + " key press latency");
+	std::cout << name << ": " << motion_queued << " motion frames queued, " << motion_received.load() << " sent, "
+		<< held_back << " frames held back by a full queue" << std::endl;
+}
+
+static void run_counting_benchmark(const char* name, void (*count)(), bool is_scraped)
+{
+	std::atomic_bool is_counting{true};
+	uint64_t scrape_cnt = 0;
+	std::thread scraper([&]
+	{
+		while (is_scraped && is_counting.load(std::memory_order_acquire))
+		{
+			Metrics::return_report();
+			++scrape_cnt;
+		}
+	});
+
+	std::vector<std::thread> threads;
+	uint64_t start_ns = monotonic_ns();
+	for (unsigned n = 0; n < COUNTING_THREADS; ++n)
+	{
+		threads.emplace_back([count]
+		{
+			for (uint64_t m = 0; m < COUNTS_PER_THREAD; ++m)
+				count();
+		});
+	}
+	for (std::thread& thread : threads)
+		thread.join();
+	uint64_t elapsed_ns = monotonic_ns() - start_ns;
+	is_counting.store(false, std::memory_order_release);
+	scraper.join();
+
+	std::cout << name << (is_scraped ? " while scraped: " : ": ") << (double)elapsed_ns / (COUNTING_THREADS * COUNTS_PER_THREAD)
+		<< " ns per increment over " << COUNTING_THREADS << " threads";
+	if (is_scraped)
+		std::cout << ", " << scrape_cnt << " scrapes";
+	std::cout << std::endl;
+}
+
+static std::atomic_uint64_t shared_counter{0};
+
+static void run_metrics_benchmark()
+{
+	run_counting_benchmark("shared atomic", [] { shared_counter.fetch_add(1, std::memory_order_relaxed); }, false);
+	run_counting_benchmark("per-thread counters", [] { Metrics::add(Metrics::FRAMES_CAPTURED); }, false);
+	run_counting_benchmark("per-thread counters", [] { Metrics::add(Metrics::FRAMES_CAPTURED); }, true);
+
+	uint64_t expected = 2 * COUNTING_THREADS * COUNTS_PER_THREAD;
+	uint64_t counted = Metrics::return_count(Metrics::FRAMES_CAPTURED);
+	std::cout << "metrics: " << counted << " of " << expected << " increments counted after the threads exited" << std::endl;
+
+	Socket_Address endpoint_addr;
+	endpoint_addr.parse(METRICS_ADDRESS, 0);
+	if (!Metrics::start_endpoint(METRICS_ADDRESS))
+	{
+		std::cout << "metrics endpoint " << METRICS_ADDRESS << " unavailable" << std::endl;
+		return;
+	}
+
+	int scrape_fd = socket(endpoint_addr.return_family(), SOCK_STREAM, 0);
+	std::string response;
+	if (connect(scrape_fd, endpoint_addr.return_sockaddr(), endpoint_addr.return_sockaddr_len()) == 0)
+	{
+		const char request[] = "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n";
+		send(scrape_fd, request, sizeof(request) - 1, MSG_NOSIGNAL);
+		char buffer[4096];
+		ssize_t bytes_read;
+		while ((bytes_read = recv(scrape_fd, buffer, sizeof(buffer), 0)) > 0)
+			response.append(buffer, bytes_read);
+	}
+	close(scrape_fd);
+	Metrics::stop_endpoint();
+
+	std::size_t line_end = response.find("\r\n");
+	std::size_t sample_pos = response.find("\nunikey_frames_captured_total ");
+	std::cout << "metrics scrape: " << response.substr(0, line_end) << ", " << response.size() << " bytes";
+	if (sample_pos != std::string::npos)
+		std::cout << ", " << response.substr(sample_pos + 1, response.find('\n', sample_pos + 1) - sample_pos - 1);
+	std::cout << std::endl;
+}
+
+static std::size_t count_dumps(const std::string& directory)
+{
+	std::size_t dump_cnt = 0;
+	for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(directory))
+		dump_cnt += (entry.path().filename().string().rfind("unikey-flight-", 0) == 0);
+	return dump_cnt;
+}
+
+static void run_flight_benchmark()
+{
+	char directory[] = "/tmp/unikey-flight-benchmark-XXXXXX";
+	if (mkdtemp(directory) == nullptr || !Flight_Recorder::start(directory))
+	{
+		std::cout << "flight recorder unavailable" << std::endl;
+		return;
+	}
+
+	// One key press frame, stamped like the capture threads stamp it
+	uint64_t frame[1 + sizeof(struct input_event) / sizeof(uint64_t)] = { 1 };
+	struct input_event* p_event = (struct input_event*)(frame + 1);
+	p_event->type = EV_KEY;
+	p_event->code = KEY_A;
+	p_event->value = 1;
+	uint64_t capture_ns = monotonic_ns();
+	p_event->input_event_sec = capture_ns / 1000000000;
+	p_event->input_event_usec = capture_ns % 1000000000 / 1000;
+
+	std::vector<std::thread> threads;
+	uint64_t start_ns = monotonic_ns();
+	for (unsigned n = 0; n < COUNTING_THREADS; ++n)
+	{
+		threads.emplace_back([&frame, capture_ns]
+		{
+			for (uint64_t m = 0; m < RECORDS_PER_THREAD; ++m)
+				Flight_Recorder::record_frame(Flight_Recorder::CAPTURE, frame, capture_ns + m);
+		});
+	}
+	for (std::thread& thread : threads)
+		thread.join();
+	std::cout << "flight recorder: " << (double)(monotonic_ns() - start_ns) / (COUNTING_THREADS * RECORDS_PER_THREAD)
+		<< " ns per record over " << COUNTING_THREADS << " threads" << std::endl;
+
+	std::string dump_path = Flight_Recorder::dump(Flight_Recorder::ON_REQUEST);
+	flight_header header = { };
+	std::ifstream dump(dump_path, std::ios::binary);
+	if (dump_path.size() != 0 && dump.read((char*)&header, sizeof(header)))
+		std::cout << "flight dump on request: " << header.record_count << " of " << FLIGHT_RING_SIZE << " records, "
+			<< std::filesystem::file_size(dump_path) << " bytes" << std::endl;
+	else
+		std::cout << "flight dump on request: FAILED" << std::endl;
+
+	std::size_t dump_cnt = count_dumps(directory);
+	kill(getpid(), SIGUSR1);
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	std::cout << "flight dump on SIGUSR1: " << count_dumps(directory) - dump_cnt << " written" << std::endl;
+
+	// Only the first frame over the threshold dumps, after the post-trigger wait
+	dump_cnt = count_dumps(directory);
+	Flight_Recorder::set_threshold(FLIGHT_THRESHOLD_NS);
+	for (unsigned n = 0; n < 8; ++n)
+		Flight_Recorder::record_frame(Flight_Recorder::INJECT, frame, capture_ns + 2 * FLIGHT_THRESHOLD_NS + n);
+	std::this_thread::sleep_for(std::chrono::milliseconds(400));
+	std::cout << "flight dump past the threshold: " << count_dumps(directory) - dump_cnt << " written for 8 slow frames" << std::endl;
+
+	Flight_Recorder::set_threshold(0);
+	Flight_Recorder::stop();
+	std::filesystem::remove_all(directory);
+}
+
+// Device::default_event_processor before the logger: one stream insertion per event and a flush per frame
+static void print_frame_with_iostream(const void* data)
+{
+	uint64_t& LENGTH = *(uint64_t*)data;
+	const struct input_event* ev = (struct input_event*)(&LENGTH + 1);
+	for (uint64_t n = 0; n < LENGTH; ++n)
+	{
+		std::cout << libevdev_event_code_get_name(ev[n].type, ev[n].code) << ',' << ev[n].value << ((n % 4 == 3) ? "\n" : "\t\t");
+	}
+	std::cout << std::endl;
+}
+
+// Device::default_event_processor as it is now
+static void print_frame_with_logger(const void* data)
+{
+	uint64_t& LENGTH = *(uint64_t*)data;
+	const struct input_event* ev = (struct input_event*)(&LENGTH + 1);
+	for (uint64_t n = 0; n < LENGTH; n += 4)
+	{
+		char line[192];
+		std::size_t used = 0;
+		for (uint64_t m = n; m < LENGTH && m < n + 4 && used < sizeof(line); ++m)
+		{
+			const char* name = libevdev_event_code_get_name(ev[m].type, ev[m].code);
+			used += snprintf(line + used, sizeof(line) - used, "%s,%d\t\t", (name != nullptr) ? name : "?", ev[m].value);
+		}
+		Logger::log(Logger::INFO, "%s", line);
+	}
+}
+
+static void run_processor_benchmark(const char* name, void (*process)(const void*))
+{
+	static constexpr uint16_t EVENT_CODES[][2] = { { EV_REL, REL_X }, { EV_REL, REL_Y }, { EV_KEY, BTN_LEFT }, { EV_REL, REL_WHEEL } };
+
+	uint64_t frame[1 + FRAME_EVENTS * sizeof(struct input_event) / sizeof(uint64_t)] = { FRAME_EVENTS };
+	struct input_event* event_queue = (struct input_event*)(frame + 1);
+	for (uint64_t n = 0; n < FRAME_EVENTS; ++n)
+	{
+		memset(&event_queue[n], 0, sizeof(struct input_event));
+		event_queue[n].type = EVENT_CODES[n % 4][0];
+		event_queue[n].code = EVENT_CODES[n % 4][1];
+		event_queue[n].value = (int32_t)n;
+	}
+
+	// Standard output goes to a pipe that is read slowly until the run is over
+	int pipe_fds[2];
+	if (pipe(pipe_fds) < 0)
+		return;
+	std::cout.flush();
+	int stdout_fd = dup(STDOUT_FILENO);
+	dup2(pipe_fds[1], STDOUT_FILENO);
+	close(pipe_fds[1]);
+	std::thread drain([&]
+	{
+		char buffer[4096];
+		while (read(pipe_fds[0], buffer, sizeof(buffer)) > 0)
+			std::this_thread::sleep_for(std::chrono::microseconds(DRAIN_PAUSE_US));
+	});
+
+	Latency_Histogram frame_latency;
+	uint64_t dropped_cnt = Logger::return_dropped_count();
+	uint64_t start_ns = monotonic_ns();
+	for (uint64_t n = 0; n < PROCESSOR_FRAMES; ++n)
+	{
+		uint64_t frame_start_ns = monotonic_ns();
+		process(frame);
+		frame_latency.record(monotonic_ns() - frame_start_ns);
+	}
+	uint64_t elapsed_ns = monotonic_ns() - start_ns;
+	dropped_cnt = Logger::return_dropped_count() - dropped_cnt;
+
+	std::cout.flush();
+	std::this_thread::sleep_for(std::chrono::milliseconds(500));	// The logger's flusher empties its ring
+	dup2(stdout_fd, STDOUT_FILENO);	// Closes the pipe, which ends the drain
+	close(stdout_fd);
+	drain.join();
+	close(pipe_fds[0]);
+
+	std::cout << frame_latency.report(std::string(name) + " processing time per frame");
+	std::cout << name << ": " << elapsed_ns / PROCESSOR_FRAMES << " ns per frame on average, "
+		<< dropped_cnt << " log lines dropped" << std::endl;
+}
+
+static void run_filter_benchmark(const char* name, bool is_swapping)
+{
+	// Typing mixed with pointer motion, half of the keys remapped or dropped by the profile
+	static constexpr uint16_t EVENTS[][2] = {
+		{ EV_KEY, KEY_CAPSLOCK }, { EV_REL, REL_X }, { EV_KEY, KEY_A },
+		{ EV_REL, REL_Y }, { EV_KEY, KEY_F13 }, { EV_KEY, KEY_Z }
+	};
+	static constexpr uint64_t EVENT_KINDS = sizeof(EVENTS) / sizeof(EVENTS[0]);
+
+	std::atomic_bool is_filtering{true};
+	uint64_t swap_cnt = 0;
+	uint64_t swap_ns = 0;
+	std::thread swapper([&]
+	{
+		while (is_swapping && is_filtering.load(std::memory_order_acquire))
+		{
+			uint64_t start_ns = monotonic_ns();
+			Event_Filter::use_profile((swap_cnt % 2 == 0) ? "bench-alt" : "bench");
+			swap_ns += monotonic_ns() - start_ns;
+			++swap_cnt;
+			std::this_thread::sleep_for(std::chrono::microseconds(SWAP_PAUSE_US));
+		}
+	});
+
+	uint64_t kept_cnt = 0;
+	uint64_t start_ns = monotonic_ns();
+	for (uint64_t n = 0; n < FILTER_EVENTS; ++n)
+	{
+		struct input_event ev = { };
+		ev.type = EVENTS[n % EVENT_KINDS][0];
+		ev.code = EVENTS[n % EVENT_KINDS][1];
+		ev.value = 1;
+		kept_cnt += Event_Filter::apply(ev);
+	}
+	uint64_t elapsed_ns = monotonic_ns() - start_ns;
+	is_filtering.store(false, std::memory_order_release);
+	swapper.join();
+
+	std::cout << name << ": " << (double)elapsed_ns / FILTER_EVENTS << " ns per event, " << kept_cnt << " of " << FILTER_EVENTS << " kept";
+	if (is_swapping && swap_cnt != 0)
+		std::cout << ", " << swap_cnt << " switches at " << swap_ns / swap_cnt << " ns each";
+	std::cout << std::endl;
+}
+
+// Opens a node and reads its capabilities, the work every probed candidate costs
+static bool probe_node(const std::string& devnode)
+{
+	int fd = open(devnode.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	struct libevdev* dev = nullptr;
+	bool is_probed = (libevdev_new_from_fd(fd, &dev) == 0);
+	libevdev_free(dev);
+	close(fd);
+	return is_probed;
+}
+
+static void run_discovery_benchmark()
+{
+	std::vector<struct libevdev_uinput*> nodes;
+	for (unsigned n = 0; n < DISCOVERY_NODES; ++n)
+	{
+		struct libevdev* dev = libevdev_new();
+		libevdev_set_name(dev, "Unikey Discovery Benchmark");
+		if (n % 2 == 0)
+		{
+			for (unsigned code = KEY_ESC; code <= KEY_D; ++code)
+				libevdev_enable_event_code(dev, EV_KEY, code, nullptr);
+		}
+		else
+			libevdev_enable_event_code(dev, EV_SW, SW_LID, nullptr);
+
+		struct libevdev_uinput* uidev = nullptr;
+		if (libevdev_uinput_create_from_device(dev, LIBEVDEV_UINPUT_OPEN_MANAGED, &uidev) == 0)
+			nodes.push_back(uidev);
+		libevdev_free(dev);
+	}
+	if (nodes.empty())
+	{
+		std::cout << "discovery needs access to /dev/uinput" << std::endl;
+		return;
+	}
+	std::this_thread::sleep_for(std::chrono::seconds(1));	// Lets udev tag the new nodes
+
+	// The old startup path, every event node opened and probed in turn
+	unsigned scanned_cnt = 0;
+	std::error_code error;
+	uint64_t start_ns = monotonic_ns();
+	for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator("/dev/input", error))
+	{
+		if (entry.path().filename().string().starts_with("event"))
+		{
+			probe_node(entry.path().string());
+			++scanned_cnt;
+		}
+	}
+	uint64_t scan_ns = monotonic_ns() - start_ns;
+
+	start_ns = monotonic_ns();
+	std::vector<std::string> candidates = Device::return_input_candidates("/dev/input");
+	uint64_t enumerate_ns = monotonic_ns() - start_ns;
+	std::atomic<std::size_t> next_candidate{0};
+	std::vector<std::thread> probe_threads;
+	for (unsigned n = 0; n < PROBE_THREADS; ++n)
+	{
+		probe_threads.emplace_back([&]
+		{
+			for (std::size_t m = next_candidate.fetch_add(1); m < candidates.size(); m = next_candidate.fetch_add(1))
+				probe_node(candidates[m]);
+		});
+	}
+	for (std::thread& probe_thread : probe_threads)
+		probe_thread.join();
+	uint64_t discovery_ns = monotonic_ns() - start_ns;
+
+	std::cout << "discovery scan: " << scanned_cnt << " nodes opened and probed serially in " << scan_ns / 1000 << " us" << std::endl;
+	std::cout << "discovery udev: " << candidates.size() << " candidates enumerated in " << enumerate_ns / 1000 << " us, probed on "
+		<< PROBE_THREADS << " threads " << discovery_ns / 1000 << " us after the start" << std::endl;
+
+	for (struct libevdev_uinput* uidev : nodes)
+		libevdev_uinput_destroy(uidev);
+}
+
+int main(int argc, char** argv)
+{
+	std::vector<uint8_t> psk(32);
+	getrandom(psk.data(), psk.size(), 0);	// Both ends live in this process
+	Secure_Channel::set_psk(psk);
+
+	for (const transport& bench : TRANSPORTS)
+	{
+		bool is_selected = (argc == 1);
+		for (int n = 1; n < argc; ++n)
+			is_selected |= (strcmp(argv[n], bench.name) == 0);
+
+		if (is_selected)
+			run_benchmark(bench);
+	}
+
+	bool run_uinput = (argc == 1);
+	for (int n = 1; n < argc; ++n)
+		run_uinput |= (strcmp(argv[n], "uinput") == 0);
+	if (run_uinput)
+	{
+		run_uinput_benchmark(false);
+		run_uinput_benchmark(true);
+	}
+
+	bool run_clock = (argc == 1);
+	for (int n = 1; n < argc; ++n)
+		run_clock |= (strcmp(argv[n], "clock") == 0);
+	if (run_clock)
+		run_clock_benchmark();
+
+	bool run_priority = (argc == 1);
+	for (int n = 1; n < argc; ++n)
+		run_priority |= (strcmp(argv[n], "priority") == 0);
+	if (run_priority)
+	{
+		run_priority_benchmark(false);
+		run_priority_benchmark(true);
+	}
+
+	bool run_metrics = (argc == 1);
+	for (int n = 1; n < argc; ++n)
+		run_metrics |= (strcmp(argv[n], "metrics") == 0);
+	if (run_metrics)
+		run_metrics_benchmark();
+
+	bool run_flight = (argc == 1);
+	for (int n = 1; n < argc; ++n)
+		run_flight |= (strcmp(argv[n], "flight") == 0);
+	if (run_flight)
+		run_flight_benchmark();
+
+	bool run_logging = (argc == 1);
+	for (int n = 1; n < argc; ++n)
+		run_logging |= (strcmp(argv[n], "logging") == 0);
+	if (run_logging)
+	{
+		run_processor_benchmark("iostream processor", &print_frame_with_iostream);
+		run_processor_benchmark("logger processor", &print_frame_with_logger);
+	}
+
+	bool run_filter = (argc == 1);
+	for (int n = 1; n < argc; ++n)
+		run_filter |= (strcmp(argv[n], "filter") == 0);
+	if (run_filter)
+	{
+		Event_Filter::add_rule("bench", "KEY_CAPSLOCK=KEY_LEFTCTRL");
+		Event_Filter::add_rule("bench", "KEY_F13=");
+		Event_Filter::add_rule("bench-alt", "KEY_Z=KEY_Y");
+		run_filter_benchmark("filter without profile", false);
+		Event_Filter::use_profile("bench");
+		run_filter_benchmark("filter with profile", false);
+		run_filter_benchmark("filter under profile switches", true);
+		Event_Filter::use_profile("");
+		Event_Filter::reclaim();
+	}
+
+	bool run_discovery = (argc == 1);
+	for (int n = 1; n < argc; ++n)
+		run_discovery |= (strcmp(argv[n], "discovery") == 0);
+	if (run_discovery)
+		run_discovery_benchmark();
+
+	bool run_jitter = (argc == 1);
+	const char* trace_path = nullptr;
+	for (int n = 1; n < argc; ++n)
+	{
+		run_jitter |= (strcmp(argv[n], "jitter") == 0);
+		if (strncmp(argv[n], "jitter=", 7) == 0)
+		{
+			run_jitter = true;
+			trace_path = argv[n] + 7;
+		}
+	}
+	if (run_jitter)
+	{
+		std::vector<trace_frame> trace = (trace_path != nullptr) ? load_trace(trace_path) : generate_bursty_trace();
+		if (trace.size() < 2)
+			std::cout << "jitter trace " << trace_path << " holds fewer than two frames" << std::endl;
+		else
+		{
+			for (uint64_t budget_ms : JITTER_BUDGETS_MS)
+				run_jitter_benchmark(trace, budget_ms);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,743 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <random>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <linux/input.h>
+#include <unistd.h>
+
+#include "libevdev/libevdev.h"
+#include "libevdev/libevdev-uinput.h"
+
+#include "Chord_Matcher.hpp"
+#include "Device.hpp"
+#include "Epoch_Domain.hpp"
+#include "Event_Filter.hpp"
+#include "Frame_Pool.hpp"
+#include "Frame_Scheduler.hpp"
+#include "Slot_Map.hpp"
+
+/*
+	Checks the parts of the pipeline that can run without devices or a
+	network, and exits non-zero when any check fails. Registered with CTest.
+	"chords" replays recorded key traces through the chord matcher and
+	compares the trigger after every event with the one expected.
+	"frames" has several threads fill frames of up to 1000 events, growing
+	them through the size classes, and release half of them on another
+	thread, then checks no frame was ever handed to two owners at once.
+	"resync" creates a synthetic keyboard through uinput, captures it, and
+	writes key bursts far larger than the kernel's evdev buffer in single
+	writes so the buffer overflows. The keys forwarded after every resync
+	must match the keys left held, and nothing may stay held after the
+	final release. It needs access to /dev/uinput and is skipped otherwise.
+	"slots" churns the device slot map with 200k random inserts and erases
+	against a reference map, checks that no stale handle ever resolves and
+	that the slots are reused, and reports the cost per operation with few
+	and with many devices present.
+	"epochs" has reader threads walk the published snapshot without pause
+	while a writer swaps it 200k times, retiring the old one each time,
+	and checks no reader ever saw a freed snapshot and nothing leaked.
+	"scheduler" queues a press as a key frame and its release as a control
+	frame, checks they leave in the order they were queued, and checks a
+	full queue refuses frames until one is popped.
+	"filter" checks remapped, dropped and untouched codes under a profile,
+	that rule changes on the active profile apply at once, and that reader
+	threads only ever see one of two profiles while a writer swaps between
+	them and rebuilds the active one.
+	Usage: unikey_self_test [chords|frames|resync|slots|epochs|scheduler|filter]...
+*/
+
+static constexpr unsigned POOL_THREADS = 4;
+static constexpr uint64_t POOL_ROUNDS = 20000;
+static constexpr uint64_t FUZZ_EVENTS = 1000;
+static constexpr unsigned RESYNC_ROUNDS = 200;
+static constexpr unsigned RESYNC_BURST = 512;	// Key transitions per write, the evdev buffer holds 64 events
+static constexpr unsigned RESYNC_FIRST_KEY = KEY_1;
+static constexpr unsigned RESYNC_KEYS = 40;	// KEY_1 to KEY_APOSTROPHE, clear of every default chord
+static constexpr uint64_t SLOT_OPERATIONS = 200000;
+static constexpr std::size_t SLOT_POPULATIONS[] = { 16, 4096 };
+static constexpr unsigned EPOCH_READERS = 4;
+static constexpr uint64_t EPOCH_SWAPS = 200000;
+static constexpr unsigned SNAPSHOT_DEVICES = 16;
+static constexpr unsigned FILTER_READERS = 4;
+static constexpr uint64_t FILTER_SWAPS = 100000;
+static constexpr uint64_t FILTER_REBUILD_INTERVAL = 100;	// Swaps between rule changes on the active profile
+
+struct trace_step
+{
+	unsigned code;
+	int value;
+	Chord_Matcher::Action expected;
+};
+
+struct chord_trace
+{
+	const char* name;
+	std::vector<trace_step> steps;
+};
+
+static uint32_t dispatched_slot = 0;
+
+static void record_switch(uint32_t slot)
+{
+	dispatched_slot = slot;
+}
+
+static bool run_chord_tests()
+{
+	static const std::vector<unsigned> EXIT_CHORD = { KEY_LEFTCTRL, KEY_LEFTALT, KEY_ESC };
+	static const std::vector<unsigned> GRAB_CHORD = { KEY_LEFTCTRL, KEY_LEFTALT };
+	static const std::vector<unsigned> UNGRAB_CHORD = { KEY_POWER };
+	static constexpr Chord_Matcher::Action NONE = Chord_Matcher::NONE;
+	static constexpr Chord_Matcher::Action EXIT = Chord_Matcher::EXIT;
+	static constexpr Chord_Matcher::Action TOGGLE_GRAB = Chord_Matcher::TOGGLE_GRAB;
+	static constexpr Chord_Matcher::Action UNGRAB = Chord_Matcher::UNGRAB;
+
+	// Recorded from a keyboard, as the capture thread hands them over: autorepeats included, SYN_REPORTs left out
+	static const chord_trace TRACES[] = {
+		{ "chord fires on the last release", {
+			{ KEY_LEFTCTRL, 1, NONE }, { KEY_LEFTALT, 1, NONE }, { KEY_ESC, 1, NONE },
+			{ KEY_ESC, 0, NONE }, { KEY_LEFTALT, 0, NONE }, { KEY_LEFTCTRL, 0, EXIT }
+		} },
+		{ "release order does not matter", {
+			{ KEY_LEFTALT, 1, NONE }, { KEY_ESC, 1, NONE }, { KEY_LEFTCTRL, 1, NONE },
+			{ KEY_LEFTCTRL, 0, NONE }, { KEY_ESC, 0, NONE }, { KEY_LEFTALT, 0, EXIT }
+		} },
+		{ "autorepeats are ignored", {
+			{ KEY_LEFTCTRL, 1, NONE }, { KEY_LEFTALT, 1, NONE }, { KEY_ESC, 1, NONE },
+			{ KEY_ESC, 2, NONE }, { KEY_ESC, 2, NONE }, { KEY_LEFTCTRL, 2, NONE },
+			{ KEY_LEFTALT, 0, NONE }, { KEY_LEFTCTRL, 0, NONE }, { KEY_ESC, 0, EXIT }
+		} },
+		{ "subset chord fires on its own", {
+			{ KEY_LEFTCTRL, 1, NONE }, { KEY_LEFTALT, 1, NONE },
+			{ KEY_LEFTALT, 0, NONE }, { KEY_LEFTCTRL, 0, TOGGLE_GRAB }
+		} },
+		{ "extra key disarms the chord", {
+			{ KEY_LEFTCTRL, 1, NONE }, { KEY_LEFTALT, 1, NONE }, { KEY_ESC, 1, NONE },
+			{ KEY_A, 1, NONE }, { KEY_A, 0, NONE },
+			{ KEY_ESC, 0, NONE }, { KEY_LEFTALT, 0, NONE }, { KEY_LEFTCTRL, 0, NONE }
+		} },
+		{ "keys outside every chord pass by", {
+			{ KEY_A, 1, NONE }, { KEY_B, 1, NONE }, { KEY_A, 0, NONE }, { KEY_B, 0, NONE }
+		} },
+		{ "partial chord never fires", {
+			{ KEY_LEFTCTRL, 1, NONE }, { KEY_ESC, 1, NONE },
+			{ KEY_ESC, 0, NONE }, { KEY_LEFTCTRL, 0, NONE }
+		} },
+		{ "re-pressed key rearms before the release", {
+			{ KEY_LEFTCTRL, 1, NONE }, { KEY_LEFTALT, 1, NONE }, { KEY_ESC, 1, NONE },
+			{ KEY_ESC, 0, NONE }, { KEY_ESC, 1, NONE },
+			{ KEY_ESC, 0, NONE }, { KEY_LEFTALT, 0, NONE }, { KEY_LEFTCTRL, 0, EXIT }
+		} },
+		{ "chord fires once per press", {
+			{ KEY_POWER, 1, NONE }, { KEY_POWER, 0, UNGRAB },
+			{ KEY_POWER, 1, NONE }, { KEY_POWER, 0, UNGRAB },
+			{ KEY_A, 1, NONE }, { KEY_A, 0, NONE }
+		} }
+	};
+
+	bool is_passed = true;
+	Chord_Matcher::clear_chords();
+	Chord_Matcher::add_chord(EXIT_CHORD, EXIT);
+	Chord_Matcher::add_chord(GRAB_CHORD, TOGGLE_GRAB);
+	Chord_Matcher::add_chord(UNGRAB_CHORD, UNGRAB);
+
+	for (const chord_trace& trace : TRACES)
+	{
+		std::size_t failed_step = trace.steps.size();
+		for (std::size_t n = 0; n < trace.steps.size() && failed_step == trace.steps.size(); ++n)
+		{
+			Chord_Matcher::Trigger fired = Chord_Matcher::process_key(trace.steps[n].code, trace.steps[n].value);
+			if (fired.action != trace.steps[n].expected)
+				failed_step = n;
+		}
+
+		if (failed_step == trace.steps.size())
+			std::cout << "chord trace \"" << trace.name << "\": ok" << std::endl;
+		else
+		{
+			std::cout << "chord trace \"" << trace.name << "\": FAILED at event " << failed_step << std::endl;
+			is_passed = false;
+		}
+		Chord_Matcher::clear_chords();	// Starts every trace from nothing held
+		Chord_Matcher::add_chord(EXIT_CHORD, EXIT);
+		Chord_Matcher::add_chord(GRAB_CHORD, TOGGLE_GRAB);
+		Chord_Matcher::add_chord(UNGRAB_CHORD, UNGRAB);
+	}
+
+	// A chord past the limits is refused and leaves the table as it was
+	std::vector<unsigned> too_many_keys;
+	for (unsigned code = KEY_F1; too_many_keys.size() <= 64; ++code)
+		too_many_keys.push_back(code);
+	bool is_refused = !Chord_Matcher::add_chord(too_many_keys, EXIT) && !Chord_Matcher::add_chord({ KEY_CNT }, EXIT)
+		&& !Chord_Matcher::add_chord({ KEY_A }, Chord_Matcher::NONE);
+	Chord_Matcher::process_key(KEY_POWER, 1);
+	is_refused &= (Chord_Matcher::process_key(KEY_POWER, 0).action == UNGRAB);
+	std::cout << "chord limits: " << (is_refused ? "ok" : "FAILED") << std::endl;
+
+	// The trigger carries its argument through to the handler
+	Chord_Matcher::add_chord({ KEY_LEFTMETA, KEY_3 }, Chord_Matcher::SWITCH_TARGET, 3);
+	Chord_Matcher::set_action_handler(Chord_Matcher::SWITCH_TARGET, &record_switch);
+	Chord_Matcher::process_key(KEY_LEFTMETA, 1);
+	Chord_Matcher::process_key(KEY_3, 1);
+	Chord_Matcher::process_key(KEY_3, 0);
+	Chord_Matcher::dispatch(Chord_Matcher::process_key(KEY_LEFTMETA, 0));
+	Chord_Matcher::set_action_handler(Chord_Matcher::SWITCH_TARGET, nullptr);
+	bool is_dispatched = (dispatched_slot == 3);
+	std::cout << "chord dispatch: " << (is_dispatched ? "ok" : "FAILED") << std::endl;
+
+	Chord_Matcher::clear_chords();
+	Chord_Matcher::reclaim();
+	return is_passed && is_refused && is_dispatched;
+}
+
+// Every event of a frame carries its owner, its round and its own index
+static bool is_frame_intact(const void* p_frame)
+{
+	const uint64_t* p_event_count = (const uint64_t*)p_frame;
+	const struct input_event* event_queue = (const struct input_event*)(p_event_count + 1);
+
+	if (*p_event_count > Frame_Pool::capacity(p_frame))
+		return false;
+	for (uint64_t n = 0; n < *p_event_count; ++n)
+	{
+		if (event_queue[n].code != event_queue[0].code || event_queue[n].value != event_queue[0].value
+			|| (uint64_t)event_queue[n].input_event_sec != n)
+			return false;
+	}
+	return true;
+}
+
+static bool run_frame_pool_tests()
+{
+	std::atomic<void*> handoffs[POOL_THREADS] = { nullptr };
+	std::atomic_uint64_t failure_cnt{0};
+	std::vector<std::thread> threads;
+
+	for (unsigned thread_index = 0; thread_index < POOL_THREADS; ++thread_index)
+	{
+		threads.emplace_back([&, thread_index]
+		{
+			std::mt19937_64 random(thread_index);
+			for (uint64_t round = 0; round < POOL_ROUNDS; ++round)
+			{
+				// A reused frame must not hand on the times of the frame it last held
+				void* p_frame = Frame_Pool::acquire();
+				if (Frame_Pool::return_read_time(p_frame) != 0 || Frame_Pool::return_queued_time(p_frame) != 0)
+					failure_cnt.fetch_add(1, std::memory_order_relaxed);
+				Frame_Pool::set_read_time(p_frame, round + 1);
+				Frame_Pool::set_queued_time(p_frame, round + 1);
+				uint64_t event_cnt = random() % (FUZZ_EVENTS + 1);
+				for (uint64_t n = 0; n < event_cnt; ++n)
+				{
+					// Filled the way the capture thread fills frames, growing once full
+					if (*(uint64_t*)p_frame == Frame_Pool::capacity(p_frame))
+						p_frame = Frame_Pool::grow(p_frame);
+
+					struct input_event* p_ev = (struct input_event*)((uint64_t*)p_frame + 1) + n;
+					memset(p_ev, 0, sizeof(struct input_event));
+					p_ev->input_event_sec = n;
+					p_ev->type = EV_MSC;
+					p_ev->code = thread_index;
+					p_ev->value = (int32_t)round;
+					++*(uint64_t*)p_frame;
+				}
+				if (!is_frame_intact(p_frame) || Frame_Pool::return_read_time(p_frame) != round + 1)	// Growing keeps the times
+					failure_cnt.fetch_add(1, std::memory_order_relaxed);
+
+				// Every other frame is released by the next thread, like frames sent by the watchdog
+				if (random() & 1)
+					p_frame = handoffs[(thread_index + 1) % POOL_THREADS].exchange(p_frame, std::memory_order_acq_rel);
+				if (p_frame != nullptr && !is_frame_intact(p_frame))
+					failure_cnt.fetch_add(1, std::memory_order_relaxed);
+				Frame_Pool::release(p_frame);
+			}
+		});
+	}
+	for (std::thread& thread : threads)
+		thread.join();
+	for (std::atomic<void*>& handoff : handoffs)
+		Frame_Pool::release(handoff.exchange(nullptr));
+	Frame_Pool::clear();
+
+	uint64_t failures = failure_cnt.load();
+	std::cout << "frame pool fuzz: " << POOL_THREADS * POOL_ROUNDS << " frames of up to " << FUZZ_EVENTS << " events, "
+		<< failures << " corrupted" << ((failures == 0) ? ", ok" : ", FAILED") << std::endl;
+	return failures == 0;
+}
+
+// Written by the watchdog thread only, read once the forwarded count has settled
+static bool forwarded_keys[KEY_CNT] = { false };
+static std::atomic_uint64_t forwarded_events{0};
+
+static void record_forwarded_keys(const void* data, uint64_t unit_size)
+{
+	static_cast<void>(unit_size);
+	const uint64_t* p_event_count = (const uint64_t*)data;
+	const struct input_event* event_queue = (const struct input_event*)(p_event_count + 1);
+
+	for (uint64_t n = 0; n < *p_event_count; ++n)
+	{
+		if (event_queue[n].type == EV_KEY && event_queue[n].code < KEY_CNT)
+			forwarded_keys[event_queue[n].code] = (event_queue[n].value != 0);
+	}
+	forwarded_events.fetch_add(*p_event_count, std::memory_order_release);
+}
+
+static void wait_until_settled()
+{
+	uint64_t event_cnt = forwarded_events.load(std::memory_order_acquire);
+	do
+	{
+		event_cnt = forwarded_events.load(std::memory_order_acquire);
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	} while (forwarded_events.load(std::memory_order_acquire) != event_cnt);
+}
+
+static unsigned count_mismatched_keys(const bool* expected_keys)
+{
+	unsigned mismatch_cnt = 0;
+	for (unsigned code = 0; code < KEY_CNT; ++code)
+		mismatch_cnt += (forwarded_keys[code] != expected_keys[code]);
+	return mismatch_cnt;
+}
+
+static bool run_resync_tests()
+{
+	if (access("/dev/uinput", W_OK) != 0)
+	{
+		std::cout << "resync stress: skipped, needs access to /dev/uinput" << std::endl;
+		return true;
+	}
+
+	struct libevdev* dev = libevdev_new();
+	struct libevdev_uinput* uidev = nullptr;
+	libevdev_set_name(dev, "unikey resync stress keyboard");
+	libevdev_enable_event_type(dev, EV_KEY);
+	for (unsigned code = RESYNC_FIRST_KEY; code < RESYNC_FIRST_KEY + RESYNC_KEYS; ++code)
+		libevdev_enable_event_code(dev, EV_KEY, code, nullptr);
+	if (libevdev_uinput_create_from_device(dev, LIBEVDEV_UINPUT_OPEN_MANAGED, &uidev) < 0)
+	{
+		std::cout << "resync stress: FAILED to create the synthetic keyboard" << std::endl;
+		libevdev_free(dev);
+		return false;
+	}
+
+	// An empty directory starts the watchdog without picking up any real device, the keyboard is added by itself
+	char scratch_directory[] = "/tmp/unikey-self-test-XXXXXX";
+	mkdtemp(scratch_directory);
+	Device::set_event_processor(&record_forwarded_keys);
+	Device::set_timeout_length(900);
+	Device::initialize_devices(scratch_directory);
+	Device::initialize_devices(libevdev_uinput_get_devnode(uidev));
+	for (unsigned n = 0; n < 100 && Device::return_device_stats().size() == 0; ++n)
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	Device::trigger_activation();
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+	bool expected_keys[KEY_CNT] = { false };
+	std::mt19937 random(RESYNC_ROUNDS);
+	std::vector<struct input_event> burst(2 * RESYNC_BURST);
+	for (unsigned round = 0; round < RESYNC_ROUNDS; ++round)
+	{
+		for (unsigned n = 0; n < RESYNC_BURST; ++n)
+		{
+			unsigned code = RESYNC_FIRST_KEY + random() % RESYNC_KEYS;
+			expected_keys[code] = !expected_keys[code];
+			burst[2 * n] = { { 0, 0 }, EV_KEY, (uint16_t)code, expected_keys[code] };
+			burst[2 * n + 1] = { { 0, 0 }, EV_SYN, SYN_REPORT, 0 };
+		}
+		// uinput injects a whole write before the capture thread can read, so the evdev buffer overflows
+		write(libevdev_uinput_get_fd(uidev), burst.data(), sizeof(struct input_event) * burst.size());
+	}
+	wait_until_settled();
+	unsigned held_mismatch_cnt = count_mismatched_keys(expected_keys);
+
+	// The final release has to leave nothing held on the target
+	burst.clear();
+	for (unsigned code = 0; code < KEY_CNT; ++code)
+	{
+		if (expected_keys[code])
+		{
+			expected_keys[code] = false;
+			burst.push_back({ { 0, 0 }, EV_KEY, (uint16_t)code, 0 });
+		}
+	}
+	burst.push_back({ { 0, 0 }, EV_SYN, SYN_REPORT, 0 });
+	write(libevdev_uinput_get_fd(uidev), burst.data(), sizeof(struct input_event) * burst.size());
+	wait_until_settled();
+	unsigned released_mismatch_cnt = count_mismatched_keys(expected_keys);
+
+	uint64_t drop_cnt = 0;
+	for (const device_stats& stats : Device::return_device_stats())
+		drop_cnt += stats.drop_count;
+
+	Device::trigger_exit();
+	libevdev_uinput_destroy(uidev);
+	libevdev_free(dev);
+	rmdir(scratch_directory);
+
+	bool is_passed = (drop_cnt != 0 && held_mismatch_cnt == 0 && released_mismatch_cnt == 0);
+	std::cout << "resync stress: " << drop_cnt << " overflows in " << RESYNC_ROUNDS << " bursts, "
+		<< held_mismatch_cnt << " keys wrong after the bursts, " << released_mismatch_cnt << " held after the release"
+		<< (is_passed ? ", ok" : ", FAILED") << std::endl;
+	return is_passed;
+}
+
+static uint64_t monotonic_ns()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+struct churn_device
+{
+	uint64_t serial;
+};
+
+static bool run_slot_map_tests()
+{
+	bool is_passed = true;
+
+	for (std::size_t population : SLOT_POPULATIONS)
+	{
+		Slot_Map<churn_device> slots;
+		std::map<uint64_t, churn_device*> live_devices;	// Handle to device, the reference
+		std::vector<uint64_t> live_handles;
+		std::vector<uint64_t> stale_handles;
+		std::mt19937_64 random(population);
+		uint64_t serial = 0;
+		uint64_t error_cnt = 0;
+
+		// Plugs and unplugs around the target population, like hotplug churn
+		for (uint64_t n = 0; n < SLOT_OPERATIONS; ++n)
+		{
+			bool is_plug = live_handles.empty() || (live_handles.size() < 2 * population && (random() % (2 * population)) >= live_handles.size());
+			if (is_plug)
+			{
+				churn_device* p_device = new churn_device{ serial++ };
+				uint64_t handle = slots.insert(p_device);
+				error_cnt += (live_devices.contains(handle) || slots.find(handle) != p_device);
+				live_devices[handle] = p_device;
+				live_handles.push_back(handle);
+			}
+			else
+			{
+				std::size_t victim = random() % live_handles.size();
+				uint64_t handle = live_handles[victim];
+				churn_device* p_device = slots.erase(handle);
+				error_cnt += (p_device != live_devices[handle] || slots.erase(handle) != nullptr);
+				delete p_device;
+				live_devices.erase(handle);
+				live_handles[victim] = live_handles.back();
+				live_handles.pop_back();
+				if (stale_handles.size() < 1024)
+					stale_handles.push_back(handle);
+			}
+		}
+
+		// A stale handle never resolves, even after its slot was reused
+		for (uint64_t handle : stale_handles)
+			error_cnt += (slots.find(handle) != nullptr);
+		std::size_t visited_cnt = 0;
+		slots.for_each([&](const churn_device* p_device)
+		{
+			++visited_cnt;
+			error_cnt += (p_device == nullptr);
+		});
+		error_cnt += (slots.size() != live_devices.size() || visited_cnt != live_devices.size());
+
+		// Freed slots are reused, so the slots never outgrow the most devices present at once
+		bool is_reused = (slots.capacity() <= 2 * population);
+
+		// Timed on its own: one device unplugged and another plugged into the freed slot
+		uint64_t start_ns = monotonic_ns();
+		for (uint64_t n = 0; n < SLOT_OPERATIONS / 2 && !live_handles.empty(); ++n)
+		{
+			uint64_t& handle = live_handles[random() % live_handles.size()];
+			handle = slots.insert(slots.erase(handle));
+		}
+		uint64_t elapsed_ns = monotonic_ns() - start_ns;
+		live_devices.clear();
+		for (uint64_t handle : live_handles)
+			live_devices[handle] = slots.find(handle);
+		is_reused &= (slots.capacity() <= 2 * population);
+		for (auto& [handle, p_device] : live_devices)
+			delete slots.erase(handle);
+
+		bool is_ok = (error_cnt == 0 && is_reused && slots.size() == 0);
+		std::cout << "slot map churn around " << population << " devices: " << SLOT_OPERATIONS << " operations, "
+			<< error_cnt << " errors, " << slots.capacity() << " slots, "
+			<< (double)elapsed_ns / (SLOT_OPERATIONS / 2) << " ns per unplug and plug" << (is_ok ? ", ok" : ", FAILED") << std::endl;
+		is_passed &= is_ok;
+	}
+	return is_passed;
+}
+
+// Stands in for the registry snapshot, poisoned before it is freed
+struct churn_snapshot
+{
+	std::atomic_bool is_live{true};
+	uint64_t generation;
+	std::vector<uint64_t> devices;
+};
+
+static bool run_epoch_tests()
+{
+	Epoch_Domain epochs;
+	std::atomic<churn_snapshot*> current{nullptr};
+	std::atomic_int64_t live_snapshots{0};
+	std::atomic_uint64_t bad_read_cnt{0};
+	std::atomic_uint64_t read_cnt{0};
+	std::atomic_bool is_stopped{false};
+
+	auto make_snapshot = [&](uint64_t generation)
+	{
+		churn_snapshot* p_snapshot = new churn_snapshot;
+		p_snapshot->generation = generation;
+		for (unsigned n = 0; n < SNAPSHOT_DEVICES; ++n)
+			p_snapshot->devices.push_back(generation + n);
+		live_snapshots.fetch_add(1, std::memory_order_relaxed);
+		return p_snapshot;
+	};
+	current.store(make_snapshot(0), std::memory_order_release);
+
+	std::vector<std::thread> readers;
+	for (unsigned n = 0; n < EPOCH_READERS; ++n)
+	{
+		readers.emplace_back([&]
+		{
+			while (!is_stopped.load(std::memory_order_acquire))
+			{
+				Epoch_Domain::Guard guard(epochs);
+				const churn_snapshot* p_snapshot = current.load(std::memory_order_acquire);
+				bool is_intact = p_snapshot->is_live.load(std::memory_order_relaxed) && p_snapshot->devices.size() == SNAPSHOT_DEVICES;
+				for (unsigned device = 0; is_intact && device < SNAPSHOT_DEVICES; ++device)
+					is_intact = (p_snapshot->devices[device] == p_snapshot->generation + device);
+				if (!is_intact)
+					bad_read_cnt.fetch_add(1, std::memory_order_relaxed);
+				read_cnt.fetch_add(1, std::memory_order_relaxed);
+			}
+		});
+	}
+
+	// The writer swaps and retires like a hotplug add or remove, and never waits for a reader
+	for (uint64_t generation = 1; generation <= EPOCH_SWAPS; ++generation)
+	{
+		churn_snapshot* p_old = current.exchange(make_snapshot(generation), std::memory_order_acq_rel);
+		epochs.retire([p_old, &live_snapshots]()
+		{
+			p_old->is_live.store(false, std::memory_order_relaxed);
+			delete p_old;
+			live_snapshots.fetch_sub(1, std::memory_order_relaxed);
+		});
+		if (generation % 64 == 0)
+			epochs.collect();
+	}
+
+	is_stopped.store(true, std::memory_order_release);
+	for (std::thread& reader : readers)
+		reader.join();
+	epochs.synchronize();
+	int64_t leaked_cnt = live_snapshots.load() - 1;
+	delete current.exchange(nullptr);
+
+	bool is_passed = (bad_read_cnt.load() == 0 && leaked_cnt == 0);
+	std::cout << "epoch churn: " << EPOCH_SWAPS << " swaps under " << read_cnt.load() << " reads, "
+		<< bad_read_cnt.load() << " freed snapshots read, " << leaked_cnt << " leaked" << (is_passed ? ", ok" : ", FAILED") << std::endl;
+	return is_passed;
+}
+
+static void* make_frame(uint16_t type, uint16_t code, int32_t value, uint64_t queued_ns)
+{
+	void* p_frame = Frame_Pool::acquire();
+	struct input_event* p_ev = (struct input_event*)((uint64_t*)p_frame + 1);
+	memset(p_ev, 0, sizeof(struct input_event));
+	p_ev->type = type;
+	p_ev->code = code;
+	p_ev->value = value;
+	*(uint64_t*)p_frame = 1;
+	Frame_Pool::set_queued_time(p_frame, queued_ns);
+	return p_frame;
+}
+
+static bool run_scheduler_tests()
+{
+	// Motion first, then a press, then the release a removed device makes up for it
+	Frame_Scheduler scheduler;
+	scheduler.push(make_frame(EV_REL, REL_X, 1, 1), Frame_Scheduler::MOTION_FRAME);
+	scheduler.push(make_frame(EV_KEY, KEY_A, 1, 2), Frame_Scheduler::KEY_FRAME);
+	scheduler.push(make_frame(EV_KEY, KEY_A, 0, 3), Frame_Scheduler::CONTROL_FRAME);
+
+	const int32_t expected_values[] = { 1, 1, 0 };
+	const uint16_t expected_types[] = { EV_REL, EV_KEY, EV_KEY };
+	bool is_ordered = true;
+	uint64_t frame_cnt = 0;
+	for (unsigned n = 0; n < 3; ++n)
+	{
+		void* p_frame = scheduler.pop(frame_cnt);
+		const struct input_event* p_ev = (const struct input_event*)((const uint64_t*)p_frame + 1);
+		is_ordered &= (p_frame != nullptr && p_ev->type == expected_types[n] && p_ev->value == expected_values[n]);
+		Frame_Pool::release(p_frame);
+	}
+	is_ordered &= (scheduler.pop(frame_cnt) == nullptr);
+	std::cout << "scheduler order: " << (is_ordered ? "ok" : "FAILED") << std::endl;
+
+	// Every entry of a full queue stays queued, the extra frame is refused
+	std::size_t queued_cnt = 0;
+	while (scheduler.push(make_frame(EV_KEY, KEY_B, 1, queued_cnt), Frame_Scheduler::KEY_FRAME))
+		++queued_cnt;
+	void* p_refused = make_frame(EV_KEY, KEY_B, 1, queued_cnt);
+	bool is_bounded = (queued_cnt == SIZE) && !scheduler.push(p_refused, Frame_Scheduler::KEY_FRAME);
+	Frame_Pool::release(scheduler.pop(frame_cnt));
+	scheduler.wait_for_room(Frame_Scheduler::KEY_FRAME);
+	is_bounded &= scheduler.push(p_refused, Frame_Scheduler::KEY_FRAME);
+
+	uint64_t expected_ns = 1;
+	while (void* p_frame = scheduler.pop(frame_cnt))
+	{
+		is_bounded &= (Frame_Pool::return_queued_time(p_frame) == expected_ns++);
+		Frame_Pool::release(p_frame);
+	}
+	is_bounded &= (expected_ns == SIZE + 1);
+	Frame_Pool::clear();
+	std::cout << "scheduler bound: " << queued_cnt << " frames held" << (is_bounded ? ", ok" : ", FAILED") << std::endl;
+	return is_ordered && is_bounded;
+}
+
+// True when the filter keeps the event and forwards it as expected_code
+static bool is_filtered_as(uint16_t type, uint16_t code, bool is_kept, uint16_t expected_code)
+{
+	struct input_event ev = { };
+	ev.type = type;
+	ev.code = code;
+	ev.value = 1;
+	bool result = Event_Filter::apply(ev);
+	return result == is_kept && (!is_kept || ev.code == expected_code);
+}
+
+static bool run_filter_tests()
+{
+	bool is_applied = Event_Filter::add_rule("self-test", "KEY_CAPSLOCK=KEY_LEFTCTRL")
+		&& Event_Filter::add_rule("self-test", "KEY_F13=")
+		&& Event_Filter::add_rule("self-test-alt", "KEY_A=KEY_B");
+
+	// Remapped, dropped and untouched codes
+	is_applied &= Event_Filter::use_profile("self-test");
+	is_applied &= is_filtered_as(EV_KEY, KEY_CAPSLOCK, true, KEY_LEFTCTRL);
+	is_applied &= is_filtered_as(EV_KEY, KEY_F13, false, 0);
+	is_applied &= is_filtered_as(EV_KEY, KEY_A, true, KEY_A);
+	is_applied &= is_filtered_as(EV_REL, REL_X, true, REL_X);
+
+	// A rule added to the active profile applies to the next event
+	is_applied &= Event_Filter::add_rule("self-test", "KEY_Z=KEY_Y");
+	is_applied &= is_filtered_as(EV_KEY, KEY_Z, true, KEY_Y);
+
+	// Swapping profiles, and back to none
+	is_applied &= Event_Filter::use_profile("self-test-alt");
+	is_applied &= is_filtered_as(EV_KEY, KEY_A, true, KEY_B) && is_filtered_as(EV_KEY, KEY_CAPSLOCK, true, KEY_CAPSLOCK);
+	is_applied &= Event_Filter::use_profile("self-test");
+	is_applied &= is_filtered_as(EV_KEY, KEY_A, true, KEY_A) && is_filtered_as(EV_KEY, KEY_Z, true, KEY_Y);
+	is_applied &= Event_Filter::use_profile("") && is_filtered_as(EV_KEY, KEY_CAPSLOCK, true, KEY_CAPSLOCK);
+	is_applied &= !Event_Filter::use_profile("self-test-missing");
+	std::cout << "filter remap and drop: " << (is_applied ? "ok" : "FAILED") << std::endl;
+
+	// Readers run flat out while the writer swaps profiles and rebuilds the active one now and then
+	std::atomic_uint64_t read_cnt{0};
+	std::atomic_uint64_t bad_read_cnt{0};
+	std::atomic_bool is_stopped{false};
+	std::vector<std::thread> readers;
+	for (unsigned n = 0; n < FILTER_READERS; ++n)
+	{
+		readers.emplace_back([&]
+		{
+			while (!is_stopped.load(std::memory_order_acquire))
+			{
+				struct input_event ev = { };
+				ev.type = EV_KEY;
+				ev.code = KEY_CAPSLOCK;
+				ev.value = 1;
+				if (!Event_Filter::apply(ev) || (ev.code != KEY_LEFTCTRL && ev.code != KEY_CAPSLOCK))
+					bad_read_cnt.fetch_add(1, std::memory_order_relaxed);
+				read_cnt.fetch_add(1, std::memory_order_relaxed);
+			}
+		});
+	}
+
+	for (uint64_t swap = 0; swap < FILTER_SWAPS; ++swap)
+	{
+		Event_Filter::use_profile((swap % 2 == 0) ? "self-test-alt" : "self-test");
+		if (swap % FILTER_REBUILD_INTERVAL == 0)
+			Event_Filter::add_rule("self-test-alt", "KEY_Q=KEY_W");	// Retires the active tables
+	}
+
+	is_stopped.store(true, std::memory_order_release);
+	for (std::thread& reader : readers)
+		reader.join();
+	Event_Filter::use_profile("");
+	Event_Filter::clear_profile("self-test");
+	Event_Filter::clear_profile("self-test-alt");
+	Event_Filter::reclaim();
+
+	bool is_swapped = (bad_read_cnt.load() == 0);
+	std::cout << "filter swap: " << FILTER_SWAPS << " swaps under " << read_cnt.load() << " reads, "
+		<< bad_read_cnt.load() << " unexpected codes" << (is_swapped ? ", ok" : ", FAILED") << std::endl;
+	return is_applied && is_swapped;
+}
+
+int main(int argc, char** argv)
+{
+	bool is_passed = true;
+
+	bool run_chords = (argc == 1);
+	for (int n = 1; n < argc; ++n)
+		run_chords |= (strcmp(argv[n], "chords") == 0);
+	if (run_chords)
+		is_passed &= run_chord_tests();
+
+	bool run_frames = (argc == 1);
+	for (int n = 1; n < argc; ++n)
+		run_frames |= (strcmp(argv[n], "frames") == 0);
+	if (run_frames)
+		is_passed &= run_frame_pool_tests();
+
+	bool run_resync = (argc == 1);
+	for (int n = 1; n < argc; ++n)
+		run_resync |= (strcmp(argv[n], "resync") == 0);
+	if (run_resync)
+		is_passed &= run_resync_tests();
+
+	bool run_slots = (argc == 1);
+	for (int n = 1; n < argc; ++n)
+		run_slots |= (strcmp(argv[n], "slots") == 0);
+	if (run_slots)
+		is_passed &= run_slot_map_tests();
+
+	bool run_epochs = (argc == 1);
+	for (int n = 1; n < argc; ++n)
+		run_epochs |= (strcmp(argv[n], "epochs") == 0);
+	if (run_epochs)
+		is_passed &= run_epoch_tests();
+
+	bool run_scheduler = (argc == 1);
+	for (int n = 1; n < argc; ++n)
+		run_scheduler |= (strcmp(argv[n], "scheduler") == 0);
+	if (run_scheduler)
+		is_passed &= run_scheduler_tests();
+
+	bool run_filter = (argc == 1);
+	for (int n = 1; n < argc; ++n)
+		run_filter |= (strcmp(argv[n], "filter") == 0);
+	if (run_filter)
+		is_passed &= run_filter_tests();
+
+	return is_passed ? 0 : 1;
+}
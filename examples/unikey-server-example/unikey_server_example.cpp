@@ -6,55 +6,37 @@
 #include <linux/input.h>
 
 #include "unikey.hpp"
+#include "Secure_Channel.hpp"
 #include "Virtual_Device.hpp"
 #include "WiFi_Server.hpp"
 
 #define EVER ;;
 
-int main()
+int main(int argc, char** argv)
 {
 	int old_gid = change_group_permissions();
 
+	Secure_Channel::load_psk("/etc/unikey/unikey.psk");	// Only used for "tls:" addresses
+
 	Virtual_Device virt_unikey("Unikey HID Device");
-	uint64_t* p_data = nullptr;
-	WiFi_Server dev_server(42069);
+	WiFi_Server dev_server((argc > 1) ? argv[1] : "tcp:0.0.0.0:42069");	// Also accepts unix:, vsock: and tls: addresses
 
 	for(EVER)
 	{
 		dev_server.begin_listening().wait_for_connection();
 		std::cout << "Device Connected" << std::endl;
-		p_data = (uint64_t*)dev_server.read_sent_data_packet();	// Get enabled EV_KEY codes
-		virt_unikey.enable_codes(EV_KEY, std::vector<uint64_t>(1 + p_data, 1 + *p_data + p_data));
-		free(p_data);
-		p_data = (uint64_t*)malloc(sizeof(uint64_t) + sizeof(struct input_event) * 64);
-		
-		while (dev_server.is_connected_to_client())
-		{
-			if (dev_server.read_sent_data(p_data) == nullptr)
-			{
-				dev_server.close_connection();
-			}
-			else if (*p_data == 0)
-			{
-				dev_server.close_connection();
-				goto BREAK_LOOP;
-			}
-			else
-			{
-				virt_unikey.write_event((struct input_event*)(1 + p_data), *p_data);	// Write received inputs
-				virt_unikey.write_event();	// Sends SYN_REPORT as default arguments
-			}
-		}
 
-		free(p_data);
-		p_data = nullptr;
+		if (receive_virtual_device_config(dev_server, virt_unikey))	// Enable the client's codes and axes
+			forward_to_virtual_device(dev_server, virt_unikey);	// Returns once the client disconnects
+		else
+			dev_server.close_connection();
+
 		virt_unikey.clear();
+		virt_unikey.set_device_name("Unikey HID Device");
 		std::cout << "Device has been disconnected" << std::endl;
 	}
 
-	BREAK_LOOP:
 	std::cout << "Shutting down unikey server..." << std::endl;
-	free(p_data);
 	virt_unikey.clear();
 	return_to_original_group_permissions(old_gid);
 
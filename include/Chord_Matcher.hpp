@@ -0,0 +1,78 @@
+#ifndef CHORD_MATCHER_HPP
+#define CHORD_MATCHER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <linux/input-event-codes.h>
+
+#include "RCU_Pointer.hpp"
+
+class Chord_Matcher
+{
+	public:
+		enum Action : uint8_t
+		{
+			NONE = 0,
+			TOGGLE_GRAB,
+			UNGRAB,
+			SWITCH_TARGET,
+			NEXT_TARGET,
+			EXIT,
+			ACTION_CNT
+		};
+
+		struct Trigger
+		{
+			Action action = NONE;
+			uint32_t argument = 0;
+		};
+
+	private:
+		static constexpr unsigned MAX_CHORDS = 16;
+		static constexpr unsigned MAX_CHORD_KEYS = 64;
+		static constexpr uint8_t NOT_MAPPED = 0xFF;
+		static constexpr uint32_t NOT_ARMED = MAX_CHORDS;
+
+		struct chord_definition
+		{
+			std::vector<unsigned> codes;
+			Trigger trigger;
+		};
+
+		/*
+			Compiled form of all chords. Every key that takes part in any chord is
+			assigned one bit, so matching is a table lookup plus a mask compare.
+		*/
+		struct chord_table
+		{
+			uint8_t key_bit[KEY_CNT];
+			uint64_t chord_mask[MAX_CHORDS];
+			Trigger chord_trigger[MAX_CHORDS];
+			unsigned chord_count = 0;
+		};
+
+		static void compile();
+
+		static inline RCU_Pointer<chord_table> table;
+		static inline std::vector<chord_definition> definitions;
+		static inline std::atomic_uint64_t pressed_mask{0};
+		static inline std::atomic_uint32_t armed_chord{NOT_ARMED};
+		static inline void (*action_handlers[ACTION_CNT])(uint32_t) = { nullptr };
+
+	public:
+		Chord_Matcher() = delete;
+
+	// PUBLIC INTERFACE
+		static bool add_chord(const std::vector<unsigned>& codes, Action action, uint32_t argument=0);
+		static bool add_chord(const std::string& chord, const std::string& action, uint32_t argument=0);
+		static void clear_chords();
+		static void set_action_handler(Action action, void (*handler)(uint32_t));
+		static Trigger process_key(unsigned code, int value);
+		static void dispatch(const Trigger& trigger);
+		static void reclaim();
+};
+
+#endif	// CHORD_MATCHER_HPP
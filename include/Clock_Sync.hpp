@@ -0,0 +1,71 @@
+#ifndef CLOCK_SYNC_HPP
+#define CLOCK_SYNC_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "Latency_Histogram.hpp"
+
+/*
+	NTP-style offset estimate between a sender's clock and a receiver's.
+	A probe yields t1 (ping sent, sender clock), t2 (ping received, receiver
+	clock), t3 (pong sent, receiver clock) and t4 (pong received, sender clock):
+		offset = ((t2 - t1) + (t3 - t4)) / 2	receiver clock minus sender clock
+		rtt = (t4 - t1) - (t3 - t2)
+	Queueing only ever inflates the round trip, so the sample with the lowest
+	rtt among the recent ones gives the most trustworthy offset.
+*/
+class Clock_Estimator
+{
+	static constexpr unsigned SAMPLE_CNT = 8;
+
+	struct sample
+	{
+		int64_t offset_ns;
+		uint64_t rtt_ns;
+	};
+
+	private:
+		sample samples[SAMPLE_CNT] = { };
+		unsigned sample_count = 0;
+		unsigned next_sample = 0;
+
+	public:
+		Clock_Estimator() = default;
+
+		void add_sample(uint64_t t1, uint64_t t2, uint64_t t3, uint64_t t4);
+		bool return_estimate(int64_t& offset_ns, uint64_t& rtt_ns) const;
+		void reset();
+};
+
+/*
+	Clock shared by capture timestamps and probes, plus the receiving side's
+	view of its current sender: the offset the sender last reported and the
+	one-way latency of every frame, from capture on the sender to the uinput
+	write here.
+*/
+class Clock_Sync
+{
+	static inline std::atomic_int64_t injected_offset_ns{0};
+	static inline std::atomic_int64_t peer_offset_ns{0};
+	static inline std::atomic_uint64_t peer_rtt_ns{0};	// Zero until the sender has reported an estimate
+	static inline Latency_Histogram one_way_latency;
+	static inline std::atomic_uint64_t negative_latency_cnt{0};
+
+	public:
+		Clock_Sync() = delete;
+
+	// PUBLIC INTERFACE
+		static uint64_t now_ns();
+		static uint64_t sender_now_ns();
+		static uint64_t to_sender_clock(uint64_t timestamp_ns);
+		static void set_injected_offset(int64_t offset_ns);	// Skews the sender's clock, for testing
+		static void set_peer_estimate(int64_t offset_ns, uint64_t rtt_ns);
+		static uint64_t to_local_clock(uint64_t capture_ns);	// Zero without an estimate
+		static void record_frame(uint64_t local_capture_ns);
+		static void reset_peer();
+		static std::string return_report();
+};
+
+#endif	// CLOCK_SYNC_HPP
@@ -5,6 +5,7 @@
 
 static inline constexpr std::size_t SIZE = 256;
 
+// The queue does not own its entries, whatever is still queued on destruction is left to the owner of the queue
 class Cyclic_Queue
 {
 	private:
@@ -14,11 +15,12 @@ class Cyclic_Queue
 
 	public:
 		Cyclic_Queue() {}
-		~Cyclic_Queue();
 		
-		void push(void* data);
-		void* pop();
+		bool push(void* data);	// False when all SIZE entries are taken
+		void* pop();	// Single consumer
+		void* peek() const;	// Only meaningful with a single consumer
 		std::size_t size() const;
+		void wait_for_room() const;	// Returns once an entry is popped, or at once if one is free
 };
 
 #endif	// CYCLIC_QUEUE_HPP
\ No newline at end of file
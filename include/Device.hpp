@@ -3,9 +3,11 @@
 
 #include <cstdint>
 #include <unistd.h>
+#include <string>
 #include <vector>
 #include <atomic>
 #include <thread>
+#include <unordered_map>
 #include <cstring>
 #include <assert.h>
 #include <fcntl.h>
@@ -14,43 +16,105 @@
 #include <linux/input.h>
 #include <sys/eventfd.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 
 #include <libevdev/libevdev.h>
+#include <libudev.h>
 
 #include "BitField.hpp"
-#include "Cyclic_Queue.hpp"
+#include "Chord_Matcher.hpp"
+#include "Epoch_Domain.hpp"
+#include "Frame_Scheduler.hpp"
+#include "Latency_Histogram.hpp"
+#include "Event_Codec.hpp"
+#include "Slot_Map.hpp"
+
+// Per-device counters, for the metrics endpoint
+struct device_stats
+{
+	std::string name;
+	dev_t devnum;
+	uint64_t frame_count;
+	uint64_t drop_count;
+};
 
 class Device
 {
 	static void default_event_processor(const void* data, uint64_t unit_size=sizeof(struct input_event));
 	static void watchdog_process();
 	static void hotplug_detect();
+	static void register_chord_actions();
+	static void lock_registry();
+	static void unlock_registry();
+	static bool is_input_capable(struct udev_device* dev);
+	static void register_device(const std::string& devnode);
+	static void unregister_device(dev_t devnum);
+	static void publish_registry();
+
+	// Lock-free walk over the registered devices, safe against concurrent add and remove
+	template <typename Function>
+	static void for_each_device(Function function)
+	{
+		Epoch_Domain::Guard guard(Device::registry_epochs);
+		const std::vector<Device*>* p_devices = Device::registry_snapshot.load(std::memory_order_acquire);
+		if (p_devices != nullptr)
+			for (const Device* p_device : *p_devices)
+				function(p_device);
+	}
+	static void discover_devices(const std::string& directory);
+	static void* queue_frame(void* p_data, Frame_Scheduler::Frame_Class frame_class);
+	static uint64_t return_timeout_ns();
+	static void arm_timeout(uint64_t deadline_ns);
+	static void kick_timeout();
+	static void signal_grab_change();
+	static bool release_grab();
 	
 	static inline void (*event_process)(const void*, const uint64_t) = Device::default_event_processor;
 	static inline std::atomic_int8_t global_key_state[KEY_CNT] = { 0 };
-	static inline unsigned timeout_length = 30000;
-	static inline Cyclic_Queue global_queue;
-	static inline Cyclic_Queue global_mem_bank;
-	static inline Cyclic_Queue global_id_queue;
-	static inline std::vector<Device*> device_objects;
+	static inline std::atomic_uint32_t timeout_length{30000};
+	static inline std::atomic_uint32_t timeout_override{0};
+	static inline Frame_Scheduler frame_scheduler;
+	static inline Slot_Map<Device> device_slots;
+	static inline std::unordered_map<dev_t, uint64_t> device_handles;	// Device number to slot handle
+	static inline std::atomic<const std::vector<Device*>*> registry_snapshot{nullptr};
+	static inline Epoch_Domain registry_epochs;
 	static inline std::thread watchdog_thread;
-	static inline int poll_signal_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE);
+	static inline std::thread discovery_thread;
+	static inline int poll_signal_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
 	static inline int event_signal_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE);
+	static inline int timeout_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
 	static inline std::atomic_uint32_t active_devices{0};
 	static inline std::atomic_uint32_t pending_events{0};
 	static inline std::atomic_uint32_t global_key_press_cnt{0};
 	static inline std::atomic_bool is_grabbed{false};
+	static inline std::atomic_bool is_watchdog_sleeping{false};	// Capture threads only signal poll_signal_fd while set
 	static inline std::atomic_bool is_exit{false};
+	static inline Latency_Histogram read_latency;
+	static inline Latency_Histogram queue_latency;
 
 	private:
-		unsigned id;
+		uint64_t handle = Slot_Map<Device>::INVALID_HANDLE;
+		dev_t devnum = 0;
+		int exit_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		std::atomic_bool is_active{false};
+		std::atomic_bool is_removed{false};
 		struct libevdev* dev = nullptr;
 		bool device_is_grabbed = false;
+		bool has_monotonic_time = false;	// Event timestamps are on CLOCK_MONOTONIC
 		BitField local_key_state{KEY_CNT};
+		uint16_t held_codes[KEY_CNT] = { 0 };	// Code each held key was forwarded under, indexed by the device's code
+		unsigned key_press_cnt = 0;
+		Chord_Matcher::Trigger chord_trigger;
+		std::atomic_uint64_t drop_count{0};
+		std::atomic_uint64_t frame_count{0};	// Written by the capture thread only
 		std::thread input_monitor_thread;
 
 		void input_monitor_process();
+		void stop();
+		bool filter_event(struct input_event& ev);
+		bool update_key_state(const struct input_event& ev);
+		void resynchronize(void*& p_data);
 
 	// PRIVATE CONSTRUCTOR
 		Device(const std::string& filepath);
@@ -63,17 +127,30 @@ class Device
 		static void set_event_processor(void (*event_processing_function)(const void*, uint64_t));
 		static void initialize_devices(const std::string& directory);
 		static unsigned set_timeout_length(unsigned seconds);
+		static unsigned set_timeout_override(unsigned seconds);
 		static bool trigger_activation();
 		static void trigger_exit();
 		static void wait_for_exit();
 		static bool return_grab_state();
 		static BitField return_enabled_global_key_states();
 		static BitField return_enabled_global_rel_states();
+		static BitField return_pressed_global_key_states();
+		static BitField return_enabled_global_properties();
+		static std::vector<struct abs_axis_info> return_enabled_global_abs_info();
+		static bool return_global_repeat_settings(int& delay, int& period);
+		static std::string return_latency_report();
+		static std::vector<device_stats> return_device_stats();
+		static std::size_t return_queue_depth();
+		static std::vector<std::string> return_input_candidates(const std::string& directory);
 
 		Device(const Device&) = delete;	// Delete copy constructor
 		Device& operator= (const Device&) = delete;	// Delete copy operator
 		BitField return_enabled_local_key_states() const;
 		BitField return_enabled_local_rel_states() const;
+		BitField return_enabled_local_properties() const;
+		std::vector<struct abs_axis_info> return_enabled_local_abs_info() const;
+		uint64_t return_drop_count() const;
+		uint64_t return_frame_count() const;
 };
 
 #endif // DEVICE_HPP
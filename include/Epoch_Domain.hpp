@@ -0,0 +1,182 @@
+#ifndef EPOCH_DOMAIN_HPP
+#define EPOCH_DOMAIN_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/*
+	Epoch-based reclamation for data that is read from arbitrary threads
+	while writers replace or remove it. A reader announces the current epoch
+	for the duration of a Guard and never blocks. A writer unlinks an object,
+	retires it with the epoch of the unlink, and collect() frees it once every
+	reader that might still hold it has left its guard.
+	Each thread claims one of MAX_READERS reader slots the first time it reads
+	and gives it back when it exits. Guards do not nest.
+*/
+class Epoch_Domain
+{
+	static constexpr unsigned MAX_READERS = 64;
+	static constexpr uint64_t IDLE = UINT64_MAX;
+
+	struct alignas(64) reader_slot
+	{
+		std::atomic_uint64_t epoch{IDLE};
+	};
+
+	struct retired_object
+	{
+		uint64_t epoch;
+		std::function<void()> deleter;
+	};
+
+	// Reader slot index of the calling thread, shared by every domain
+	class Thread_Index
+	{
+		static inline std::atomic_bool is_claimed[MAX_READERS] = { };
+
+		public:
+			unsigned index = MAX_READERS;
+
+			Thread_Index()
+			{
+				while (true)
+				{
+					for (unsigned n = 0; n < MAX_READERS; ++n)
+					{
+						bool prev_state = false;
+						if (!is_claimed[n].load(std::memory_order_relaxed) && is_claimed[n].compare_exchange_strong(prev_state, true, std::memory_order_acq_rel))
+						{
+							this->index = n;
+							return;
+						}
+					}
+					std::this_thread::yield();	// Every slot is taken, wait for a reader thread to exit
+				}
+			}
+
+			~Thread_Index()
+			{
+				is_claimed[this->index].store(false, std::memory_order_release);
+			}
+	};
+
+	private:
+		std::atomic_uint64_t global_epoch{0};
+		reader_slot readers[MAX_READERS];
+		std::atomic_bool in_progress = false;
+		std::vector<retired_object> retired;
+
+		static unsigned thread_index()
+		{
+			thread_local Thread_Index thread_slot;
+			return thread_slot.index;
+		}
+
+		void lock()
+		{
+			bool prev_state = false;
+			while (!this->in_progress.compare_exchange_strong(prev_state, true, std::memory_order_acq_rel))
+			{
+				this->in_progress.wait(true, std::memory_order_acquire);
+				prev_state = false;
+			}
+		}
+
+		void unlock()
+		{
+			this->in_progress.store(false, std::memory_order_release);
+			this->in_progress.notify_all();
+		}
+
+		uint64_t oldest_reader_epoch() const
+		{
+			uint64_t oldest = IDLE;
+			for (const reader_slot& reader : this->readers)
+			{
+				uint64_t epoch = reader.epoch.load(std::memory_order_seq_cst);
+				if (epoch < oldest)
+					oldest = epoch;
+			}
+			return oldest;
+		}
+
+	public:
+		class Guard
+		{
+			private:
+				Epoch_Domain& domain;
+				unsigned index;
+
+			public:
+				Guard(Epoch_Domain& epoch_domain) : domain(epoch_domain), index(Epoch_Domain::thread_index())
+				{
+					this->domain.readers[this->index].epoch.store(this->domain.global_epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+				}
+
+				~Guard()
+				{
+					this->domain.readers[this->index].epoch.store(IDLE, std::memory_order_release);
+				}
+
+				Guard(const Guard&) = delete;
+				Guard& operator=(const Guard&) = delete;
+		};
+
+		Epoch_Domain() = default;
+		Epoch_Domain(const Epoch_Domain&) = delete;
+
+		~Epoch_Domain()
+		{
+			this->synchronize();
+		}
+
+		// Call after the object has been unlinked from everything readers can reach
+		void retire(std::function<void()> deleter)
+		{
+			uint64_t epoch = this->global_epoch.fetch_add(1, std::memory_order_seq_cst);
+			this->lock();
+			this->retired.push_back({ epoch, std::move(deleter) });
+			this->unlock();
+		}
+
+		// Frees whatever no reader can still see, without waiting for anyone
+		std::size_t collect()
+		{
+			std::vector<retired_object> ready;
+			uint64_t oldest = this->oldest_reader_epoch();
+
+			this->lock();
+			for (std::size_t n = 0; n < this->retired.size();)
+			{
+				if (this->retired[n].epoch < oldest)
+				{
+					ready.push_back(std::move(this->retired[n]));
+					this->retired[n] = std::move(this->retired.back());
+					this->retired.pop_back();
+				}
+				else
+					++n;
+			}
+			std::size_t pending = this->retired.size();
+			this->unlock();
+
+			for (retired_object& object : ready)
+				object.deleter();
+			return pending;
+		}
+
+		// Waits until every retired object has been freed
+		void synchronize()
+		{
+			while (this->collect() != 0)
+				std::this_thread::yield();
+		}
+
+		Epoch_Domain& operator=(const Epoch_Domain&) = delete;
+};
+
+#endif	// EPOCH_DOMAIN_HPP
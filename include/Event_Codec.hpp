@@ -0,0 +1,68 @@
+#ifndef EVENT_CODEC_HPP
+#define EVENT_CODEC_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include <linux/input.h>
+
+// Absolute axis description exchanged during the handshake
+struct abs_axis_info
+{
+	uint32_t code;
+	struct input_absinfo info;
+};
+
+/*
+	Compact wire encoding for event frames.
+	Frame layouts by kind:
+		FRAME_EVENTS		{ uint8_t frame_kind, event[] }
+		FRAME_TIMED_EVENTS	{ uint8_t frame_kind, varint capture_ns, event[] }
+		FRAME_PING			{ uint8_t frame_kind, varint send_ns }
+		FRAME_CLOCK			{ uint8_t frame_kind, zigzag varint offset_ns, varint rtt_ns }
+	Event layout: { varint type, varint code, zigzag varint value }
+	Ping and clock frames carry no events and leave the codec state alone.
+
+	EV_ABS values are sent as the difference from the last value sent for that
+	axis, tracked per multitouch slot for the ABS_MT_* axes. An encoder and its
+	decoder must therefore see the same frames in the same order, and both are
+	reset when a connection is (re)established.
+*/
+class Event_Codec
+{
+	static constexpr unsigned MAX_SLOTS = 16;
+	static constexpr uint64_t MAX_EVENT_BYTES = 16;
+	static constexpr uint64_t MAX_VARINT_BYTES = 10;
+
+	private:
+		int32_t abs_value[ABS_CNT] = { 0 };
+		int32_t mt_value[MAX_SLOTS][ABS_MT_TOOL_Y - ABS_MT_TOUCH_MAJOR + 1] = { { 0 } };
+
+		int32_t* return_abs_base(uint16_t code);
+
+	public:
+		enum Frame_Kind : uint8_t
+		{
+			FRAME_EVENTS = 0,
+			FRAME_PING = 1,	// Answered with { uint64_t send_ns, receive_ns, reply_ns } on the same connection
+			FRAME_CLOCK = 2,	// The sender's current offset estimate for the receiver
+			FRAME_TIMED_EVENTS = 3
+		};
+
+		Event_Codec() = default;
+
+		void reset();
+		static constexpr uint64_t max_encoded_size(uint64_t event_count)
+		{
+			return sizeof(uint8_t) + MAX_VARINT_BYTES + event_count * MAX_EVENT_BYTES;
+		}
+		static int return_frame_kind(const uint8_t* buffer, uint64_t buffer_size);
+		uint64_t encode(const struct input_event* ev_list, uint64_t list_size, uint8_t* buffer, uint64_t capture_ns=0);
+		bool decode(const uint8_t* buffer, uint64_t buffer_size, std::vector<struct input_event>& ev_list, uint64_t* p_capture_ns=nullptr);
+		static uint64_t encode_ping(uint64_t send_ns, uint8_t* buffer);
+		static bool decode_ping(const uint8_t* buffer, uint64_t buffer_size, uint64_t& send_ns);
+		static uint64_t encode_clock(int64_t offset_ns, uint64_t rtt_ns, uint8_t* buffer);
+		static bool decode_clock(const uint8_t* buffer, uint64_t buffer_size, int64_t& offset_ns, uint64_t& rtt_ns);
+};
+
+#endif	// EVENT_CODEC_HPP
@@ -0,0 +1,86 @@
+#ifndef EVENT_FILTER_HPP
+#define EVENT_FILTER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <linux/input.h>
+
+#include "BitField.hpp"
+#include "RCU_Pointer.hpp"
+
+class Event_Filter
+{
+	static constexpr uint16_t DROP = 0xFFFF;
+
+	struct remap_rule
+	{
+		uint16_t type;
+		uint16_t code;
+		uint16_t new_code;	// DROP filters the code out
+	};
+
+	/*
+		Flat per-type lookup tables: the hot path is one indexed load that
+		yields either the code to forward or DROP.
+	*/
+	struct filter_profile
+	{
+		uint16_t key_map[KEY_CNT];
+		uint16_t rel_map[REL_CNT];
+		uint16_t abs_map[ABS_CNT];
+	};
+
+	static void lock_profiles();
+	static void unlock_profiles();
+	static const filter_profile* compile(const std::string& profile_name);
+	static const filter_profile* find_compiled(const std::string& profile_name);
+	static void invalidate(const std::string& profile_name);
+
+	static inline RCU_Pointer<filter_profile> active_profile;
+	static inline std::map<std::string, std::vector<remap_rule>> profiles;
+	static inline std::map<std::string, const filter_profile*> compiled_profiles;	// Kept across switches, retired when the rules change
+	static inline std::string active_profile_name;
+	static inline std::atomic_bool in_progress{false};
+
+	public:
+		Event_Filter() = delete;
+
+	// PUBLIC INTERFACE
+		static bool add_rule(const std::string& profile_name, const std::string& rule);
+		static void clear_profile(const std::string& profile_name);
+		static bool use_profile(const std::string& profile_name);
+		static std::string return_active_profile();
+		static BitField return_remapped_codes(unsigned type);
+		static void reclaim();
+
+		static inline bool apply(struct input_event& ev)
+		{
+			RCU_Pointer<filter_profile>::Reader p_profile(Event_Filter::active_profile);
+			if (p_profile.get() == nullptr)
+				return true;
+
+			uint16_t new_code = ev.code;
+			switch (ev.type)
+			{
+				case EV_KEY:
+					new_code = p_profile->key_map[ev.code];
+					break;
+				case EV_REL:
+					new_code = p_profile->rel_map[ev.code];
+					break;
+				case EV_ABS:
+					new_code = p_profile->abs_map[ev.code];
+					break;
+				default:
+					break;
+			}
+			ev.code = new_code;
+			return new_code != DROP;
+		}
+};
+
+#endif	// EVENT_FILTER_HPP
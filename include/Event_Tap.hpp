@@ -0,0 +1,80 @@
+#ifndef EVENT_TAP_HPP
+#define EVENT_TAP_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include <linux/input.h>
+
+/*
+	Shared-memory tap of the forwarded input stream for same-host consumers.
+	The daemon owns a sealed memfd holding a ring of frame slots and is its
+	only writer; any number of readers map it and follow along on their own.
+	Memory structure:
+	{ tap_header, tap_slot[TAP_SLOT_COUNT] }
+
+	Each slot is a seqlock: its sequence is odd while being written and
+	2 * (frame index + 1) once complete, so a reader detects both unfinished
+	and overwritten slots without taking a lock. Readers that fall more than
+	a lap behind lose frames instead of slowing the daemon down.
+	A reader that wants to block sets its waiting flag and polls the eventfd
+	it was handed; the daemon only signals readers that asked for it.
+*/
+static inline constexpr uint32_t TAP_MAGIC = 0x554E4B54;	// "UNKT"
+static inline constexpr uint32_t TAP_VERSION = 1;
+static inline constexpr uint32_t TAP_SLOT_COUNT = 256;
+static inline constexpr uint32_t TAP_SLOT_EVENTS = 64;
+static inline constexpr uint32_t TAP_MAX_READERS = 16;
+
+struct alignas(64) tap_reader
+{
+	std::atomic_uint32_t in_use;
+	std::atomic_uint32_t waiting;
+};
+
+struct tap_header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t slot_count;
+	uint32_t slot_events;
+	alignas(64) std::atomic_uint64_t write_index;	// Frames published so far
+	tap_reader readers[TAP_MAX_READERS];
+};
+
+struct alignas(64) tap_slot
+{
+	std::atomic_uint64_t sequence;
+	uint64_t event_count;	// Events in the frame, may exceed TAP_SLOT_EVENTS when truncated
+	struct input_event events[TAP_SLOT_EVENTS];
+};
+
+class Event_Tap
+{
+	static constexpr std::size_t REGION_SIZE = sizeof(tap_header) + sizeof(tap_slot) * TAP_SLOT_COUNT;
+
+	static void lock_readers();
+	static void unlock_readers();
+	static bool create_region();
+	static void wake_readers();
+
+	static inline int memfd = -1;
+	static inline tap_header* p_header = nullptr;
+	static inline tap_slot* p_slots = nullptr;
+	static inline int reader_fds[TAP_MAX_READERS] = { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 };
+	static inline std::string reader_owners[TAP_MAX_READERS];	// D-Bus unique name of whoever opened the reader
+	static inline std::atomic_uint32_t reader_count{0};
+	static inline std::atomic_bool in_progress{false};
+
+	public:
+		Event_Tap() = delete;
+
+	// PUBLIC INTERFACE
+		static bool open_reader(int& region_fd, int& event_fd, unsigned& reader_index, const std::string& owner);
+		static bool close_reader(unsigned reader_index, const std::string& owner);
+		static void publish(const void* data);
+		static void destroy();
+};
+
+#endif	// EVENT_TAP_HPP
@@ -0,0 +1,49 @@
+#ifndef EVENT_TAP_READER_HPP
+#define EVENT_TAP_READER_HPP
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <linux/input.h>
+
+#include "Event_Tap.hpp"
+
+namespace sdbus { class IProxy; }
+
+/*
+	Client side of the shared-memory event tap. Frames are read in place from
+	the daemon's ring and validated against the slot sequence, so the daemon
+	never waits on a reader. A reader that falls a full ring behind skips
+	ahead to the oldest frame still present and reports how many it lost.
+*/
+class Event_Tap_Reader
+{
+	private:
+		int region_fd = -1;
+		int event_fd = -1;
+		unsigned reader_index = TAP_MAX_READERS;
+		tap_header* p_header = nullptr;
+		const tap_slot* p_slots = nullptr;
+		uint64_t read_index = 0;
+		std::unique_ptr<sdbus::IProxy> p_proxy;	// Set by connect(); the daemon only lets the connection that opened a slot close it
+
+	public:
+		// Takes ownership of both descriptors, as handed out by OpenEventTap
+		Event_Tap_Reader(int region_fd, int event_fd, unsigned reader_index);
+		~Event_Tap_Reader();
+
+		Event_Tap_Reader(const Event_Tap_Reader&) = delete;
+		Event_Tap_Reader& operator=(const Event_Tap_Reader&) = delete;
+
+		// Asks the daemon for a tap over the system bus, nullptr when none is available
+		static Event_Tap_Reader* connect();
+
+		bool is_valid() const;
+		unsigned return_reader_index() const;
+		int return_event_fd() const;
+		bool read_frame(std::vector<struct input_event>& ev_list, uint64_t& lost_frames);
+		bool wait(int timeout_ms);
+};
+
+#endif	// EVENT_TAP_READER_HPP
@@ -0,0 +1,124 @@
+#ifndef FLIGHT_RECORDER_HPP
+#define FLIGHT_RECORDER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+#include <linux/input.h>
+
+/*
+	Always-on record of the last FLIGHT_RING_SIZE frames through each stage
+	of the pipeline, for looking back at a stuck key or a lag spike after
+	the fact. Each stage keeps an overwrite-oldest ring of seqlocked slots,
+	like the event tap: a writer claims a slot with one relaxed increment
+	and never waits, and a dump skips the slots caught mid-write.
+	A dump is written on request over D-Bus, on SIGUSR1, or by itself once
+	a frame takes longer than the latency threshold to reach a stage.
+	Dumps only go to the directory given to start(), which must belong to
+	the daemon and be writable by nobody else, and never replace a file.
+	Dump file structure:
+	{ flight_header, flight_record[record_count] }
+	Records are grouped by stage, oldest first. frame_id is the frame's
+	capture time on the clock of the host that wrote the dump, which
+	matches a frame up across the stages of one dump; the receiving end
+	only knows it once the clock probes have produced an estimate. Frames
+	made up without a kernel time are recorded at capture only, and no
+	frame without a known capture time triggers a dump.
+*/
+static inline constexpr uint32_t FLIGHT_MAGIC = 0x554E4B46;	// "UNKF"
+static inline constexpr uint32_t FLIGHT_VERSION = 1;
+static inline constexpr uint32_t FLIGHT_RING_SIZE = 512;
+
+struct flight_header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t reason;
+	uint32_t record_size;
+	uint64_t dump_ns;	// CLOCK_MONOTONIC, like every time in the records
+	uint64_t record_count;
+};
+
+struct flight_record
+{
+	uint64_t frame_id;
+	uint64_t stage_ns;	// When the frame passed the stage
+	uint64_t latency_ns;	// Capture to this stage, zero when unknown
+	uint32_t event_count;
+	uint16_t stage;
+	uint16_t type;	// First EV_KEY event of the frame, or its first event
+	uint16_t code;
+	uint16_t reserved;
+	int32_t value;
+};
+
+class Flight_Recorder
+{
+	public:
+		enum Stage : uint16_t
+		{
+			CAPTURE = 0,	// Latency is kernel timestamp to read
+			DISPATCH,
+			SEND,
+			RECEIVE,
+			INJECT,
+			STAGE_CNT
+		};
+
+		enum Reason : uint32_t
+		{
+			ON_REQUEST = 0,
+			ON_SIGNAL,
+			ON_THRESHOLD
+		};
+
+	private:
+		static constexpr uint64_t AUTO_DUMP_INTERVAL_NS = 10000000000;	// At most one threshold dump per interval
+		static constexpr uint64_t POST_TRIGGER_NS = 200000000;	// Lets the slow frame reach the later stages first
+
+		struct alignas(64) flight_slot
+		{
+			std::atomic_uint64_t sequence;	// Odd while written, 2 * (index + 1) once complete
+			flight_record record;
+		};
+
+		struct alignas(64) stage_index
+		{
+			std::atomic_uint64_t value;
+		};
+
+		static void lock_dump();
+		static void unlock_dump();
+		static void dumper_process();
+		static void trigger_dump(Reason reason);
+		static bool is_private_directory(const std::string& directory);
+		static std::string return_dump_path();
+
+		static inline flight_slot slots[STAGE_CNT][FLIGHT_RING_SIZE];
+		static inline stage_index write_indices[STAGE_CNT];
+		static inline std::atomic_uint64_t threshold_ns{0};
+		static inline std::atomic_uint64_t last_auto_dump_ns{0};
+		static inline std::atomic_uint32_t pending_reasons{0};
+		static inline std::atomic_bool is_exit{false};
+		static inline std::atomic_bool in_progress{false};
+		static inline int request_fd = -1;
+		static inline int signal_fd = -1;
+		static inline std::string dump_directory;
+		static inline uint64_t dump_count = 0;	// Guarded by the dump lock, keeps names apart within a millisecond
+		static inline std::thread dumper_thread;
+
+	public:
+		Flight_Recorder() = delete;
+
+	// PUBLIC INTERFACE
+		static bool start(const std::string& directory);	// Blocks SIGUSR1, call before any other thread starts; creates the directory if missing
+		static void stop();
+		static void record(Stage stage, uint64_t frame_id, uint64_t latency_ns, const struct input_event* events, uint64_t event_count, uint64_t stage_ns);
+		static void record_frame(Stage stage, const void* data, uint64_t stage_ns);
+		static void set_threshold(uint64_t latency_ns);	// Zero turns automatic dumps off
+		static std::string dump(Reason reason);
+};
+
+#endif	// FLIGHT_RECORDER_HPP
@@ -0,0 +1,68 @@
+#ifndef FRAME_POOL_HPP
+#define FRAME_POOL_HPP
+
+#include <atomic>
+#include <cstdint>
+
+#include <linux/input.h>
+
+#include "Chord_Matcher.hpp"
+
+/*
+	Size-classed pool of event frames.
+	Frame memory structure:
+	{ frame_info, uint64_t, struct input_event[capacity] }
+	Callers only ever see the pointer to the uint64_t event count, so frames keep
+	the layout every event processor already expects. The hidden frame_info in
+	front records which size class the frame belongs to, plus per-frame
+	bookkeeping that never goes on the wire.
+	Frames are acquired by every capture thread and released by whichever
+	thread sent them, so each bank is a free list linked through frame_info
+	and guarded by its own lock.
+*/
+class Frame_Pool
+{
+	static constexpr unsigned CLASS_CNT = 4;	// 64, 256, 1024 and 4096 events
+	static constexpr uint64_t SMALL_FRAME = 64;
+	static constexpr uint64_t BANK_FRAMES = 128;	// Frames kept per class, the rest are freed
+
+	struct frame_info
+	{
+		frame_info* p_next;	// Next free frame while banked
+		uint64_t capacity;
+		uint64_t read_ns;	// CLOCK_MONOTONIC time the frame's SYN_REPORT was read from the kernel
+		uint64_t queued_ns;	// CLOCK_MONOTONIC time the frame was queued for the watchdog
+		Chord_Matcher::Trigger trigger;	// Chord action to run once the frame is dispatched
+	};
+
+	struct alignas(64) frame_bank	// Zeroed as static storage
+	{
+		std::atomic_bool in_progress;
+		frame_info* p_head;
+		uint64_t frame_count;
+	};
+
+	static unsigned size_class(uint64_t capacity);
+	static void lock_bank(frame_bank& bank);
+	static void unlock_bank(frame_bank& bank);
+
+	static inline frame_bank banks[CLASS_CNT];
+
+	public:
+		Frame_Pool() = delete;
+
+	// PUBLIC INTERFACE
+		static void* acquire(uint64_t min_events=SMALL_FRAME);
+		static void* grow(void* p_frame);
+		static void release(void* p_frame);
+		static uint64_t capacity(const void* p_frame);
+		static void set_read_time(void* p_frame, uint64_t read_ns);
+		static uint64_t return_read_time(const void* p_frame);
+		static void set_queued_time(void* p_frame, uint64_t queued_ns);
+		static uint64_t return_queued_time(const void* p_frame);
+		static void set_trigger(void* p_frame, const Chord_Matcher::Trigger& trigger);
+		static Chord_Matcher::Trigger return_trigger(const void* p_frame);
+		static void clear();
+};
+
+#endif	// FRAME_POOL_HPP
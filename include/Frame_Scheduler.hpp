@@ -0,0 +1,60 @@
+#ifndef FRAME_SCHEDULER_HPP
+#define FRAME_SCHEDULER_HPP
+
+#include <atomic>
+#include <cstdint>
+
+#include "Cyclic_Queue.hpp"
+
+/*
+	Per-class queues between the capture threads and the sender, so a key
+	press never waits behind a backlog of pointer motion.
+	Classes, highest priority first:
+		CONTROL_FRAME	state corrections after SYN_DROPPED and on device removal
+		KEY_FRAME		any frame holding an EV_KEY event
+		MOTION_FRAME	everything else, EV_REL and EV_ABS
+	Control and key frames leave in the order they were queued, so a release
+	made up on device removal never overtakes the press it releases.
+	Motion queued before the next control or key frame still goes out ahead
+	of it, so a click lands where the pointer was, but as a single frame:
+	queued frames made only of EV_REL events are folded into one by summing
+	their values per code. Motion that queues up behind a slow link is folded
+	the same way. Frames holding EV_ABS are never folded.
+	Each queue holds at most SIZE frames; a producer that finds its queue
+	full waits for the consumer instead of overwriting queued frames.
+	Any number of producers, a single consumer.
+*/
+class Frame_Scheduler
+{
+	public:
+		enum Frame_Class : uint8_t
+		{
+			CONTROL_FRAME = 0,
+			KEY_FRAME,
+			MOTION_FRAME,
+			CLASS_CNT
+		};
+
+	private:
+		Cyclic_Queue queues[CLASS_CNT];
+		std::atomic_bool is_prioritized{true};
+
+		static bool is_relative_only(const void* p_frame);
+		void coalesce_motion(void* p_frame, uint64_t until_ns, uint64_t& frame_cnt, void (*observer)(const void*));
+
+	public:
+		Frame_Scheduler() = default;
+		~Frame_Scheduler();
+		Frame_Scheduler(const Frame_Scheduler&) = delete;
+
+		static Frame_Class classify(const void* p_frame);
+		void set_prioritized(bool prioritized);	// False keeps a single FIFO, for comparison
+		bool push(void* p_frame, Frame_Class frame_class);	// False when the class's queue is full
+		void wait_for_room(Frame_Class frame_class) const;
+		void* pop(uint64_t& frame_cnt, void (*observer)(const void*)=nullptr);
+		std::size_t size() const;
+
+		Frame_Scheduler& operator=(const Frame_Scheduler&) = delete;
+};
+
+#endif	// FRAME_SCHEDULER_HPP
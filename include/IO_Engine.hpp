@@ -0,0 +1,55 @@
+#ifndef IO_ENGINE_HPP
+#define IO_ENGINE_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include <sys/uio.h>
+
+#ifdef UNIKEY_HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+/*
+	Per-thread batching of small writes. With io_uring available, writes are
+	copied into registered buffers and queued as linked SQEs, so they reach
+	their descriptors in order, and flush() submits the whole batch with one
+	io_uring_enter(). Without liburing at build time, or when the kernel
+	refuses io_uring at runtime, every write goes out immediately with
+	writev() and flush() has nothing to do.
+	Callers flush before anything that can block. A write cancelled because
+	an earlier linked write failed is resent with writev(). Not thread safe.
+*/
+class IO_Engine
+{
+	static constexpr unsigned QUEUE_DEPTH = 64;
+	static constexpr std::size_t SLOT_SIZE = 4096;	// Larger writes flush the batch and go out directly
+
+	private:
+#ifdef UNIKEY_HAVE_LIBURING
+		struct io_uring ring;
+		struct io_uring_sqe* p_last_sqe = nullptr;
+		std::vector<uint8_t> slot_buffers;
+		int slot_fds[QUEUE_DEPTH];	// Where each queued slot goes, to resend it when its link is cancelled
+		uint32_t slot_lengths[QUEUE_DEPTH];
+#endif
+		bool is_uring = false;
+		unsigned queued_writes = 0;
+		uint64_t syscall_count = 0;
+
+		bool write_direct(int fd, const struct iovec* p_iov, int iov_count);
+
+	public:
+		IO_Engine(bool use_io_uring=true);
+		~IO_Engine();
+
+		IO_Engine(const IO_Engine&) = delete;
+		IO_Engine& operator=(const IO_Engine&) = delete;
+
+		bool uses_io_uring() const;
+		bool write(int fd, const struct iovec* p_iov, int iov_count);
+		void flush();
+		uint64_t return_syscall_count() const;	// write and submit calls made so far
+};
+
+#endif	// IO_ENGINE_HPP
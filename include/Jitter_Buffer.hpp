@@ -0,0 +1,65 @@
+#ifndef JITTER_BUFFER_HPP
+#define JITTER_BUFFER_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include <linux/input.h>
+
+/*
+	Receiver-side playout buffer that smooths bursty arrival of motion frames.
+	A frame is due at its capture time on the receiver's clock plus a playout
+	delay, which follows the observed one-way latency and its jitter the way
+	adaptive audio playout does:
+		mean += (transit - mean) / 64
+		jitter += (|transit - mean| - jitter) / 64
+		delay = min(mean + 4 * jitter, budget)
+	Frames that arrive after their due time go out at once. Only frames made
+	of EV_REL and EV_ABS events are held; anything else, key transitions
+	above all, is refused so the caller writes it immediately after draining
+	what is buffered, which keeps every frame in order.
+	Not thread safe; the receiving thread owns it.
+*/
+class Jitter_Buffer
+{
+	static constexpr unsigned CAPACITY = 64;
+	static constexpr unsigned GAIN_SHIFT = 6;
+
+	struct pending_frame
+	{
+		uint64_t due_ns;
+		uint64_t capture_ns;	// Receiver clock
+		std::vector<struct input_event> ev_list;
+	};
+
+	private:
+		pending_frame frames[CAPACITY];
+		unsigned head = 0;
+		unsigned count = 0;
+		uint64_t budget_ns = 0;	// Zero disables buffering
+		int64_t mean_transit_ns = 0;
+		int64_t jitter_ns = 0;
+		bool has_transit = false;
+		uint64_t last_due_ns = 0;
+
+		static bool is_motion(const std::vector<struct input_event>& ev_list);
+		void track_transit(int64_t transit_ns);
+
+	public:
+		static constexpr uint64_t NOT_DUE = UINT64_MAX;
+
+		Jitter_Buffer() = default;
+		Jitter_Buffer(const Jitter_Buffer&) = delete;
+
+		void set_budget(uint64_t budget_ns);
+		bool push(std::vector<struct input_event>& ev_list, uint64_t capture_ns, uint64_t now_ns);
+		uint64_t return_next_due() const;
+		uint64_t return_delay() const;
+		bool pop_due(uint64_t now_ns, std::vector<struct input_event>& ev_list, uint64_t& capture_ns);
+		bool pop(std::vector<struct input_event>& ev_list, uint64_t& capture_ns);
+		void clear();
+
+		Jitter_Buffer& operator=(const Jitter_Buffer&) = delete;
+};
+
+#endif	// JITTER_BUFFER_HPP
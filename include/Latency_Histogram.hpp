@@ -0,0 +1,35 @@
+#ifndef LATENCY_HISTOGRAM_HPP
+#define LATENCY_HISTOGRAM_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/*
+	Lock-free latency histogram with power-of-two buckets: bucket n counts
+	samples in [2^n, 2^(n+1)) nanoseconds. Recording is a single relaxed
+	increment, so it is cheap enough for the event path.
+*/
+class Latency_Histogram
+{
+	static constexpr unsigned BUCKET_CNT = 64;
+
+	private:
+		std::atomic_uint64_t buckets[BUCKET_CNT] = { };
+		std::atomic_uint64_t max_ns{0};
+
+	public:
+		Latency_Histogram() = default;
+		Latency_Histogram(const Latency_Histogram&) = delete;
+
+		void record(uint64_t latency_ns);
+		void clear();
+		uint64_t return_count() const;
+		uint64_t return_percentile(double percentile) const;
+		uint64_t return_max() const;
+		std::string report(const std::string& name) const;
+
+		Latency_Histogram& operator=(const Latency_Histogram&) = delete;
+};
+
+#endif	// LATENCY_HISTOGRAM_HPP
@@ -0,0 +1,65 @@
+#ifndef LOGGER_HPP
+#define LOGGER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+/*
+	Non-blocking logger for the capture, watchdog and injection threads.
+	log() formats into a slot of a bounded lock-free ring (multi-producer,
+	single consumer) and returns; a background flusher thread batches the
+	ring into write() calls. When the ring is full the message is dropped and
+	counted rather than making the caller wait.
+*/
+class Logger
+{
+	public:
+		enum Level : uint8_t
+		{
+			DEBUG = 0,
+			INFO,
+			WARNING,
+			ERROR
+		};
+
+	private:
+		static constexpr std::size_t RING_SIZE = 1024;	// Power of two
+		static constexpr std::size_t MESSAGE_SIZE = 240;
+
+		// sequence is 2 * lap while the slot is free and 2 * lap + 1 once published, so zeroed slots start out free
+		struct log_record
+		{
+			std::atomic<std::size_t> sequence;
+			Level level;
+			uint16_t length;
+			char text[MESSAGE_SIZE];
+		};
+
+		static void start();
+		static void flusher_process();
+		static void wake_flusher();
+
+		static inline log_record ring[RING_SIZE];
+		static inline std::atomic<std::size_t> head{0};	// Next slot to claim
+		static inline std::size_t tail = 0;	// Next slot to flush, owned by the flusher
+		static inline std::atomic_uint8_t min_level{INFO};
+		static inline std::atomic_uint64_t dropped{0};
+		static inline std::atomic_bool flusher_waiting{false};
+		static inline std::atomic_bool is_started{false};
+		static inline std::atomic_bool is_stopping{false};
+		static inline int wake_fd = -1;
+		static inline std::thread flusher_thread;
+
+	public:
+		Logger() = delete;
+
+	// PUBLIC INTERFACE
+		static void set_level(Level level);
+		static bool is_enabled(Level level);
+		static void log(Level level, const char* format, ...) __attribute__((format(printf, 2, 3)));
+		static uint64_t return_dropped_count();
+		static void stop();
+};
+
+#endif	// LOGGER_HPP
@@ -0,0 +1,102 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+	Process-wide counters, exposed in the Prometheus text format over a local
+	HTTP endpoint and through D-Bus.
+	Each thread counts into its own cache line, claimed the first time it
+	counts, with a plain load and store that never contend with another
+	thread. Only a scrape walks every thread's line and sums them up. A
+	thread that exits folds its counts into the retired totals and gives
+	its line back. Threads past MAX_THREADS share one line and pay for an
+	atomic add instead.
+	Values read at scrape time only, such as queue depths, come from
+	collectors registered with add_collector().
+*/
+class Metrics
+{
+	public:
+		enum Counter : uint8_t
+		{
+			FRAMES_CAPTURED = 0,
+			FRAMES_RESYNCED,
+			FRAMES_COALESCED,
+			FRAMES_FORWARDED,
+			FRAMES_UNROUTED,
+			FRAMES_RECEIVED,
+			FRAMES_INJECTED,
+			CLIENT_CONNECTS,
+			CLIENT_SEND_FAILURES,
+			SERVER_CONNECTIONS,
+			COUNTER_CNT
+		};
+
+	private:
+		static constexpr unsigned MAX_THREADS = 64;
+		static constexpr unsigned SHARED_BLOCK = MAX_THREADS;
+
+		struct alignas(64) counter_block
+		{
+			std::atomic_uint64_t values[COUNTER_CNT];	// Zeroed as static storage
+		};
+
+		// Counter line of the calling thread, handed back when the thread exits
+		class Thread_Block
+		{
+			public:
+				unsigned index = SHARED_BLOCK;
+
+				Thread_Block();
+				~Thread_Block();
+		};
+
+		static void lock_metrics();
+		static void unlock_metrics();
+		static void endpoint_process(int listen_fd);
+
+		static inline counter_block blocks[MAX_THREADS + 1];	// The last one is shared
+		static inline std::atomic_bool is_claimed[MAX_THREADS] = { };
+		static inline uint64_t retired_values[COUNTER_CNT] = { };
+		static inline std::vector<std::function<void(std::string&)>> collectors;
+		static inline std::atomic_bool in_progress{false};
+		static inline int endpoint_fd = -1;
+		static inline std::thread endpoint_thread;
+
+		static unsigned thread_index()
+		{
+			thread_local Thread_Block thread_block;
+			return thread_block.index;
+		}
+
+	public:
+		Metrics() = delete;
+
+	// PUBLIC INTERFACE
+		static inline void add(Counter counter, uint64_t amount=1)
+		{
+			unsigned index = Metrics::thread_index();
+			std::atomic_uint64_t& value = Metrics::blocks[index].values[counter];
+			if (index != SHARED_BLOCK)
+				value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+			else
+				value.fetch_add(amount, std::memory_order_relaxed);
+		}
+
+		static uint64_t return_count(Counter counter);
+		static void add_collector(std::function<void(std::string&)> collector);
+		static void append_header(std::string& text, const std::string& name, const char* type, const char* help);
+		static void append_sample(std::string& text, const std::string& name, const std::string& labels, uint64_t value);
+		static std::string escape_label(const std::string& value);
+		static std::string return_report();
+		static bool start_endpoint(const std::string& address);
+		static void stop_endpoint();
+};
+
+#endif	// METRICS_HPP
@@ -0,0 +1,83 @@
+#ifndef RCU_POINTER_HPP
+#define RCU_POINTER_HPP
+
+#include <atomic>
+
+#include "Epoch_Domain.hpp"
+
+/*
+	Publishes immutable, rarely rebuilt data to hot-path readers. A reader
+	holds a Reader for as long as it uses the object, which costs an epoch
+	announcement and an acquire load. Replaced objects are retired through
+	the pointer's own Epoch_Domain and freed once no Reader can still hold
+	them; reclaim() waits until every retired object is gone.
+	Readers of the same pointer do not nest.
+*/
+template <typename T>
+class RCU_Pointer
+{
+	private:
+		std::atomic<const T*> current = nullptr;
+		mutable Epoch_Domain epochs;
+
+	public:
+		class Reader
+		{
+			private:
+				Epoch_Domain::Guard guard;
+				const T* p_data;
+
+			public:
+				Reader(const RCU_Pointer& pointer) : guard(pointer.epochs), p_data(pointer.current.load(std::memory_order_acquire)) { }
+
+				const T* get() const
+				{
+					return this->p_data;
+				}
+
+				const T* operator->() const
+				{
+					return this->p_data;
+				}
+
+				Reader(const Reader&) = delete;
+				Reader& operator=(const Reader&) = delete;
+		};
+
+		RCU_Pointer() = default;
+		RCU_Pointer(const RCU_Pointer&) = delete;
+
+		~RCU_Pointer()
+		{
+			this->reclaim();
+			delete this->current.exchange(nullptr, std::memory_order_acq_rel);
+		}
+
+		// Publishes p_data and hands back the object it replaced, which readers may still hold until it is retired
+		const T* exchange(const T* p_data)
+		{
+			return this->current.exchange(p_data, std::memory_order_acq_rel);
+		}
+
+		// Call once the object can no longer be published, it is freed after the last Reader that saw it
+		void retire(const T* p_old)
+		{
+			if (p_old != nullptr)
+				this->epochs.retire([p_old]() { delete p_old; });
+			this->epochs.collect();
+		}
+
+		void update(const T* p_data)
+		{
+			this->retire(this->exchange(p_data));
+		}
+
+		void reclaim()
+		{
+			this->epochs.synchronize();
+		}
+
+		RCU_Pointer& operator=(const RCU_Pointer&) = delete;
+};
+
+#endif	// RCU_POINTER_HPP
@@ -0,0 +1,49 @@
+#ifndef SECURE_CHANNEL_HPP
+#define SECURE_CHANNEL_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+	Encrypted mode for the TCP transport ("tls:" addresses). Both ends hold the
+	same pre-shared key. A one-round-trip handshake proves that each side knows
+	it and derives fresh per-connection keys from it. The keys are then handed
+	to kernel TLS, so every later send() goes out as an AES-GCM-128 TLS 1.2
+	record and the event path keeps using plain socket calls.
+	Handshake, plaintext:
+		client -> server { "UNKT", version, client_nonce[32] }
+		server -> client { server_nonce[32], server_finished[32] }
+		client -> server { client_finished[32] }
+	Both ends install TLS_TX and TLS_RX. Client records use the "client write" key and
+	server replies (clock pongs) the "server write" key, so replies are authenticated too.
+	The handshake is specific to unikey and does not interoperate with other TLS peers.
+*/
+class Secure_Channel
+{
+	static constexpr std::size_t NONCE_SIZE = 32;
+	static constexpr std::size_t DIGEST_SIZE = 32;
+	static constexpr std::size_t MIN_PSK_SIZE = 16;
+
+	static void lock_psk();
+	static void unlock_psk();
+	static std::vector<uint8_t> derive_secret(const uint8_t* client_nonce, const uint8_t* server_nonce);
+	static bool install_keys(int socket_fd, const char* tx_label, const char* rx_label, const std::vector<uint8_t>& secret);
+
+	static inline std::vector<uint8_t> psk;
+	static inline std::atomic_bool in_progress{false};
+
+	public:
+		Secure_Channel() = delete;
+
+	// PUBLIC INTERFACE
+		static bool load_psk(const std::string& path);
+		static bool set_psk(const std::vector<uint8_t>& key);
+		static bool has_psk();
+		static bool client_handshake(int socket_fd);
+		static bool server_handshake(int socket_fd);
+		static void hmac_sha256(const uint8_t* key, std::size_t key_size, const uint8_t* data, std::size_t data_size, uint8_t* digest);
+};
+
+#endif	// SECURE_CHANNEL_HPP
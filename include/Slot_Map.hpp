@@ -0,0 +1,102 @@
+#ifndef SLOT_MAP_HPP
+#define SLOT_MAP_HPP
+
+#include <cstdint>
+#include <vector>
+
+/*
+	Stable slots for objects that come and go at runtime. A handle packs the
+	slot index with the slot's generation, and the generation is bumped every
+	time the slot is emptied, so a handle to a removed object never resolves
+	to whatever reuses its slot. Empty slots are chained into a free list,
+	which makes insert, erase and find constant time.
+	Not thread safe; the owner serializes access.
+*/
+template <typename T>
+class Slot_Map
+{
+	static constexpr uint32_t NO_SLOT = UINT32_MAX;
+
+	struct slot
+	{
+		T* p_value = nullptr;
+		uint32_t generation = 0;
+		uint32_t next_free = NO_SLOT;
+	};
+
+	private:
+		std::vector<slot> slots;
+		uint32_t free_head = NO_SLOT;
+		std::size_t value_count = 0;
+
+		static uint32_t index_of(uint64_t handle) { return (uint32_t)handle; }
+		static uint32_t generation_of(uint64_t handle) { return (uint32_t)(handle >> 32); }
+
+	public:
+		static constexpr uint64_t INVALID_HANDLE = UINT64_MAX;
+
+		Slot_Map() = default;
+
+		uint64_t insert(T* p_value)
+		{
+			uint32_t index = this->free_head;
+			if (index != NO_SLOT)
+				this->free_head = this->slots[index].next_free;
+			else
+			{
+				index = this->slots.size();
+				this->slots.emplace_back();
+			}
+
+			this->slots[index].p_value = p_value;
+			this->slots[index].next_free = NO_SLOT;
+			++this->value_count;
+			return ((uint64_t)this->slots[index].generation << 32) | index;
+		}
+
+		T* find(uint64_t handle) const
+		{
+			uint32_t index = index_of(handle);
+			if (index >= this->slots.size() || this->slots[index].generation != generation_of(handle))
+				return nullptr;
+			return this->slots[index].p_value;
+		}
+
+		// Returns the removed object, or nullptr if the handle was already stale
+		T* erase(uint64_t handle)
+		{
+			T* p_value = this->find(handle);
+			if (p_value == nullptr)
+				return nullptr;
+
+			slot& entry = this->slots[index_of(handle)];
+			entry.p_value = nullptr;
+			++entry.generation;
+			entry.next_free = this->free_head;
+			this->free_head = index_of(handle);
+			--this->value_count;
+			return p_value;
+		}
+
+		template <typename Function>
+		void for_each(Function function) const
+		{
+			for (const slot& entry : this->slots)
+			{
+				if (entry.p_value != nullptr)
+					function(entry.p_value);
+			}
+		}
+
+		std::size_t size() const
+		{
+			return this->value_count;
+		}
+
+		std::size_t capacity() const
+		{
+			return this->slots.size();
+		}
+};
+
+#endif	// SLOT_MAP_HPP
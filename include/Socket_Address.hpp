@@ -0,0 +1,44 @@
+#ifndef SOCKET_ADDRESS_HPP
+#define SOCKET_ADDRESS_HPP
+
+#include <cstdint>
+#include <string>
+
+#include <sys/socket.h>
+
+/*
+	Transport address shared by WiFi_Client and WiFi_Server.
+	Accepted syntax:
+		unix:/path/to/socket	AF_UNIX SOCK_SEQPACKET, "unix:@name" for the abstract namespace
+		vsock:cid[:port]		AF_VSOCK SOCK_STREAM, cid may be "any", "local" or "host"
+		tcp:a.b.c.d[:port]		AF_INET SOCK_STREAM
+		tls:a.b.c.d[:port]		Same as tcp:, encrypted with kernel TLS after a pre-shared key handshake
+		a.b.c.d					Same as tcp:, for addresses given before transports existed
+	Packet-based transports deliver every message as one record, which the
+	client and server honour by sending and receiving whole messages.
+*/
+class Socket_Address
+{
+	private:
+		struct sockaddr_storage address = { };
+		socklen_t address_len = 0;
+		int socket_type = SOCK_STREAM;
+		bool encrypted = false;
+
+	public:
+		static constexpr uint16_t DEFAULT_PORT = 42069;
+
+		Socket_Address() = default;
+
+		bool parse(const std::string& address_str, uint16_t default_port=DEFAULT_PORT);
+		int create_socket() const;
+		int return_family() const;
+		bool is_packet_based() const;
+		bool is_encrypted() const;
+		bool is_valid() const;
+		const struct sockaddr* return_sockaddr() const;
+		socklen_t return_sockaddr_len() const;
+		std::string return_unix_path() const;	// Filesystem path to unlink before binding, empty for other transports
+};
+
+#endif	// SOCKET_ADDRESS_HPP
@@ -0,0 +1,48 @@
+#ifndef STATE_NOTIFIER_HPP
+#define STATE_NOTIFIER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <thread>
+
+/*
+	Carries state changes from any thread to a single notifier thread, which
+	hands them to the emitter, e.g. to send D-Bus PropertiesChanged signals.
+	A changing thread only sets bits and wakes the notifier if it was idle,
+	so capture threads never wait on or call into the bus. After the first
+	change the notifier waits COALESCE_INTERVAL_MS for the rest of the burst
+	and the emitter reports the state as it is then: rapid toggles turn into
+	at most one emission per interval, carrying the final values.
+*/
+class State_Notifier
+{
+	public:
+		enum State : uint32_t
+		{
+			GRAB_STATE = 1 << 0,
+			ACTIVE_TARGET = 1 << 1,
+			TARGET_CONNECTIONS = 1 << 2,
+			SENDER_CONNECTION = 1 << 3
+		};
+
+	private:
+		static constexpr unsigned COALESCE_INTERVAL_MS = 50;
+		static constexpr uint32_t STOP_REQUEST = 1u << 31;
+
+		static void notifier_process();
+
+		static inline std::atomic_uint32_t pending_states{0};
+		static inline std::function<void(uint32_t)> emitter;
+		static inline std::thread notifier_thread;
+
+	public:
+		State_Notifier() = delete;
+
+	// PUBLIC INTERFACE
+		static void start(std::function<void(uint32_t)> emitter_function);
+		static void stop();
+		static void mark_changed(uint32_t states);	// Any combination of State, callable from any thread
+};
+
+#endif	// STATE_NOTIFIER_HPP
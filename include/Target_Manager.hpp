@@ -0,0 +1,71 @@
+#ifndef TARGET_MANAGER_HPP
+#define TARGET_MANAGER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Clock_Sync.hpp"
+#include "Event_Codec.hpp"
+#include "Latency_Histogram.hpp"
+#include "WiFi_Client.hpp"
+
+class Target_Manager
+{
+	static constexpr unsigned MAX_TARGETS = 8;
+	static constexpr unsigned NO_TARGET = MAX_TARGETS;
+	static constexpr unsigned PROBE_INTERVAL_MS = 1000;
+	static constexpr int PROBE_TIMEOUT_MS = 200;
+
+	static void lock_targets();
+	static void unlock_targets();
+	static void wait_for_senders();
+	static void release_held_keys(unsigned slot);
+	static void send_frame(WiFi_Client* p_client, Event_Codec& codec, std::vector<uint8_t>& buffer, const void* data);
+	static int find_target_slot(const std::string& ip_addr);
+	static void clock_probe_process();
+	static void probe_clock(WiFi_Client* p_client, Clock_Estimator& estimator);
+	static void wait_for_probe(unsigned slot);
+	static void close_target(unsigned slot, WiFi_Client* p_client);
+
+	static inline std::atomic<WiFi_Client*> targets[MAX_TARGETS] = { nullptr };
+	static inline std::string target_addresses[MAX_TARGETS];
+	static inline std::string target_profiles[MAX_TARGETS];
+	static inline unsigned target_timeouts[MAX_TARGETS] = { 0 };	// Seconds, 0 uses the default timeout
+	static inline std::atomic_bool target_ready[MAX_TARGETS] = { false };
+	static inline Event_Codec target_codecs[MAX_TARGETS];
+	static inline Clock_Estimator target_clocks[MAX_TARGETS];
+	static inline std::vector<uint8_t> encode_buffer;
+	static inline std::atomic_uint32_t active_target{NO_TARGET};
+	static inline std::atomic_uint32_t senders_in_flight{0};
+	static inline std::atomic_bool in_progress{false};
+	static inline std::atomic_uint32_t probing_slot{NO_TARGET};
+	static inline std::atomic_bool stop_probing{false};
+	static inline std::thread clock_probe_thread;
+	static inline std::thread handshake_threads[MAX_TARGETS];
+	static inline Latency_Histogram send_latency;
+	static inline void (*handshake_process)(WiFi_Client&) = nullptr;
+
+	public:
+		Target_Manager() = delete;
+
+	// PUBLIC INTERFACE
+		static void set_handshake_process(void (*handshake_function)(WiFi_Client&));
+		static int add_target(const std::string& ip_addr);
+		static bool remove_target(const std::string& ip_addr);
+		static bool switch_to(unsigned slot);
+		static bool switch_to(const std::string& ip_addr);
+		static bool switch_to_next();
+		static bool set_target_profile(const std::string& ip_addr, const std::string& profile_name);
+		static bool set_target_timeout(const std::string& ip_addr, unsigned seconds);
+		static std::string return_active_target();
+		static std::map<std::string, bool> return_target_states();	// Address to whether it is connected
+		static void send_to_active(const void* data, uint64_t unit_size);
+		static std::string return_latency_report();
+		static void close_all();
+};
+
+#endif	// TARGET_MANAGER_HPP
@@ -0,0 +1,62 @@
+#ifndef THREAD_POLICY_HPP
+#define THREAD_POLICY_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <sched.h>
+#include <sys/types.h>
+
+/*
+	CPU placement and scheduling class for the latency-critical threads.
+	Threads announce their role with enter() when they start and leave() when
+	they end, so a policy change is applied to every running thread of that
+	role right away as well as to threads started later.
+	Real-time classes need CAP_SYS_NICE or an RLIMIT_RTPRIO allowance; without
+	either the thread keeps its current class and a warning is printed.
+*/
+class Thread_Policy
+{
+	public:
+		enum Role : uint8_t
+		{
+			CAPTURE = 0,	// Per-device evdev readers
+			WATCHDOG,		// Drains the frame queue and sends to the active target
+			RECEIVER,		// Server side, decodes frames into the virtual device
+			ROLE_CNT
+		};
+
+	private:
+		// Zero-initialized means no pinning and SCHED_OTHER
+		struct role_policy
+		{
+			cpu_set_t cpus;
+			bool has_cpus;
+			int policy;
+			int priority;
+		};
+
+		static void lock_policies();
+		static void unlock_policies();
+		static bool apply(pid_t tid, const role_policy& policy);
+		static bool parse_role(const std::string& role_name, Role& role);
+
+		static inline role_policy policies[ROLE_CNT];
+		static inline std::vector<pid_t> role_threads[ROLE_CNT];
+		static inline std::atomic_bool in_progress{false};
+
+	public:
+		Thread_Policy() = delete;
+
+	// PUBLIC INTERFACE
+		static bool set_policy(Role role, const std::string& cpus, const std::string& policy, int priority);
+		static bool set_policy(const std::string& role_name, const std::string& cpus, const std::string& policy, int priority);
+		static bool lock_memory(bool is_locked);
+		static bool load_config(const std::string& filepath);
+		static void enter(Role role);
+		static void leave(Role role);
+};
+
+#endif	// THREAD_POLICY_HPP
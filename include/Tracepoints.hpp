@@ -0,0 +1,29 @@
+#ifndef TRACEPOINTS_HPP
+#define TRACEPOINTS_HPP
+
+/*
+	Static probes (USDT) under the "unikey" provider, for perf and bpftrace
+	on a release build. An unattached probe is a single nop and its
+	arguments are values the caller already holds, so the event path pays
+	nothing until a tracer attaches. Builds without <sys/sdt.h> compile
+	them out. Probe points, in pipeline order:
+		frame_captured	(devnum, frame, event_cnt, kernel_ns, read_ns)	capture thread, at SYN_REPORT
+		frame_queued	(frame, frame_class, depth)						scheduler push
+		frame_dequeued	(frame, frame_class, frame_cnt)					scheduler pop, after folding
+		frame_dispatch	(frame, frame_cnt, queued_ns, dispatch_ns)		watchdog, before processing
+		frame_sent		(fd, bytes)										client, after the last byte is written
+		frame_read		(packet, bytes)									server, once a whole packet is read
+		frame_parsed	(capture_ns, event_cnt, receive_ns)				receiver, capture time on the local clock
+		frame_inject	(capture_ns, event_cnt)							receiver, before the frame is written
+		frame_written	(events, event_cnt)								virtual device write or queued write
+	Timestamps are CLOCK_MONOTONIC nanoseconds, the clock bpftrace's nsecs
+	reads. scripts/unikey_pipeline_latency.bt puts them together per frame.
+*/
+#ifdef UNIKEY_HAVE_SDT
+#include <sys/sdt.h>
+#define TRACEPOINT(name, ...) STAP_PROBEV(unikey, name, __VA_ARGS__)
+#else
+#define TRACEPOINT(name, ...) do { } while (0)
+#endif
+
+#endif	// TRACEPOINTS_HPP
@@ -2,10 +2,13 @@
 #define VIRTUAL_DEVICE_HPP
 
 #include <string>
+#include <vector>
 
 #include "libevdev/libevdev.h"
 #include "libevdev/libevdev-uinput.h"
 #include "BitField.hpp"
+#include "Event_Codec.hpp"
+#include "IO_Engine.hpp"
 
 #include <linux/input.h>
 
@@ -15,6 +18,9 @@ class Virtual_Device
 		std::string device_name;
 		struct libevdev* dev = nullptr;
 		struct libevdev_uinput* virt_dev = nullptr;
+		int repeat_settings[2] = { 0, 0 };	// { delay, period } in ms, zero when repeat is disabled
+		IO_Engine* io_engine = nullptr;
+		std::vector<struct input_event> frame_buffer;
 
 		bool init_virt_libevdev();
 		void create_virt_device();
@@ -28,9 +34,14 @@ class Virtual_Device
 		void set_device_name(const std::string& device_name);
 		void enable_codes(const unsigned type, const BitField& enabled_key_field);
 		void enable_codes(const unsigned type, const std::vector<uint64_t>& bitfield);
+		void enable_abs_axes(const struct abs_axis_info* axis_list, const uint64_t& list_size);
+		void enable_properties(const BitField& enabled_props);
+		void enable_repeat(int delay, int period);
+		void set_io_engine(IO_Engine* p_engine);
 		void write_event(const struct input_event& ev);
 		void write_event(const struct input_event* ev_list, const uint64_t& list_size);
 		void write_event(unsigned type=EV_SYN, unsigned code=SYN_REPORT, int value=0);
+		void write_frame(const struct input_event* ev_list, uint64_t list_size);
 		void clear();
 };
 
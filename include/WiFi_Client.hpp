@@ -3,18 +3,40 @@
 
 #include <atomic>
 #include <stdint.h>
+#include <thread>
 
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 
+#include "Socket_Address.hpp"
+
 class WiFi_Client
 {
 	private:
-		int client_socket = socket(AF_INET, SOCK_STREAM, 0);
-		struct sockaddr_in server_addr;
-		std::atomic_bool connected_to_server = false;
+		enum Connection_State : uint8_t
+		{
+			CONNECTING = 0,
+			CONNECTED,
+			CLOSED
+		};
+
+		static constexpr int CONNECT_TIMEOUT_MS = 500;	// Bounds how long close_connection() waits on a pending connect
+
+		int client_socket = -1;	// Created on connect, once the transport is known, and kept at the same number across reconnects
+		Socket_Address server_addr;
+		mutable std::atomic_uint8_t connection_state = CONNECTING;
+		mutable std::atomic_bool is_sending = false;
+		std::thread connecting_thread;
+
+		void lock_send() const;
+		void unlock_send() const;
+		void send_message(struct iovec* p_iov, int iov_count) const;
+		void mark_connection_lost() const;
+		void replace_socket();
+		void connect_process();
 
 	public:
 		WiFi_Client() = default;
@@ -23,13 +45,15 @@ class WiFi_Client
 
 		~WiFi_Client();
 
-		void set_server_addr(const char* ip_addr, uint16_t port_num=42069);
+		bool set_server_addr(const char* address, uint16_t port_num=42069);
 		bool server_connection_status() const;
 		void send_formatted_data(const void* data , uint64_t data_unit_size=0) const;
 		void send_unformatted_data(const void* data, uint64_t data_unit_size=0, uint64_t length=1) const;
+		bool receive_reply(void* p_buffer, uint64_t size, int timeout_ms) const;
 		void connect_to_server();
 		void connect_to_server(const char* ip_addr, uint16_t port_num=42069);
-		void wait_until_connected();
+		bool wait_until_connected() const;	// False once the connection is closed
+		void wait_until_disconnected() const;
 		void close_connection();
 
 		WiFi_Client& operator=(const WiFi_Client&) = delete;
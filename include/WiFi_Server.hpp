@@ -4,33 +4,48 @@
 #include <atomic>
 #include <cstdint>
 #include <stdint.h>
+#include <vector>
 
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include "Socket_Address.hpp"
+
 class WiFi_Server
 {
 	private:
 		int server_socket = -1;
 		int client_socket = -1;
-		struct sockaddr_in server_addr;
+		Socket_Address server_addr;
 		std::atomic_bool is_connected = false;
 		std::atomic_uint64_t blocks_left = 0;
 		std::atomic_uint64_t block_size = 0;
+		std::vector<uint8_t> receive_buffer;	// Received but not yet handed out, whole records on packet-based transports
+		std::size_t buffered_size = 0;
+		std::size_t buffered_offset = 0;
+
+		ssize_t receive(void* p_buffer, std::size_t length);
+		ssize_t receive_all(void* p_buffer, std::size_t min_bytes);
 
 	public:
 		WiFi_Server();
 		WiFi_Server(uint16_t port_num);
+		WiFi_Server(const char* address);
 
 		~WiFi_Server();
 
 		const WiFi_Server& init_server(uint16_t port_num=42069);
+		const WiFi_Server& init_server(const char* address);
 		const WiFi_Server& begin_listening();
 		const WiFi_Server& wait_for_connection() const;
 		bool is_connected_to_client() const;
+		bool has_buffered_data() const;
+		bool has_buffered_record() const;
+		bool wait_for_data(uint64_t deadline_ns) const;
 		void* read_sent_data(void* p_data=nullptr);
 		void* read_sent_data_packet(void* p_data=nullptr);
+		bool send_reply(const void* p_data, uint64_t size);
 		void close_connection();
 };
 
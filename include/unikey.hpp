@@ -3,11 +3,16 @@
 
 #include <linux/input.h>
 #include <memory>
+#include <string>
 #include <sdbus-c++/sdbus-c++.h>
 #include <sdbus-c++/IConnection.h>
 #include <sdbus-c++/IObject.h>
 #include <sdbus-c++/Message.h>
 
+#include "Virtual_Device.hpp"
+#include "WiFi_Client.hpp"
+#include "WiFi_Server.hpp"
+
 extern std::unique_ptr<sdbus::IConnection> unikey_dbus_connection;
 
 extern std::unique_ptr<sdbus::IObject> unikey_root_dbus_obj;
@@ -17,10 +22,33 @@ extern std::unique_ptr<sdbus::IObject> unikey_wifi_dbus_obj;
 extern void register_to_dbus();
 extern void register_device_dbus_cmds();
 extern void register_wifi_dbus_cmds();
+extern void register_metrics_collectors();
+extern void emit_state_changes(uint32_t states);
 extern void dbus_trigger_cmd();
 extern void dbus_set_timeout_cmd(sdbus::MethodCall);
+extern void dbus_add_hotkey(sdbus::MethodCall);
+extern void dbus_add_remap_rule(sdbus::MethodCall);
+extern void dbus_use_remap_profile(sdbus::MethodCall);
+extern void dbus_clear_remap_profile(sdbus::MethodCall);
+extern void dbus_set_thread_policy(sdbus::MethodCall);
+extern void dbus_lock_memory(sdbus::MethodCall);
+extern void dbus_set_log_level(sdbus::MethodCall);
+extern void dbus_open_event_tap(sdbus::MethodCall);
+extern void dbus_close_event_tap(sdbus::MethodCall);
+extern void dbus_set_metrics_endpoint(sdbus::MethodCall);
+extern void dbus_dump_flight_recorder(sdbus::MethodCall);
+extern void dbus_set_flight_threshold(sdbus::MethodCall);
 extern void dbus_connect_to_ip(sdbus::MethodCall);
-extern void dbus_toggle_unikey_server();
+extern void dbus_add_target(sdbus::MethodCall);
+extern void dbus_remove_target(sdbus::MethodCall);
+extern void dbus_switch_target(sdbus::MethodCall);
+extern void dbus_set_target_profile(sdbus::MethodCall);
+extern void dbus_set_target_timeout(sdbus::MethodCall);
+extern void dbus_toggle_unikey_server(const std::string& address);
+
+extern void send_virtual_device_config(WiFi_Client& client);
+extern bool receive_virtual_device_config(WiFi_Server& server, Virtual_Device& virt_dev);
+extern void forward_to_virtual_device(WiFi_Server& server, Virtual_Device& virt_dev);
 
 // extern void broadcast_service();
 extern int change_group_permissions();
@@ -0,0 +1,8 @@
+#!/bin/bash
+
+# Usage: unikey_add_hotkey.sh KEY_LEFTCTRL+KEY_LEFTALT+KEY_1 target 0
+# Actions: grab, ungrab, target, next-target, exit
+busctl --system call io.unikey \
+	/io/unikey/Device \
+	io.unikey.Device.Methods \
+	AddHotkey ssu $1 $2 ${3:-0}
@@ -0,0 +1,8 @@
+#!/bin/bash
+
+# Usage: unikey_add_remap_rule.sh <profile> KEY_CAPSLOCK=KEY_LEFTCTRL
+# Leave the right-hand side empty to drop the code, e.g. KEY_F13=
+busctl --system call io.unikey \
+	/io/unikey/Device \
+	io.unikey.Device.Methods \
+	AddRemapRule ss $1 $2
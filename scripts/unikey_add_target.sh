@@ -0,0 +1,6 @@
+#!/bin/bash
+
+busctl --system call io.unikey \
+	/io/unikey/WiFi \
+	io.unikey.WiFi.Methods \
+	AddTarget s $1
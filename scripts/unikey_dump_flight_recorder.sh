@@ -0,0 +1,7 @@
+#!/bin/bash
+
+# Dumps to /var/lib/unikey and prints the path written
+busctl --system call io.unikey \
+	/io/unikey/Device \
+	io.unikey.Device.Methods \
+	DumpFlightRecorder
@@ -0,0 +1,8 @@
+#!/bin/bash
+
+# Writes a new pre-shared key for "tls:" targets, readable only by the user running unikey;
+# copy the same file to every machine
+sudo mkdir -p /etc/unikey
+head -c 32 /dev/urandom | od -An -tx1 | tr -d ' \n' | sudo tee /etc/unikey/unikey.psk > /dev/null
+sudo chown "$(id -un)" /etc/unikey/unikey.psk
+sudo chmod 600 /etc/unikey/unikey.psk
@@ -0,0 +1,4 @@
+#!/bin/bash
+
+busctl --system introspect io.unikey /io/unikey/Device io.unikey.Device
+busctl --system introspect io.unikey /io/unikey/WiFi io.unikey.WiFi
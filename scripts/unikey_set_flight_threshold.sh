@@ -0,0 +1,7 @@
+#!/bin/bash
+
+# Milliseconds, 0 turns automatic dumps off
+busctl --system call io.unikey \
+	/io/unikey/Device \
+	io.unikey.Device.Methods \
+	SetFlightThreshold u $1
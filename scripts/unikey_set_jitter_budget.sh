@@ -0,0 +1,6 @@
+#!/bin/bash
+
+busctl --system call io.unikey \
+	/io/unikey/WiFi \
+	io.unikey.WiFi.Methods \
+	SetJitterBudget u $1
@@ -0,0 +1,7 @@
+#!/bin/bash
+
+# An empty address stops the endpoint
+busctl --system call io.unikey \
+	/io/unikey/Device \
+	io.unikey.Device.Methods \
+	SetMetricsEndpoint s "$1"
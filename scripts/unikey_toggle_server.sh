@@ -3,4 +3,4 @@
 busctl --system call io.unikey \
 	/io/unikey/WiFi \
 	io.unikey.WiFi.Methods \
-	ToggleServer
+	ToggleServer s "$1"
@@ -0,0 +1,5 @@
+#!/bin/bash
+
+# Prints every PropertiesChanged signal: grab state, active target and connections
+busctl --system monitor \
+	--match "type='signal',sender='io.unikey',interface='org.freedesktop.DBus.Properties',member='PropertiesChanged'"
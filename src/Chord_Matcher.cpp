@@ -0,0 +1,195 @@
+#include "Chord_Matcher.hpp"
+#include "Logger.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+#include "libevdev/libevdev.h"
+
+static std::atomic_bool in_progress = false;
+
+static void lock_definitions()
+{
+	bool prev_state = false;
+	while (!in_progress.compare_exchange_strong(prev_state, true, std::memory_order_acq_rel))
+	{
+		in_progress.wait(true, std::memory_order_acquire);
+		prev_state = false;
+	}
+}
+
+static void unlock_definitions()
+{
+	in_progress.store(false, std::memory_order_release);
+	in_progress.notify_all();
+}
+
+void Chord_Matcher::compile()
+{
+	chord_table* p_table = new chord_table;
+	unsigned bits_used = 0;
+
+	memset(p_table->key_bit, NOT_MAPPED, sizeof(p_table->key_bit));
+	for (const chord_definition& definition : Chord_Matcher::definitions)
+	{
+		uint64_t mask = 0;
+		for (unsigned code : definition.codes)
+		{
+			if (p_table->key_bit[code] == NOT_MAPPED)
+				p_table->key_bit[code] = bits_used++;
+			mask |= (1ULL << p_table->key_bit[code]);
+		}
+		p_table->chord_mask[p_table->chord_count] = mask;
+		p_table->chord_trigger[p_table->chord_count] = definition.trigger;
+		++p_table->chord_count;
+	}
+
+	// Bit positions change between tables, so matching restarts from a clean state
+	Chord_Matcher::table.update(p_table);
+	Chord_Matcher::pressed_mask.store(0, std::memory_order_release);
+	Chord_Matcher::armed_chord.store(NOT_ARMED, std::memory_order_release);
+}
+
+bool Chord_Matcher::add_chord(const std::vector<unsigned>& codes, Action action, uint32_t argument)
+{
+	if (codes.size() == 0 || action == NONE || action >= ACTION_CNT)
+		return false;
+
+	lock_definitions();
+
+	// Count the distinct keys the new table would need
+	std::vector<bool> is_used(KEY_CNT, false);
+	unsigned keys_used = 0;
+	for (const chord_definition& definition : Chord_Matcher::definitions)
+		for (unsigned code : definition.codes)
+			if (!is_used[code])
+			{
+				is_used[code] = true;
+				++keys_used;
+			}
+	for (unsigned code : codes)
+	{
+		if (code >= KEY_CNT)
+		{
+			unlock_definitions();
+			return false;
+		}
+		if (!is_used[code])
+		{
+			is_used[code] = true;
+			++keys_used;
+		}
+	}
+	if (Chord_Matcher::definitions.size() == MAX_CHORDS || keys_used > MAX_CHORD_KEYS)
+	{
+		unlock_definitions();
+		return false;
+	}
+
+	Chord_Matcher::definitions.push_back({ codes, { action, argument } });
+	Chord_Matcher::compile();
+
+	unlock_definitions();
+	return true;
+}
+
+bool Chord_Matcher::add_chord(const std::string& chord, const std::string& action, uint32_t argument)
+{
+	static const char* ACTION_NAMES[ACTION_CNT] = { "", "grab", "ungrab", "target", "next-target", "exit" };
+
+	std::vector<unsigned> codes;
+	std::size_t begin = 0;
+	while (begin < chord.size())
+	{
+		std::size_t end = chord.find('+', begin);
+		if (end == std::string::npos)
+			end = chord.size();
+
+		int code = libevdev_event_code_from_name(EV_KEY, chord.substr(begin, end - begin).c_str());
+		if (code < 0)
+		{
+			Logger::log(Logger::ERROR, "Unknown key in chord: %s", chord.substr(begin, end - begin).c_str());
+			return false;
+		}
+		codes.push_back(code);
+		begin = end + 1;
+	}
+
+	for (unsigned n = TOGGLE_GRAB; n < ACTION_CNT; ++n)
+	{
+		if (action == ACTION_NAMES[n])
+			return Chord_Matcher::add_chord(codes, (Action)n, argument);
+	}
+	Logger::log(Logger::ERROR, "Unknown chord action: %s", action.c_str());
+	return false;
+}
+
+void Chord_Matcher::clear_chords()
+{
+	lock_definitions();
+	Chord_Matcher::definitions.clear();
+	Chord_Matcher::compile();
+	unlock_definitions();
+}
+
+void Chord_Matcher::set_action_handler(Action action, void (*handler)(uint32_t))
+{
+	if (action < ACTION_CNT)
+		Chord_Matcher::action_handlers[action] = handler;
+}
+
+Chord_Matcher::Trigger Chord_Matcher::process_key(unsigned code, int value)
+{
+	RCU_Pointer<chord_table>::Reader p_table(Chord_Matcher::table);
+	if (p_table.get() == nullptr || code >= KEY_CNT)
+		return Trigger();
+	if (p_table->key_bit[code] == NOT_MAPPED)
+	{
+		// Any other key pressed on top of a chord disarms it too
+		if (value == 1 && Chord_Matcher::armed_chord.load(std::memory_order_relaxed) != NOT_ARMED)
+			Chord_Matcher::armed_chord.store(NOT_ARMED, std::memory_order_release);
+		return Trigger();
+	}
+
+	const uint64_t bit = 1ULL << p_table->key_bit[code];
+	if (value == 1)
+	{
+		uint64_t mask = Chord_Matcher::pressed_mask.fetch_or(bit, std::memory_order_acq_rel) | bit;
+		uint32_t matched = NOT_ARMED;
+		for (unsigned n = 0; n < p_table->chord_count; ++n)
+		{
+			if (p_table->chord_mask[n] == mask)
+			{
+				matched = n;
+				break;
+			}
+		}
+		// Extra keys on top of a chord disarm it
+		Chord_Matcher::armed_chord.store(matched, std::memory_order_release);
+	}
+	else if (value == 0)
+	{
+		uint64_t mask = Chord_Matcher::pressed_mask.fetch_and(~bit, std::memory_order_acq_rel) & ~bit;
+
+		// Fire only once every key of the chord is released so nothing stays held on the target
+		if (mask == 0)
+		{
+			uint32_t armed = Chord_Matcher::armed_chord.exchange(NOT_ARMED, std::memory_order_acq_rel);
+			if (armed < p_table->chord_count)
+				return p_table->chord_trigger[armed];
+		}
+	}
+	return Trigger();
+}
+
+void Chord_Matcher::dispatch(const Trigger& trigger)
+{
+	if (trigger.action != NONE && trigger.action < ACTION_CNT && Chord_Matcher::action_handlers[trigger.action] != nullptr)
+		Chord_Matcher::action_handlers[trigger.action](trigger.argument);
+}
+
+void Chord_Matcher::reclaim()
+{
+	Chord_Matcher::table.reclaim();
+}
@@ -0,0 +1,111 @@
+#include "Clock_Sync.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <sstream>
+#include <string>
+
+void Clock_Estimator::add_sample(uint64_t t1, uint64_t t2, uint64_t t3, uint64_t t4)
+{
+	int64_t rtt_ns = ((int64_t)t4 - (int64_t)t1) - ((int64_t)t3 - (int64_t)t2);
+	this->samples[this->next_sample].offset_ns = (((int64_t)t2 - (int64_t)t1) + ((int64_t)t3 - (int64_t)t4)) / 2;
+	this->samples[this->next_sample].rtt_ns = (rtt_ns > 0) ? rtt_ns : 0;
+	this->next_sample = (this->next_sample + 1) % SAMPLE_CNT;
+	if (this->sample_count < SAMPLE_CNT)
+		++this->sample_count;
+}
+
+bool Clock_Estimator::return_estimate(int64_t& offset_ns, uint64_t& rtt_ns) const
+{
+	if (this->sample_count == 0)
+		return false;
+
+	const sample* p_best = &this->samples[0];
+	for (unsigned n = 1; n < this->sample_count; ++n)
+	{
+		if (this->samples[n].rtt_ns < p_best->rtt_ns)
+			p_best = &this->samples[n];
+	}
+	offset_ns = p_best->offset_ns;
+	rtt_ns = p_best->rtt_ns;
+	return true;
+}
+
+void Clock_Estimator::reset()
+{
+	this->sample_count = 0;
+	this->next_sample = 0;
+}
+
+// Same clock as the kernel's input event timestamps
+uint64_t Clock_Sync::now_ns()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+uint64_t Clock_Sync::sender_now_ns()
+{
+	return Clock_Sync::to_sender_clock(Clock_Sync::now_ns());
+}
+
+uint64_t Clock_Sync::to_sender_clock(uint64_t timestamp_ns)
+{
+	return timestamp_ns + Clock_Sync::injected_offset_ns.load(std::memory_order_relaxed);
+}
+
+void Clock_Sync::set_injected_offset(int64_t offset_ns)
+{
+	Clock_Sync::injected_offset_ns.store(offset_ns, std::memory_order_relaxed);
+}
+
+void Clock_Sync::set_peer_estimate(int64_t offset_ns, uint64_t rtt_ns)
+{
+	Clock_Sync::peer_offset_ns.store(offset_ns, std::memory_order_relaxed);
+	Clock_Sync::peer_rtt_ns.store((rtt_ns != 0) ? rtt_ns : 1, std::memory_order_release);
+}
+
+uint64_t Clock_Sync::to_local_clock(uint64_t capture_ns)
+{
+	// Frames that arrive before the first estimate cannot be placed on this clock
+	if (capture_ns == 0 || Clock_Sync::peer_rtt_ns.load(std::memory_order_acquire) == 0)
+		return 0;
+	return capture_ns + Clock_Sync::peer_offset_ns.load(std::memory_order_relaxed);
+}
+
+void Clock_Sync::record_frame(uint64_t local_capture_ns)
+{
+	if (local_capture_ns == 0)
+		return;
+
+	int64_t latency_ns = (int64_t)Clock_Sync::now_ns() - (int64_t)local_capture_ns;
+	if (latency_ns < 0)	// Within the error of the estimate, counted so that a bad estimate shows
+		Clock_Sync::negative_latency_cnt.fetch_add(1, std::memory_order_relaxed);
+	else
+		Clock_Sync::one_way_latency.record(latency_ns);
+}
+
+void Clock_Sync::reset_peer()
+{
+	Clock_Sync::peer_rtt_ns.store(0, std::memory_order_release);
+	Clock_Sync::peer_offset_ns.store(0, std::memory_order_relaxed);
+}
+
+std::string Clock_Sync::return_report()
+{
+	std::ostringstream text;
+	uint64_t rtt_ns = Clock_Sync::peer_rtt_ns.load(std::memory_order_acquire);
+	if (rtt_ns == 0)
+		text << "Sender clock: no estimate\n";
+	else
+		text << "Sender clock: offset=" << Clock_Sync::peer_offset_ns.load(std::memory_order_relaxed) / 1000
+			<< "us rtt=" << rtt_ns / 1000 << "us\n";
+
+	text << Clock_Sync::one_way_latency.report("One-way latency (capture to uinput)");
+	uint64_t negative_cnt = Clock_Sync::negative_latency_cnt.load(std::memory_order_relaxed);
+	if (negative_cnt != 0)
+		text << "\tbelow zero: " << negative_cnt << '\n';
+	return text.str();
+}
@@ -1,31 +1,52 @@
 #include "Cyclic_Queue.hpp"
 
 #include <atomic>
-#include <stdlib.h>
 
-Cyclic_Queue::~Cyclic_Queue()
+bool Cyclic_Queue::push(void* data)
 {
-	while (this->head.load() != this->tail.load())
+	// An entry is only claimed while there is room, a full queue used to overwrite its oldest entries
+	std::size_t tail = this->tail.load(std::memory_order_acquire);
+	do
 	{
-		free(this->queue[this->head.fetch_add(1)]);
-	}
+		if (tail - this->head.load(std::memory_order_acquire) >= SIZE)
+			return false;
+	} while (!this->tail.compare_exchange_weak(tail, tail + 1, std::memory_order_acq_rel));
+
+	this->queue[tail % SIZE].store(data, std::memory_order_release);
+	return true;
 }
 
-void Cyclic_Queue::push(void* data)
+void* Cyclic_Queue::pop()
 {
-	this->queue[this->tail.fetch_add(1, std::memory_order_acq_rel) % SIZE]
-		.store(data, std::memory_order_release);
+	if (this->size() == 0)
+		return nullptr;
+
+	// The entry is emptied before head moves past it, so a producer never claims it while still full
+	std::size_t head = this->head.load(std::memory_order_acquire);
+	void* data = this->queue[head % SIZE].exchange(nullptr, std::memory_order_acq_rel);
+	if (data == nullptr)	// Claimed, but its producer has yet to store it
+		return nullptr;
+	this->head.store(head + 1, std::memory_order_release);
+	this->head.notify_all();
+	return data;
 }
 
-void* Cyclic_Queue::pop()
+// Null while empty or while the producer of the oldest entry has yet to store it
+void* Cyclic_Queue::peek() const
 {
 	return (this->size())
-		? this->queue[this->head.fetch_add(1, std::memory_order_acq_rel) % SIZE]
-			.exchange(nullptr, std::memory_order_acq_rel)
+		? this->queue[this->head.load(std::memory_order_acquire) % SIZE].load(std::memory_order_acquire)
 		: nullptr;
 }
 
 std::size_t Cyclic_Queue::size() const
 {
 	return this->tail.load(std::memory_order_acquire) - this->head.load(std::memory_order_acquire);
+}
+
+void Cyclic_Queue::wait_for_room() const
+{
+	std::size_t head = this->head.load(std::memory_order_acquire);
+	if (this->tail.load(std::memory_order_acquire) - head >= SIZE)
+		this->head.wait(head, std::memory_order_acquire);
 }
\ No newline at end of file
@@ -1,14 +1,26 @@
 #include "Device.hpp"
 #include "BitField.hpp"
+#include "Chord_Matcher.hpp"
+#include "Event_Filter.hpp"
+#include "Event_Tap.hpp"
+#include "Flight_Recorder.hpp"
+#include "Frame_Pool.hpp"
+#include "Logger.hpp"
+#include "Metrics.hpp"
+#include "State_Notifier.hpp"
+#include "Thread_Policy.hpp"
+#include "Tracepoints.hpp"
 
 #include "libevdev/libevdev.h"
 #include "libudev.h"
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <cstddef>
 #include <filesystem>
 #include <functional>
-#include <iostream>
+#include <cstdio>
 #include <cerrno>
 #include <cstdint>
 #include <ctime>
@@ -19,6 +31,7 @@
 #include <linux/input-event-codes.h>
 #include <linux/input.h>
 #include <sys/types.h>
+#include <sys/ioctl.h>
 #include <sys/poll.h>
 
 void Device::set_event_processor(void (*event_processing_function)(const void*, uint64_t))
@@ -45,95 +58,365 @@ void Device::set_event_processor(void (*event_processing_function)(const void*,
 	in_progress.notify_all();
 }
 
-void Device::initialize_devices(const std::string &directory)
+static std::atomic_bool registry_in_progress = false;
+
+void Device::lock_registry()
 {
-	if (Device::active_devices.load() == 0)
+	bool prev_state = false;
+	while (!registry_in_progress.compare_exchange_strong(prev_state, true, std::memory_order_acq_rel))
 	{
-		if (Device::poll_signal_fd < 0)
+		registry_in_progress.wait(true, std::memory_order_acquire);
+		prev_state = false;
+	}
+}
+
+void Device::unlock_registry()
+{
+	registry_in_progress.store(false, std::memory_order_release);
+	registry_in_progress.notify_all();
+}
+
+bool Device::is_input_capable(struct udev_device* dev)
+{
+	// Tags set by udev's input_id builtin, a node without any of them cannot produce forwarded events
+	static constexpr const char* INPUT_PROPERTIES[] = {
+		"ID_INPUT_KEY", "ID_INPUT_KEYBOARD", "ID_INPUT_MOUSE", "ID_INPUT_TOUCHPAD", "ID_INPUT_TOUCHSCREEN",
+		"ID_INPUT_TABLET", "ID_INPUT_JOYSTICK", "ID_INPUT_POINTINGSTICK", "ID_INPUT_TRACKBALL"
+	};
+
+	const char* sysname = udev_device_get_sysname(dev);
+	if (sysname == nullptr || !std::string(sysname).starts_with("event") || udev_device_get_devnode(dev) == nullptr)
+		return false;
+
+	for (const char* property : INPUT_PROPERTIES)
+	{
+		const char* value = udev_device_get_property_value(dev, property);
+		if (value != nullptr && value[0] == '1')
+			return true;
+	}
+	return false;
+}
+
+void Device::register_device(const std::string& devnode)
+{
+	// Opening and probing runs unlocked so several nodes can be probed at once
+	Device* p_device = new Device(devnode);
+	if (p_device->dev == nullptr || Device::is_exit.load(std::memory_order_acquire))
+	{
+		delete p_device;
+		return;
+	}
+
+	Device* p_stale = nullptr;
+	Device::lock_registry();
+
+	auto found = Device::device_handles.find(p_device->devnum);
+	if (found != Device::device_handles.end())
+	{
+		Device* p_existing = Device::device_slots.find(found->second);
+		if (p_existing != nullptr && p_existing->is_active.load(std::memory_order_acquire))
 		{
-			std::cerr << "Poll initialization failed: " << strerror(errno) << std::endl;
+			// Already captured, e.g. seen by both the startup enumeration and the hotplug monitor
+			Device::unlock_registry();
+			delete p_device;
 			return;
 		}
+		p_stale = Device::device_slots.erase(found->second);	// Capture thread already ended on a read error
+		Device::device_handles.erase(found);
+	}
 
-		Device::watchdog_thread = std::thread(watchdog_process);
-		std::string fullpath = directory.ends_with("/") ? directory.substr(0, directory.size() - 1) : directory;
+	p_device->handle = Device::device_slots.insert(p_device);
+	Device::device_handles[p_device->devnum] = p_device->handle;
+	p_device->is_active.store(true, std::memory_order_release);
+	p_device->input_monitor_thread = std::thread(std::bind(&Device::input_monitor_process, p_device));
+	Device::active_devices.fetch_add(1, std::memory_order_acq_rel);
+	Device::active_devices.notify_all();
+	Device::publish_registry();
 
-		for (const auto& entry : std::filesystem::directory_iterator(fullpath.c_str()))
+	Device::unlock_registry();
+	if (p_stale != nullptr)
+		Device::registry_epochs.retire([p_stale]() { delete p_stale; });
+	Device::registry_epochs.collect();
+}
+
+void Device::unregister_device(dev_t devnum)
+{
+	Device* p_device = nullptr;
+	Device::lock_registry();
+
+	auto found = Device::device_handles.find(devnum);
+	if (found != Device::device_handles.end())
+	{
+		p_device = Device::device_slots.erase(found->second);
+		Device::device_handles.erase(found);
+		Device::publish_registry();
+	}
+
+	Device::unlock_registry();
+
+	// Capture stops right away, the object itself is freed once no reader can still see it
+	if (p_device != nullptr)
+	{
+		p_device->stop();
+		Device::registry_epochs.retire([p_device]() { delete p_device; });
+	}
+	Device::registry_epochs.collect();
+}
+
+void Device::publish_registry()
+{
+	// Called with the registry locked; readers keep whichever snapshot they loaded until their guard ends
+	std::vector<Device*>* p_devices = new std::vector<Device*>;
+	p_devices->reserve(Device::device_slots.size());
+	Device::device_slots.for_each([&](Device* p_device)
+	{
+		p_devices->push_back(p_device);
+	});
+
+	const std::vector<Device*>* p_old = Device::registry_snapshot.exchange(p_devices, std::memory_order_acq_rel);
+	if (p_old != nullptr)
+		Device::registry_epochs.retire([p_old]() { delete p_old; });
+}
+
+void Device::stop()
+{
+	static constexpr uint64_t message = 1;
+
+	this->is_removed.store(true, std::memory_order_release);
+	write(this->exit_fd, &message, sizeof(uint64_t));
+}
+
+// Event nodes under directory worth probing, found without opening any of them when udev is available
+std::vector<std::string> Device::return_input_candidates(const std::string& directory)
+{
+	std::vector<std::string> candidates;
+
+	struct udev* udev = udev_new();
+	if (udev != nullptr)
+	{
+		// Property matches are OR'ed together, so one enumeration finds every input-capable node
+		struct udev_enumerate* enumerate = udev_enumerate_new(udev);
+		udev_enumerate_add_match_subsystem(enumerate, "input");
+		for (const char* property : { "ID_INPUT_KEY", "ID_INPUT_MOUSE", "ID_INPUT_TOUCHPAD", "ID_INPUT_TOUCHSCREEN", "ID_INPUT_TABLET", "ID_INPUT_JOYSTICK", "ID_INPUT_POINTINGSTICK", "ID_INPUT_TRACKBALL" })
+			udev_enumerate_add_match_property(enumerate, property, "1");
+		udev_enumerate_scan_devices(enumerate);
+
+		struct udev_list_entry* entry;
+		udev_list_entry_foreach(entry, udev_enumerate_get_list_entry(enumerate))
 		{
-			if (entry.path().filename().string().starts_with("event"))
+			struct udev_device* dev = udev_device_new_from_syspath(udev, udev_list_entry_get_name(entry));
+			if (dev != nullptr)
 			{
-				Device* p_device = new Device(fullpath + "/" + entry.path().filename().string());
-				if (p_device->dev != nullptr)
-				{
-					Device::device_objects.push_back(p_device);
-				}
+				if (Device::is_input_capable(dev) && std::string(udev_device_get_devnode(dev)).starts_with(directory))
+					candidates.push_back(udev_device_get_devnode(dev));
+				udev_device_unref(dev);
 			}
 		}
+
+		udev_enumerate_unref(enumerate);
+		udev_unref(udev);
 	}
-	else
+	else	// No udev available, every event node has to be opened to be probed
 	{
-		Device* p_device = new Device(directory);
-		if (p_device->dev != nullptr && Device::device_objects[p_device->id] != nullptr)
+		std::string fullpath = directory.ends_with("/") ? directory.substr(0, directory.size() - 1) : directory;
+		for (const auto& entry : std::filesystem::directory_iterator(fullpath.c_str()))
 		{
-			if (p_device->id < Device::device_objects.size())
-			{
-				delete Device::device_objects[p_device->id];
-				Device::device_objects[p_device->id] = p_device;
-			}
-			else
-				Device::device_objects.push_back(p_device);
+			if (entry.path().filename().string().starts_with("event"))
+				candidates.push_back(fullpath + "/" + entry.path().filename().string());
 		}
 	}
+
+	return candidates;
 }
 
-unsigned Device::set_timeout_length(unsigned int seconds)
+void Device::discover_devices(const std::string& directory)
 {
-	static std::atomic_bool in_progress = false;
-	constexpr unsigned MINMAX_TIME[2] = { 1, 900 };
-	
-	
-	bool prev_state = false;
-	while (!in_progress.compare_exchange_strong(prev_state, !prev_state))
+	auto start_time = std::chrono::steady_clock::now();
+	std::vector<std::string> candidates = Device::return_input_candidates(directory);
+
+	// Probe candidates in parallel, each device goes online as soon as its own probe finishes
+	std::atomic<std::size_t> next_candidate{0};
+	std::vector<std::thread> probe_threads(std::min<std::size_t>(candidates.size(), std::max(1u, std::min(std::thread::hardware_concurrency(), 8u))));
+	for (std::thread& probe_thread : probe_threads)
 	{
-		in_progress.wait(false, std::memory_order_acquire);
-		prev_state = false;
+		probe_thread = std::thread([&]()
+		{
+			for (std::size_t n = next_candidate.fetch_add(1); n < candidates.size(); n = next_candidate.fetch_add(1))
+			{
+				if (Device::is_exit.load(std::memory_order_acquire))
+					return;
+				Device::register_device(candidates[n]);
+			}
+		});
 	}
-	if (Device::is_grabbed.load(std::memory_order_acquire))
+	for (std::thread& probe_thread : probe_threads)
 	{
-		Device::is_grabbed.wait(true, std::memory_order_acquire);
+		probe_thread.join();
 	}
-	while (uint32_t ev_left = Device::pending_events.load(std::memory_order_release))
+
+	Logger::log(Logger::INFO, "Initialized %u input devices out of %zu candidates in %lld ms",
+		Device::active_devices.load(std::memory_order_acquire), candidates.size(),
+		(long long)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time).count());
+}
+
+void Device::initialize_devices(const std::string &directory)
+{
+	if (Device::watchdog_thread.joinable() == false)
 	{
-		Device::pending_events.wait(ev_left, std::memory_order_acquire);
+		if (Device::poll_signal_fd < 0)
+		{
+			Logger::log(Logger::ERROR, "Poll initialization failed: %s", strerror(errno));
+			return;
+		}
+
+		// Returns right away, devices come online from the discovery thread as they are probed
+		Device::register_chord_actions();
+		Device::watchdog_thread = std::thread(watchdog_process);
+		Device::discovery_thread = std::thread(Device::discover_devices, directory);
+	}
+	else
+	{
+		Device::register_device(directory);
 	}
+}
+
+static unsigned clamp_timeout(unsigned seconds)
+{
+	constexpr unsigned MINMAX_TIME[2] = { 1, 900 };
 
 	if (seconds < MINMAX_TIME[0])	// Warning: minimum time is 1 second
-		seconds = MINMAX_TIME[0];
-	else if (seconds > MINMAX_TIME[1])	// Warning: maximum time is 15 minutes
-		seconds = MINMAX_TIME[1];
+		return MINMAX_TIME[0];
+	if (seconds > MINMAX_TIME[1])	// Warning: maximum time is 15 minutes
+		return MINMAX_TIME[1];
+	return seconds;
+}
 
-	Device::timeout_length = seconds * 1000;
+static uint64_t monotonic_ns()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
 
-	in_progress.store(false, std::memory_order_release);
-	in_progress.notify_all();
+// Moves wall clock event times onto CLOCK_MONOTONIC, the clock every latency and clock estimate is built on
+static void move_to_monotonic(struct input_event* event_queue, uint64_t event_count, uint64_t read_ns)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	int64_t shift_ns = (int64_t)read_ns - (int64_t)((uint64_t)now.tv_sec * 1000000000 + now.tv_nsec);
+
+	for (uint64_t n = 0; n < event_count; ++n)
+	{
+		int64_t event_ns = (int64_t)((uint64_t)event_queue[n].input_event_sec * 1000000000 + (uint64_t)event_queue[n].input_event_usec * 1000);
+		if (event_ns == 0)	// Synthesized events carry no time
+			continue;
+		event_ns = (event_ns + shift_ns > 0) ? event_ns + shift_ns : 0;
+		event_queue[n].input_event_sec = event_ns / 1000000000;
+		event_queue[n].input_event_usec = (event_ns % 1000000000) / 1000;
+	}
+}
+
+unsigned Device::set_timeout_length(unsigned int seconds)
+{
+	seconds = clamp_timeout(seconds);
+	Device::timeout_length.store(seconds * 1000, std::memory_order_release);
+	Device::kick_timeout();
 
 	return seconds;
 }
 
-bool Device::trigger_activation()
+unsigned Device::set_timeout_override(unsigned int seconds)
 {
-	bool prev_state = Device::is_grabbed.exchange(!Device::is_grabbed.load(std::memory_order_acquire), std::memory_order_acq_rel);
+	// Zero falls back to the default set through set_timeout_length()
+	if (seconds != 0)
+		seconds = clamp_timeout(seconds);
+	Device::timeout_override.store(seconds * 1000, std::memory_order_release);
+	Device::kick_timeout();
+
+	return seconds;
+}
+
+uint64_t Device::return_timeout_ns()
+{
+	uint64_t timeout_ms = Device::timeout_override.load(std::memory_order_acquire);
+	if (timeout_ms == 0)
+		timeout_ms = Device::timeout_length.load(std::memory_order_acquire);
+	return timeout_ms * 1000000;
+}
+
+void Device::arm_timeout(uint64_t deadline_ns)
+{
+	struct itimerspec deadline;
+	memset(&deadline, 0, sizeof(deadline));
+	deadline.it_value.tv_sec = deadline_ns / 1000000000;
+	deadline.it_value.tv_nsec = deadline_ns % 1000000000;
+	timerfd_settime(Device::timeout_fd, TFD_TIMER_ABSTIME, &deadline, nullptr);
+}
+
+void Device::kick_timeout()
+{
+	// Expire right away, the watchdog then re-arms from the last activity with the new length
+	if (Device::is_grabbed.load(std::memory_order_acquire))
+		Device::arm_timeout(1);
+}
+
+void Device::register_chord_actions()
+{
+	Chord_Matcher::set_action_handler(Chord_Matcher::TOGGLE_GRAB, [](uint32_t)
+	{
+		Logger::log(Logger::INFO, Device::trigger_activation() ? "---GRABBED---" : "--UNGRABBED--");
+	});
+	Chord_Matcher::set_action_handler(Chord_Matcher::UNGRAB, [](uint32_t)
+	{
+		if (Device::release_grab())
+			Logger::log(Logger::INFO, "--UNGRABBED--");
+	});
+	Chord_Matcher::set_action_handler(Chord_Matcher::EXIT, [](uint32_t)
+	{
+		// trigger_exit() joins the capture threads, so it cannot run on one of them
+		std::thread exit_thread(&Device::trigger_exit);
+		exit_thread.detach();
+	});
+
+	// Pressing and releasing the power button while grabbed gives control back to this machine
+	Chord_Matcher::add_chord(std::vector<unsigned>{ KEY_POWER }, Chord_Matcher::UNGRAB);
+}
+
+void Device::signal_grab_change()
+{
+	static constexpr uint64_t add_to_count = 1;
 
 	uint64_t message = Device::active_devices.load(std::memory_order_acquire);
 	write(Device::event_signal_fd, &message, sizeof(uint64_t));
+	write(Device::poll_signal_fd, &add_to_count, sizeof(uint64_t));	// The watchdog disarms its timer on an ungrab
 
 	Device::is_grabbed.notify_all();
+	State_Notifier::mark_changed(State_Notifier::GRAB_STATE);	// Often on a capture thread, the bus is left to the notifier
+}
+
+// Ungrabs without ever grabbing, false when input was not grabbed
+bool Device::release_grab()
+{
+	bool prev_state = true;
+	if (!Device::is_grabbed.compare_exchange_strong(prev_state, false, std::memory_order_acq_rel))
+		return false;
+
+	Device::signal_grab_change();
+	return true;
+}
+
+bool Device::trigger_activation()
+{
+	bool prev_state = Device::is_grabbed.exchange(!Device::is_grabbed.load(std::memory_order_acquire), std::memory_order_acq_rel);
+	Device::signal_grab_change();
 	return !prev_state;
 }
 
 void Device::trigger_exit()
 {
 	Device::is_exit.store(true, std::memory_order_release);
+	if (Device::discovery_thread.joinable())
+		Device::discovery_thread.join();
 	if (Device::is_grabbed.load() == false)
 		Device::trigger_activation();
 
@@ -142,14 +425,18 @@ void Device::trigger_exit()
 	Device::watchdog_thread.join();
 	// Notify event handler that devices are exited
 
-	for (std::size_t n = 0; n < Device::device_objects.size(); ++n)
+	Device::lock_registry();
+	Device::device_slots.for_each([](Device* p_device)
 	{
-		if (Device::device_objects[n] != nullptr)
-		{
-			delete Device::device_objects[n];
-			Device::device_objects[n] = nullptr;
-		}
-	}
+		Device::registry_epochs.retire([p_device]() { delete p_device; });
+	});
+	Device::device_slots = Slot_Map<Device>();
+	Device::device_handles.clear();
+	Device::publish_registry();
+	Device::unlock_registry();
+	Device::registry_epochs.synchronize();	// Waits out any reader still walking the old snapshot
+	Chord_Matcher::reclaim();
+	Event_Filter::reclaim();
 	Device::is_exit.notify_all();
 }
 
@@ -161,73 +448,126 @@ bool Device::return_grab_state()
 void Device::watchdog_process()
 {
 	std::thread hotplug_process(Device::hotplug_detect);
+	Thread_Policy::enter(Thread_Policy::WATCHDOG);
 
-	struct pollfd pfd;
-	pfd.fd = Device::poll_signal_fd;
-	pfd.events = POLLIN;
+	struct pollfd pfd[2];
+	pfd[0].fd = Device::poll_signal_fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = Device::timeout_fd;
+	pfd[1].events = POLLIN;
+
+	/*
+		The inactivity timer is armed once per window rather than per frame. Frames only
+		record when they were processed; on expiry the timer is pushed out to the end of
+		the window that last activity started, and input is released only once a full
+		window has passed without any.
+	*/
+	uint64_t last_activity_ns = 0;
+	bool timer_armed = false;
 
 	Device::active_devices.wait(0);
 	while (Device::is_exit.load(std::memory_order_acquire) == false)
 	{
 		if (Device::pending_events.load(std::memory_order_acquire))
 		{
-			uint64_t event_count = 0;
-			read(pfd.fd, &event_count, sizeof(uint64_t));
-			void* p_data = Device::global_queue.pop();
+			// Highest class first; the tap still sees every frame as captured
+			uint64_t frame_cnt = 0;
+			void* p_data = Device::frame_scheduler.pop(frame_cnt, &Event_Tap::publish);
 
 			if (p_data != nullptr)
 			{
+				last_activity_ns = monotonic_ns();
+				Device::queue_latency.record(last_activity_ns - Frame_Pool::return_queued_time(p_data));	// Watchdog wake-up delay
+				TRACEPOINT(frame_dispatch, p_data, frame_cnt, Frame_Pool::return_queued_time(p_data), last_activity_ns);
+				Flight_Recorder::record_frame(Flight_Recorder::DISPATCH, p_data, last_activity_ns);
 				Device::event_process(p_data, sizeof(struct input_event));
-				Device::pending_events.fetch_sub(1, std::memory_order_acq_rel);
-				Device::global_mem_bank.push(p_data);
+				Device::pending_events.fetch_sub(frame_cnt, std::memory_order_acq_rel);
+				Chord_Matcher::Trigger trigger = Frame_Pool::return_trigger(p_data);
+				Frame_Pool::release(p_data);
+
+				// Runs only now, so a switch cannot send the chord's last release to the new target
+				if (trigger.action != Chord_Matcher::NONE)
+					Chord_Matcher::dispatch(trigger);
 			}
 		}
 		else if (Device::is_grabbed.load(std::memory_order_acquire))
 		{
-			// Only timeout watchdog if no keys are being pressed down
-			if (poll(&pfd, 1, 
-				(
-					Device::global_key_press_cnt.load(std::memory_order_acquire)
-						? -1
-						: Device::timeout_length
-				)) < 0)
+			if (!timer_armed)
+			{
+				last_activity_ns = monotonic_ns();
+				Device::arm_timeout(last_activity_ns + Device::return_timeout_ns());
+				timer_armed = true;
+			}
+
+			// A frame queued after the flag is set either is seen here or writes the eventfd
+			pfd[0].revents = 0;
+			pfd[1].revents = 0;
+			Device::is_watchdog_sleeping.store(true, std::memory_order_seq_cst);
+			if (Device::pending_events.load(std::memory_order_seq_cst) == 0 && poll(pfd, 2, -1) < 0)
 			{
-				std::cerr << "Poll failed: " << strerror(errno) << std::endl;   // Error while polling
+				Logger::log(Logger::ERROR, "Poll failed: %s", strerror(errno));   // Error while polling
 			}
+			Device::is_watchdog_sleeping.store(false, std::memory_order_relaxed);
 
-			if ((pfd.revents & POLLIN) == 0)	// If broke out of polling and no new events are waiting
+			if (pfd[0].revents & POLLIN)
 			{
-				Device::trigger_activation();
+				uint64_t signal_count = 0;
+				read(pfd[0].fd, &signal_count, sizeof(uint64_t));	// One read clears every signal
+			}
+
+			if (pfd[1].revents & POLLIN)
+			{
+				uint64_t expirations = 0;
+				read(pfd[1].fd, &expirations, sizeof(uint64_t));
+
+				uint64_t now_ns = monotonic_ns();
+				uint64_t deadline_ns = last_activity_ns + Device::return_timeout_ns();
+				if (Device::global_key_press_cnt.load(std::memory_order_acquire))	// Only time out if no keys are being pressed down
+					Device::arm_timeout(now_ns + Device::return_timeout_ns());
+				else if (now_ns < deadline_ns)
+					Device::arm_timeout(deadline_ns);
+				else
+				{
+					// Only ever releases, an ungrab that beat the timer must not turn into a grab
+					timer_armed = false;
+					Device::release_grab();
+				}
 			}
 		}
 		else
 		{
+			if (timer_armed)
+			{
+				Device::arm_timeout(0);	// Disarm
+				timer_armed = false;
+			}
 			Device::pending_events.notify_all();
 			Device::is_grabbed.wait(false);
 		}
 	}
 
-	// Close everything out
-	while (uint32_t active_devices_left = Device::active_devices.load())
-	{
-		Device::active_devices.wait(active_devices_left);
-	}
-	while (Device::global_queue.size())
+	// Close everything out, making room for any capture thread held back by a full queue
+	uint64_t frame_cnt = 0;
+	while (void* p_data = Device::frame_scheduler.pop(frame_cnt))
 	{
-		free(Device::global_queue.pop());
+		Frame_Pool::release(p_data);
 	}
-	while (Device::global_mem_bank.size())
+	while (uint32_t active_devices_left = Device::active_devices.load())
 	{
-		free(Device::global_mem_bank.pop());
+		Device::active_devices.wait(active_devices_left);
 	}
-	while (Device::global_id_queue.size())
+	while (void* p_data = Device::frame_scheduler.pop(frame_cnt))
 	{
-		Device::global_id_queue.pop();
+		Frame_Pool::release(p_data);
 	}
+	Frame_Pool::clear();
+	Event_Tap::destroy();
 
 	close(Device::event_signal_fd);
 	close(Device::poll_signal_fd);
+	close(Device::timeout_fd);
 	hotplug_process.join();
+	Thread_Policy::leave(Thread_Policy::WATCHDOG);
 }
 
 void Device::hotplug_detect()
@@ -235,14 +575,14 @@ void Device::hotplug_detect()
 	struct udev* udev = udev_new();
 	if (!udev)
 	{
-		std::cerr << "Can't create udev context!" << std::endl;
+		Logger::log(Logger::ERROR, "Can't create udev context!");
 		return;
 	}
 	
 	struct udev_monitor* mon = udev_monitor_new_from_netlink(udev, "udev");
 	if (!mon)
 	{
-		std::cerr << "Can't create udev monitor!" << std::endl;
+		Logger::log(Logger::ERROR, "Can't create udev monitor!");
 		return;
 	}
 
@@ -264,11 +604,25 @@ void Device::hotplug_detect()
 			if (dev)
 			{
 				std::string action = udev_device_get_action(dev);
-				const char* devnode = udev_device_get_devnode(dev);
 				std::string subsystem(udev_device_get_subsystem(dev));
-				if (action == "add" && devnode && subsystem == "input")
+				if (subsystem == "input")
 				{
-					Device::initialize_devices(devnode);
+					if (action == "add" && Device::is_input_capable(dev))
+					{
+						Device::register_device(udev_device_get_devnode(dev));
+					}
+					else if (action == "remove")
+					{
+						Device::unregister_device(udev_device_get_devnum(dev));
+					}
+					else if (action == "change")
+					{
+						// Only capability changes matter, an already captured device keeps running
+						if (Device::is_input_capable(dev))
+							Device::register_device(udev_device_get_devnode(dev));
+						else
+							Device::unregister_device(udev_device_get_devnum(dev));
+					}
 				}
 				udev_device_unref(dev);
 			}
@@ -283,11 +637,18 @@ void Device::default_event_processor(const void* data, uint64_t unit_size)
 {
 	uint64_t& LENGTH = *(uint64_t*)data;
 	const struct input_event* ev = (struct input_event*)(&LENGTH + 1);
-	for (uint64_t n = 0; n < LENGTH; ++n)
+	// One log line per four events, formatted on this thread and written out by the logger's flusher
+	for (uint64_t n = 0; n < LENGTH; n += 4)
 	{
-		std::cout << libevdev_event_code_get_name(ev[n].type, ev[n].code) << ',' << ev[n].value << ((n % 4 == 3) ? "\n" : "\t\t");
+		char line[192];
+		std::size_t used = 0;
+		for (uint64_t m = n; m < LENGTH && m < n + 4 && used < sizeof(line); ++m)
+		{
+			const char* name = libevdev_event_code_get_name(ev[m].type, ev[m].code);
+			used += snprintf(line + used, sizeof(line) - used, "%s,%d\t\t", (name != nullptr) ? name : "?", ev[m].value);
+		}
+		Logger::log(Logger::INFO, "%s", line);
 	}
-	std::cout << std::endl;
 }
 
 Device::Device(const std::string& filepath)
@@ -298,19 +659,17 @@ Device::Device(const std::string& filepath)
 		close(fd);
 		return;
 	}
+	struct stat file_info;
+	if (fstat(fd, &file_info) == 0)
+		this->devnum = file_info.st_rdev;
 	if (libevdev_new_from_fd(fd, &this->dev) >= 0)
 	{
+		// Wall clock timestamps jump whenever the clock is stepped, which corrupts every latency built on them
+		this->has_monotonic_time = (libevdev_set_clock_id(this->dev, CLOCK_MONOTONIC) == 0);
+		if (!this->has_monotonic_time)
+			Logger::log(Logger::WARNING, "%s keeps wall clock event timestamps, they are moved onto the monotonic clock and its read latency is not recorded", filepath.c_str());
 		if (libevdev_has_event_type(this->dev, EV_KEY) || libevdev_has_event_type(this->dev, EV_REL) || libevdev_has_event_type(this->dev, EV_ABS))
-		{
-			if (Device::global_id_queue.size() != 0)
-				this->id = *(unsigned*)Device::global_id_queue.pop();
-			else
-				this->id = Device::device_objects.size();
-			this->input_monitor_thread = std::thread(std::bind(&Device::input_monitor_process, this));
-			Device::active_devices.fetch_add(1, std::memory_order_acq_rel);
-			Device::active_devices.notify_all();
-			return;
-		}
+			return;	// Capture starts once the device is registered
 	}
 
 	close(fd);
@@ -320,37 +679,208 @@ Device::Device(const std::string& filepath)
 
 Device::~Device()
 {
-	this->input_monitor_thread.join();
+	if (this->input_monitor_thread.joinable())
+		this->input_monitor_thread.join();
 
-	close(libevdev_get_fd(this->dev));
-	libevdev_free(this->dev);
-	this->dev = nullptr;
+	if (this->dev != nullptr)
+	{
+		close(libevdev_get_fd(this->dev));
+		libevdev_free(this->dev);
+		this->dev = nullptr;
+	}
+	close(this->exit_fd);
 }
 
-void Device::input_monitor_process()
+void* Device::queue_frame(void* p_data, Frame_Scheduler::Frame_Class frame_class)
 {
 	static constexpr uint64_t add_to_count = 1;
+
+	// A full queue holds the capture thread back, and the kernel's buffer overflow and resync take over from there
+	Frame_Pool::set_queued_time(p_data, monotonic_ns());
+	while (!Device::frame_scheduler.push(p_data, frame_class))
+	{
+		if (Device::is_exit.load(std::memory_order_acquire))
+		{
+			Frame_Pool::release(p_data);
+			return Frame_Pool::acquire();
+		}
+		Device::frame_scheduler.wait_for_room(frame_class);
+	}
+	Metrics::add(Metrics::FRAMES_CAPTURED);
+	Device::pending_events.fetch_add(1, std::memory_order_seq_cst); // Notify watchdog
+	// A watchdog that is busy draining frames picks this one up without a syscall
+	if (Device::is_watchdog_sleeping.load(std::memory_order_seq_cst) && Device::is_watchdog_sleeping.exchange(false, std::memory_order_seq_cst))
+		write(Device::poll_signal_fd, &add_to_count, sizeof(uint64_t));	// Write to polling eventfd
+	Device::pending_events.notify_one();
+
+	return Frame_Pool::acquire();
+}
+
+// Returns the next free event slot of a frame, moving the frame into a larger size class when full
+static struct input_event* next_event_slot(void*& p_data)
+{
+	uint64_t* p_event_count = (uint64_t*)p_data;
+	if (*p_event_count == Frame_Pool::capacity(p_data))
+	{
+		p_data = Frame_Pool::grow(p_data);
+		p_event_count = (uint64_t*)p_data;
+	}
+	return (struct input_event*)(p_event_count + 1) + *p_event_count;
+}
+
+bool Device::filter_event(struct input_event& ev)
+{
+	uint16_t device_code = ev.code;
+	bool is_kept = Event_Filter::apply(ev);
+	if (ev.type != EV_KEY)
+		return is_kept;
+
+	// A key held across a remap profile swap is released under the code it was forwarded under, even if now dropped
+	if (ev.value == 0 && this->held_codes[device_code] != 0)
+	{
+		ev.code = this->held_codes[device_code];
+		this->held_codes[device_code] = 0;
+		return true;
+	}
+	if (ev.value == 1 && is_kept)
+		this->held_codes[device_code] = ev.code;
+
+	return is_kept;
+}
+
+bool Device::update_key_state(const struct input_event& ev)
+{
+	bool is_forwarded = false;
+
+	// If key is released AND there was a change in the local state
+	if (ev.value == 0 && this->local_key_state.remove(ev.code))
+	{
+		Device::global_key_press_cnt.fetch_sub(1, std::memory_order_acq_rel);
+		// Only register a key release when there are no keys being pressed down
+		if (Device::global_key_state[ev.code].fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			Chord_Matcher::Trigger fired = Chord_Matcher::process_key(ev.code, 0);
+			if (fired.action != Chord_Matcher::NONE)
+				this->chord_trigger = fired;
+			is_forwarded = true;
+		}
+
+		--this->key_press_cnt;
+	}
+	// Autorepeats (value 2) are never forwarded, the receiving side repeats held keys itself
+	else if (ev.value == 1 && this->local_key_state.insert(ev.code))	// If key is pressed ONLY
+	{
+		Device::global_key_press_cnt.fetch_add(1, std::memory_order_acq_rel);
+		if (Device::global_key_state[ev.code].fetch_add(1, std::memory_order_acq_rel) == 0)
+		{
+			Chord_Matcher::process_key(ev.code, 1);
+			is_forwarded = true;
+		}
+
+		++this->key_press_cnt;
+	}
+
+	return is_forwarded;
+}
+
+void Device::resynchronize(void*& p_data)
+{
+	static constexpr unsigned KEY_WORDS = (KEY_CNT + 63) / 64;
+
+	this->drop_count.fetch_add(1, std::memory_order_relaxed);
+	Metrics::add(Metrics::FRAMES_RESYNCED);
+
+	// Drain libevdev's sync events, axis state is forwarded as-is while keys are diffed below
+	struct input_event ev;
+	while (libevdev_next_event(this->dev, LIBEVDEV_READ_FLAG_SYNC, &ev) == LIBEVDEV_READ_STATUS_SYNC)
+	{
+		if (ev.type == EV_ABS && Event_Filter::apply(ev))
+		{
+			*next_event_slot(p_data) = ev;
+			++*(uint64_t*)p_data;
+		}
+	}
+
+	if (!libevdev_has_event_type(this->dev, EV_KEY))
+		return;
+
+	uint64_t device_keys[KEY_WORDS] = { 0 };
+	if (ioctl(libevdev_get_fd(this->dev), EVIOCGKEY(sizeof(device_keys)), device_keys) < 0)
+	{
+		Logger::log(Logger::ERROR, "Failed to read key state after dropped events: %s", strerror(errno));
+		return;
+	}
+
+	// Translate the device's key state into the remapped codes local_key_state is kept in
+	uint64_t true_keys[KEY_WORDS] = { 0 };
+	memset(this->held_codes, 0, sizeof(this->held_codes));
+	for (unsigned word = 0; word < KEY_WORDS; ++word)
+	{
+		for (uint64_t bits = device_keys[word]; bits != 0; bits &= bits - 1)
+		{
+			memset(&ev, 0, sizeof(ev));
+			ev.type = EV_KEY;
+			ev.code = word * 64 + __builtin_ctzll(bits);
+			ev.value = 1;
+			if (this->filter_event(ev))
+				true_keys[ev.code / 64] |= (1ULL << (ev.code % 64));
+		}
+	}
+
+	// Only keys whose state differs produce an event
+	const std::vector<uint64_t>& local_keys = this->local_key_state.return_vector();
+	for (unsigned word = 0; word < KEY_WORDS && word < local_keys.size(); ++word)
+	{
+		for (uint64_t diff = true_keys[word] ^ local_keys[word]; diff != 0; diff &= diff - 1)
+		{
+			unsigned bit = __builtin_ctzll(diff);
+			struct input_event* p_ev = next_event_slot(p_data);
+			memset(p_ev, 0, sizeof(struct input_event));
+			p_ev->type = EV_KEY;
+			p_ev->code = word * 64 + bit;
+			p_ev->value = (true_keys[word] >> bit) & 1;
+			if (this->update_key_state(*p_ev))
+				++*(uint64_t*)p_data;
+		}
+	}
+}
+
+uint64_t Device::return_drop_count() const
+{
+	return this->drop_count.load(std::memory_order_relaxed);
+}
+
+uint64_t Device::return_frame_count() const
+{
+	return this->frame_count.load(std::memory_order_relaxed);
+}
+
+void Device::input_monitor_process()
+{
 	static constexpr enum libevdev_grab_mode grab_state[2] = { LIBEVDEV_UNGRAB, LIBEVDEV_GRAB };
 
-	unsigned key_press_cnt = 0;
-	uint8_t kill_switch = 0;
-	enum libevdev_read_flag read_flag = LIBEVDEV_READ_FLAG_NORMAL;
+	uint64_t read_ns = 0;
+	uint64_t kernel_ns = 0;
+	Thread_Policy::enter(Thread_Policy::CAPTURE);
 	/* 
-		Allocate generic memory block
+		Take a frame from the pool
 		Memory structure:
-		{ uint64_t, struct input_event[64] }
+		{ uint64_t, struct input_event[frame_capacity] }
 	*/
-	void* p_data = malloc(sizeof(uint64_t) + sizeof(struct input_event) * 64);
+	void* p_data = Frame_Pool::acquire();
+	uint64_t frame_capacity = Frame_Pool::capacity(p_data);
 	uint64_t* p_event_count = (uint64_t*)p_data;
 	struct input_event* event_queue = (struct input_event*)(p_event_count + 1);
 	*p_event_count = 0;
 
 	// Set up poll signals for grab and exit signals
-	struct pollfd pfd[2];
+	struct pollfd pfd[3];
 	pfd[0].fd = libevdev_get_fd(this->dev);
 	pfd[0].events = POLLIN;
 	pfd[1].fd = Device::event_signal_fd;
 	pfd[1].events = POLLIN;
+	pfd[2].fd = this->exit_fd;	// Signaled when this device alone is torn down
+	pfd[2].events = POLLIN;
 
 	// Records the initial EV_KEY state and updates shared global values
 	if (libevdev_has_event_type(this->dev, EV_KEY))
@@ -361,7 +891,7 @@ void Device::input_monitor_process()
 			{
 				if (libevdev_get_event_value(this->dev, EV_KEY, code) == 1)
 				{
-					++key_press_cnt;
+					++this->key_press_cnt;
 					this->local_key_state.insert(code);
 
 					Device::global_key_press_cnt.fetch_add(1);
@@ -377,75 +907,95 @@ void Device::input_monitor_process()
 	*/
 
 	// Main loop
-	while (Device::is_exit.load(std::memory_order_acquire) == false)
+	while (Device::is_exit.load(std::memory_order_acquire) == false && this->is_removed.load(std::memory_order_acquire) == false)
 	{
 		if (libevdev_has_event_pending(this->dev))
 		{
-			switch(libevdev_next_event(this->dev, read_flag, &event_queue[*p_event_count]))
+			// Move a full frame into a larger size class so the whole SYN_REPORT group is sent as one frame
+			if (*p_event_count == frame_capacity)
+			{
+				p_data = Frame_Pool::grow(p_data);
+				frame_capacity = Frame_Pool::capacity(p_data);
+				p_event_count = (uint64_t*)p_data;
+				event_queue = (struct input_event*)(p_event_count + 1);
+			}
+
+			switch(libevdev_next_event(this->dev, LIBEVDEV_READ_FLAG_NORMAL, &event_queue[*p_event_count]))
 			{
 				case -EAGAIN:	// No inputs are available
-					read_flag = LIBEVDEV_READ_FLAG_NORMAL;
 					break;
 
-				case LIBEVDEV_READ_STATUS_SYNC:
-					read_flag = LIBEVDEV_READ_FLAG_SYNC;
-					while (event_queue[*p_event_count].code == EV_SYN && event_queue[*p_event_count].value == SYN_DROPPED)
-						libevdev_next_event(this->dev, read_flag, &event_queue[*p_event_count]);
+				case LIBEVDEV_READ_STATUS_SYNC:	// Kernel buffer overflowed (SYN_DROPPED)
+					// The partial frame is kept and completed with the corrections into a single frame
+					this->resynchronize(p_data);
+					read_ns = monotonic_ns();
+					Frame_Pool::set_read_time(p_data, read_ns);
+					p_event_count = (uint64_t*)p_data;
+					if (!this->has_monotonic_time)
+						move_to_monotonic((struct input_event*)(p_event_count + 1), *p_event_count, read_ns);
+					if (*p_event_count && this->device_is_grabbed)
+					{
+						TRACEPOINT(frame_captured, this->devnum, p_data, *p_event_count, 0, read_ns);	// Corrections carry no kernel time
+						Flight_Recorder::record_frame(Flight_Recorder::CAPTURE, p_data, read_ns);
+						this->frame_count.store(this->frame_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+						Frame_Pool::set_trigger(p_data, this->chord_trigger);	// Dispatched by the watchdog after the frame
+						this->chord_trigger = Chord_Matcher::Trigger();
+						p_data = Device::queue_frame(p_data, Frame_Scheduler::CONTROL_FRAME);
+					}
+					frame_capacity = Frame_Pool::capacity(p_data);
+					p_event_count = (uint64_t*)p_data;
+					event_queue = (struct input_event*)(p_event_count + 1);
+					*p_event_count = 0;
+
+					// A chord whose frame was not queued has nothing to wait for
+					if (this->chord_trigger.action != Chord_Matcher::NONE)
+					{
+						Chord_Matcher::dispatch(this->chord_trigger);
+						this->chord_trigger = Chord_Matcher::Trigger();
+					}
+					break;
+
 				case LIBEVDEV_READ_STATUS_SUCCESS:
+					if (this->filter_event(event_queue[*p_event_count]) == false)	// Remapped in place or dropped
+						break;
+
 					switch(event_queue[*p_event_count].type)	// Handle events
 					{
 						case EV_SYN:
 							if (*p_event_count && event_queue[*p_event_count].value == SYN_REPORT && this->device_is_grabbed)
 							{
-								Device::global_queue.push(p_data);
-								write(Device::poll_signal_fd, &add_to_count, sizeof(uint64_t));	// Write to polling eventfd
-								Device::pending_events.fetch_add(1, std::memory_order_acq_rel); // Notify watchdog
-								Device::pending_events.notify_one();
-								
-								(Device::global_mem_bank.size())
-									? p_data = Device::global_mem_bank.pop()	// Use available buffer
-									: p_data = malloc(sizeof(uint64_t) + sizeof(struct input_event) * 64);	// Create new buffer
-								
+								// Kernel event timestamp to userspace read, mostly scheduling delay of this thread
+								read_ns = monotonic_ns();
+								Frame_Pool::set_read_time(p_data, read_ns);
+								if (!this->has_monotonic_time)
+									move_to_monotonic(event_queue, *p_event_count + 1, read_ns);	// Includes the SYN_REPORT
+								kernel_ns = (uint64_t)event_queue[*p_event_count].input_event_sec * 1000000000 + (uint64_t)event_queue[*p_event_count].input_event_usec * 1000;
+								if (this->has_monotonic_time && read_ns >= kernel_ns)
+									Device::read_latency.record(read_ns - kernel_ns);
+								this->frame_count.store(this->frame_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+								TRACEPOINT(frame_captured, this->devnum, p_data, *p_event_count, kernel_ns, read_ns);
+								Flight_Recorder::record_frame(Flight_Recorder::CAPTURE, p_data, read_ns);
+								// Chord actions run once the watchdog has sent the frame holding the chord's last release
+								Frame_Pool::set_trigger(p_data, this->chord_trigger);
+								this->chord_trigger = Chord_Matcher::Trigger();
+								p_data = Device::queue_frame(p_data, Frame_Scheduler::classify(p_data));
+								frame_capacity = Frame_Pool::capacity(p_data);
 								p_event_count = (uint64_t*)p_data;
 								event_queue = (struct input_event*)(p_event_count + 1);
-
-								if (kill_switch == 2)
-								{
-									Device::trigger_activation();
-									std::cout << "--UNGRABBED--" << std::endl;
-									kill_switch = 0;
-								}
 							}
 							*p_event_count = 0;	// Set event counter to zero regardless
-							break;
 
-						case EV_KEY:
-							if (this->device_is_grabbed == true && event_queue[*p_event_count].code == KEY_POWER)
+							// A chord whose frame was not queued has nothing to wait for
+							if (this->chord_trigger.action != Chord_Matcher::NONE)
 							{
-								if (kill_switch == 0 && event_queue[*p_event_count].value == 1)
-									++kill_switch;
-								else if (kill_switch == 1 && event_queue[*p_event_count].value == 0)
-									++kill_switch;
+								Chord_Matcher::dispatch(this->chord_trigger);
+								this->chord_trigger = Chord_Matcher::Trigger();
 							}
+							break;
 
-							// If key is released AND there was a change in the local state
-							if (event_queue[*p_event_count].value == 0 && this->local_key_state.remove(event_queue[*p_event_count].code))
-							{
-								Device::global_key_press_cnt.fetch_sub(1, std::memory_order_acq_rel);
-								// Only register a key release when there are no keys being pressed down
-								if (Device::global_key_state[event_queue[*p_event_count].code].fetch_sub(1, std::memory_order_acq_rel) == 1)
-									++*p_event_count;
-
-								--key_press_cnt;
-							}
-							else if (event_queue[*p_event_count].value == 1 && this->local_key_state.insert(event_queue[*p_event_count].code))	// If key is pressed ONLY
-							{
-								Device::global_key_press_cnt.fetch_add(1, std::memory_order_acq_rel);
-								if (Device::global_key_state[event_queue[*p_event_count].code].fetch_add(1, std::memory_order_acq_rel) == 0)
-									++*p_event_count;
-								
-								++key_press_cnt;
-							}
+						case EV_KEY:
+							if (this->update_key_state(event_queue[*p_event_count]))
+								++*p_event_count;
 							break;
 
 						case EV_REL:
@@ -453,8 +1003,9 @@ void Device::input_monitor_process()
 								++*p_event_count;
 							break;
 
-						case EV_ABS:
-							// ++*p_event_count;
+						case EV_ABS:	// Includes the ABS_MT_* slot protocol, forwarded as-is
+							++*p_event_count;
+							break;
 
 						default:
 							break;
@@ -462,46 +1013,52 @@ void Device::input_monitor_process()
 					break;
 
 				default:
-					Device::global_id_queue.push(&this->id);
-					if (*p_event_count != 0)
-						for (std::size_t n = 0; n < *p_event_count; ++n)
-							if (event_queue[n].code == EV_KEY && event_queue[n].value != 0)
-							{
-								Device::global_key_state[event_queue[n].code].fetch_sub(1, std::memory_order_acq_rel);
-								Device::global_key_press_cnt.fetch_sub(1, std::memory_order_acq_rel);
-								this->local_key_state.remove(event_queue[n].code);
-							}
-					if (this->local_key_state != BitField::zero())
-						for (unsigned code = 0; code < KEY_CNT; ++code)
-							if (this->local_key_state.remove(code))
-							{
-								Device::global_key_state[code].fetch_sub(1, std::memory_order_acq_rel);
-								Device::global_key_press_cnt.fetch_sub(1, std::memory_order_acq_rel);
-							}
 					goto CLEAN_UP_THREAD;	// Break out of loop to deactivate device
 			}
 		}
-		else if ((Device::is_grabbed.load(std::memory_order_acquire) != this->device_is_grabbed) && key_press_cnt == 0)	// Toggling local grab state (only grabs if no inputs are being received)
+		else if ((Device::is_grabbed.load(std::memory_order_acquire) != this->device_is_grabbed) && this->key_press_cnt == 0)	// Toggling local grab state (only grabs if no inputs are being received)
 		{
 			this->device_is_grabbed = !this->device_is_grabbed;
 			libevdev_grab(this->dev, grab_state[this->device_is_grabbed]);
 			uint64_t msg = 0;
 			read(pfd[1].fd, &msg, sizeof(uint64_t));
 		}
-		else if (poll(pfd, 2, -1) < 0)	// Handle polling error
+		else if (poll(pfd, 3, -1) < 0)	// Handle polling error
 		{
-			std::cerr << "Input polling failed: " << strerror(errno) << std::endl;
+			Logger::log(Logger::ERROR, "Input polling failed: %s", strerror(errno));
 			break;
 		}
 	}
 
 	CLEAN_UP_THREAD:
-	free(p_data);
+	// Release every key still held on this device, so nothing stays pressed on the target
+	*p_event_count = 0;
+	for (unsigned code = 0; code < KEY_CNT; ++code)
+	{
+		if (this->local_key_state.contains(code))
+		{
+			struct input_event* p_ev = next_event_slot(p_data);
+			memset(p_ev, 0, sizeof(struct input_event));
+			p_ev->type = EV_KEY;
+			p_ev->code = code;
+			p_ev->value = 0;
+			if (this->update_key_state(*p_ev))
+				++*(uint64_t*)p_data;
+		}
+	}
+	if (*(uint64_t*)p_data && this->device_is_grabbed && Device::is_exit.load(std::memory_order_acquire) == false)
+	{
+		Frame_Pool::set_read_time(p_data, monotonic_ns());	// The releases are made up here, there is no kernel time to stamp
+		p_data = Device::queue_frame(p_data, Frame_Scheduler::CONTROL_FRAME);
+	}
+	Frame_Pool::release(p_data);
 	if (this->device_is_grabbed)
 	{
 		libevdev_grab(this->dev, LIBEVDEV_UNGRAB);
 		this->device_is_grabbed = false;
 	}
+	Thread_Policy::leave(Thread_Policy::CAPTURE);
+	this->is_active.store(false, std::memory_order_release);
 	Device::active_devices.fetch_sub(1, std::memory_order_acq_rel);
 	Device::active_devices.notify_one();
 }
@@ -532,30 +1089,122 @@ BitField Device::return_enabled_local_rel_states() const
 	return enabled_codes;
 }
 
-BitField Device::return_enabled_global_key_states()
+BitField Device::return_enabled_local_properties() const
 {
-	BitField enabled_codes(KEY_CNT);
-	for (unsigned n = 0; n < Device::device_objects.size(); ++n)
+	BitField enabled_props(INPUT_PROP_CNT);
+	for (unsigned prop = 0; prop < INPUT_PROP_CNT; ++prop)
+	{
+		if (libevdev_has_property(this->dev, prop))
+		{
+			enabled_props.insert(prop);
+		}
+	}
+	return enabled_props;
+}
+
+std::vector<struct abs_axis_info> Device::return_enabled_local_abs_info() const
+{
+	std::vector<struct abs_axis_info> axes;
+	for (unsigned code = 0; code < ABS_CNT; ++code)
 	{
-		if (Device::device_objects[n]->dev != nullptr)
+		if (libevdev_has_event_code(this->dev, EV_ABS, code))
 		{
-			enabled_codes |= Device::device_objects[n]->return_enabled_local_key_states();
+			axes.push_back({ code, *libevdev_get_abs_info(this->dev, code) });
 		}
 	}
+	return axes;
+}
+
+BitField Device::return_enabled_global_key_states()
+{
+	BitField enabled_codes(KEY_CNT);
+	Device::for_each_device([&](const Device* p_device)
+	{
+		enabled_codes |= p_device->return_enabled_local_key_states();
+	});
 	return enabled_codes;
 }
 
 BitField Device::return_enabled_global_rel_states()
 {
 	BitField enabled_codes(REL_CNT);
-	for (unsigned n = 0; n < Device::device_objects.size(); ++n)
+	Device::for_each_device([&](const Device* p_device)
 	{
-		if (Device::device_objects[n]->dev != nullptr)
+		enabled_codes |= p_device->return_enabled_local_rel_states();
+	});
+	return enabled_codes;
+}
+
+BitField Device::return_pressed_global_key_states()
+{
+	BitField pressed_codes(KEY_CNT);
+	for (unsigned code = 0; code < KEY_CNT; ++code)
+	{
+		if (Device::global_key_state[code].load(std::memory_order_acquire) > 0)
 		{
-			enabled_codes |= Device::device_objects[n]->return_enabled_local_rel_states();
+			pressed_codes.insert(code);
 		}
 	}
-	return enabled_codes;
+	return pressed_codes;
+}
+
+BitField Device::return_enabled_global_properties()
+{
+	BitField enabled_props(INPUT_PROP_CNT);
+	Device::for_each_device([&](const Device* p_device)
+	{
+		enabled_props |= p_device->return_enabled_local_properties();
+	});
+	return enabled_props;
+}
+
+std::vector<struct abs_axis_info> Device::return_enabled_global_abs_info()
+{
+	// All devices share one virtual device, so the first device to report an axis defines its range
+	BitField seen_codes(ABS_CNT);
+	std::vector<struct abs_axis_info> axes;
+	Device::for_each_device([&](const Device* p_device)
+	{
+		for (const struct abs_axis_info& axis : p_device->return_enabled_local_abs_info())
+		{
+			if (seen_codes.insert(axis.code))
+				axes.push_back(axis);
+		}
+	});
+	return axes;
+}
+
+bool Device::return_global_repeat_settings(int& delay, int& period)
+{
+	// The first keyboard that autorepeats sets the rate for the virtual device
+	bool has_repeat = false;
+	Device::for_each_device([&](const Device* p_device)
+	{
+		if (!has_repeat && libevdev_get_repeat(p_device->dev, &delay, &period) == 0)
+			has_repeat = true;
+	});
+	return has_repeat;
+}
+
+std::vector<device_stats> Device::return_device_stats()
+{
+	std::vector<device_stats> stats;
+	Device::for_each_device([&](const Device* p_device)
+	{
+		const char* name = (p_device->dev != nullptr) ? libevdev_get_name(p_device->dev) : nullptr;
+		stats.push_back({ (name != nullptr) ? name : "", p_device->devnum, p_device->return_frame_count(), p_device->return_drop_count() });
+	});
+	return stats;
+}
+
+std::size_t Device::return_queue_depth()
+{
+	return Device::frame_scheduler.size();
+}
+
+std::string Device::return_latency_report()
+{
+	return Device::read_latency.report("Capture read latency") + Device::queue_latency.report("Watchdog queue latency");
 }
 
 void Device::wait_for_exit()
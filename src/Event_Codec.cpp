@@ -0,0 +1,181 @@
+#include "Event_Codec.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+static inline uint8_t* write_varint(uint8_t* p_buffer, uint64_t value)
+{
+	while (value >= 0x80)
+	{
+		*p_buffer++ = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	*p_buffer++ = (uint8_t)value;
+	return p_buffer;
+}
+
+static inline bool read_varint(const uint8_t*& p_buffer, const uint8_t* p_end, uint64_t& value)
+{
+	value = 0;
+	for (unsigned shift = 0; p_buffer < p_end && shift < 64; shift += 7)
+	{
+		uint8_t byte = *p_buffer++;
+		value |= (uint64_t)(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0)
+			return true;
+	}
+	return false;	// Truncated or oversized varint
+}
+
+static inline uint64_t zigzag_encode(int64_t value)
+{
+	return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t zigzag_decode(uint64_t value)
+{
+	return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+int32_t* Event_Codec::return_abs_base(uint16_t code)
+{
+	if (code >= ABS_MT_TOUCH_MAJOR && code <= ABS_MT_TOOL_Y)
+	{
+		// Multitouch axes are tracked per slot; slots beyond MAX_SLOTS are sent as absolute values
+		int32_t slot = this->abs_value[ABS_MT_SLOT];
+		return (slot >= 0 && slot < (int32_t)MAX_SLOTS)
+			? &this->mt_value[slot][code - ABS_MT_TOUCH_MAJOR]
+			: nullptr;
+	}
+	return (code < ABS_CNT) ? &this->abs_value[code] : nullptr;
+}
+
+void Event_Codec::reset()
+{
+	memset(this->abs_value, 0, sizeof(this->abs_value));
+	memset(this->mt_value, 0, sizeof(this->mt_value));
+}
+
+int Event_Codec::return_frame_kind(const uint8_t* buffer, uint64_t buffer_size)
+{
+	return (buffer_size == 0) ? -1 : buffer[0];
+}
+
+// A capture_ns of zero sends the frame without a timestamp
+uint64_t Event_Codec::encode(const struct input_event* ev_list, uint64_t list_size, uint8_t* buffer, uint64_t capture_ns)
+{
+	uint8_t* p_buffer = buffer;
+	if (capture_ns != 0)
+	{
+		*p_buffer++ = FRAME_TIMED_EVENTS;
+		p_buffer = write_varint(p_buffer, capture_ns);
+	}
+	else
+		*p_buffer++ = FRAME_EVENTS;
+
+	for (uint64_t n = 0; n < list_size; ++n)
+	{
+		int64_t value = ev_list[n].value;
+		if (ev_list[n].type == EV_ABS)
+		{
+			int32_t* p_base = this->return_abs_base(ev_list[n].code);
+			if (p_base != nullptr)
+			{
+				value -= *p_base;
+				*p_base = ev_list[n].value;
+			}
+		}
+
+		p_buffer = write_varint(p_buffer, ev_list[n].type);
+		p_buffer = write_varint(p_buffer, ev_list[n].code);
+		p_buffer = write_varint(p_buffer, zigzag_encode(value));
+	}
+
+	return p_buffer - buffer;
+}
+
+bool Event_Codec::decode(const uint8_t* buffer, uint64_t buffer_size, std::vector<struct input_event>& ev_list, uint64_t* p_capture_ns)
+{
+	const uint8_t* p_buffer = buffer;
+	const uint8_t* p_end = buffer + buffer_size;
+
+	ev_list.clear();
+	if (buffer_size == 0)
+		return false;
+
+	uint64_t capture_ns = 0;
+	uint8_t frame_kind = *p_buffer++;
+	if (frame_kind == FRAME_TIMED_EVENTS)
+	{
+		if (!read_varint(p_buffer, p_end, capture_ns))
+			return false;
+	}
+	else if (frame_kind != FRAME_EVENTS)
+		return false;
+	if (p_capture_ns != nullptr)
+		*p_capture_ns = capture_ns;
+
+	while (p_buffer < p_end)
+	{
+		uint64_t type = 0;
+		uint64_t code = 0;
+		uint64_t value = 0;
+		if (!read_varint(p_buffer, p_end, type) || !read_varint(p_buffer, p_end, code) || !read_varint(p_buffer, p_end, value))
+			return false;
+		if (type >= EV_CNT || code > 0xFFFF)
+			return false;
+
+		struct input_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.type = type;
+		ev.code = code;
+		ev.value = (int32_t)zigzag_decode(value);
+
+		if (ev.type == EV_ABS)
+		{
+			int32_t* p_base = this->return_abs_base(ev.code);
+			if (p_base != nullptr)
+			{
+				ev.value = (int32_t)(*p_base + zigzag_decode(value));
+				*p_base = ev.value;
+			}
+		}
+		ev_list.push_back(ev);
+	}
+
+	return true;
+}
+
+uint64_t Event_Codec::encode_ping(uint64_t send_ns, uint8_t* buffer)
+{
+	uint8_t* p_buffer = buffer;
+	*p_buffer++ = FRAME_PING;
+	p_buffer = write_varint(p_buffer, send_ns);
+	return p_buffer - buffer;
+}
+
+bool Event_Codec::decode_ping(const uint8_t* buffer, uint64_t buffer_size, uint64_t& send_ns)
+{
+	const uint8_t* p_buffer = buffer + 1;
+	return buffer_size != 0 && buffer[0] == FRAME_PING && read_varint(p_buffer, buffer + buffer_size, send_ns);
+}
+
+uint64_t Event_Codec::encode_clock(int64_t offset_ns, uint64_t rtt_ns, uint8_t* buffer)
+{
+	uint8_t* p_buffer = buffer;
+	*p_buffer++ = FRAME_CLOCK;
+	p_buffer = write_varint(p_buffer, zigzag_encode(offset_ns));
+	p_buffer = write_varint(p_buffer, rtt_ns);
+	return p_buffer - buffer;
+}
+
+bool Event_Codec::decode_clock(const uint8_t* buffer, uint64_t buffer_size, int64_t& offset_ns, uint64_t& rtt_ns)
+{
+	const uint8_t* p_buffer = buffer + 1;
+	const uint8_t* p_end = buffer + buffer_size;
+	uint64_t encoded_offset = 0;
+	if (buffer_size == 0 || buffer[0] != FRAME_CLOCK || !read_varint(p_buffer, p_end, encoded_offset) || !read_varint(p_buffer, p_end, rtt_ns))
+		return false;
+	offset_ns = zigzag_decode(encoded_offset);
+	return true;
+}
@@ -0,0 +1,181 @@
+#include "Event_Filter.hpp"
+#include "Logger.hpp"
+
+#include <atomic>
+#include <cstdint>
+
+#include "libevdev/libevdev.h"
+
+void Event_Filter::lock_profiles()
+{
+	bool prev_state = false;
+	while (!Event_Filter::in_progress.compare_exchange_strong(prev_state, true, std::memory_order_acq_rel))
+	{
+		Event_Filter::in_progress.wait(true, std::memory_order_acquire);
+		prev_state = false;
+	}
+}
+
+void Event_Filter::unlock_profiles()
+{
+	Event_Filter::in_progress.store(false, std::memory_order_release);
+	Event_Filter::in_progress.notify_all();
+}
+
+const Event_Filter::filter_profile* Event_Filter::compile(const std::string& profile_name)
+{
+	filter_profile* p_profile = new filter_profile;
+	for (unsigned code = 0; code < KEY_CNT; ++code)
+		p_profile->key_map[code] = code;
+	for (unsigned code = 0; code < REL_CNT; ++code)
+		p_profile->rel_map[code] = code;
+	for (unsigned code = 0; code < ABS_CNT; ++code)
+		p_profile->abs_map[code] = code;
+
+	auto profile = Event_Filter::profiles.find(profile_name);
+	if (profile != Event_Filter::profiles.end())
+	{
+		for (const remap_rule& rule : profile->second)
+		{
+			switch (rule.type)
+			{
+				case EV_KEY:
+					p_profile->key_map[rule.code] = rule.new_code;
+					break;
+				case EV_REL:
+					p_profile->rel_map[rule.code] = rule.new_code;
+					break;
+				case EV_ABS:
+					p_profile->abs_map[rule.code] = rule.new_code;
+					break;
+			}
+		}
+	}
+
+	return p_profile;
+}
+
+const Event_Filter::filter_profile* Event_Filter::find_compiled(const std::string& profile_name)
+{
+	auto compiled = Event_Filter::compiled_profiles.find(profile_name);
+	if (compiled != Event_Filter::compiled_profiles.end())
+		return compiled->second;
+
+	const filter_profile* p_profile = Event_Filter::compile(profile_name);
+	Event_Filter::compiled_profiles[profile_name] = p_profile;
+	return p_profile;
+}
+
+// Drops the compiled tables of a profile whose rules changed, rebuilding them if the profile is in use
+void Event_Filter::invalidate(const std::string& profile_name)
+{
+	auto compiled = Event_Filter::compiled_profiles.find(profile_name);
+	if (compiled == Event_Filter::compiled_profiles.end())
+		return;
+	const filter_profile* p_old = compiled->second;
+	Event_Filter::compiled_profiles.erase(compiled);
+
+	// Readers pick up the new tables on their next event; nothing on the hot path waits
+	if (Event_Filter::active_profile_name == profile_name)
+		Event_Filter::active_profile.exchange(Event_Filter::find_compiled(profile_name));
+	Event_Filter::active_profile.retire(p_old);	// May have been active a moment ago, so never deleted directly
+}
+
+bool Event_Filter::add_rule(const std::string& profile_name, const std::string& rule)
+{
+	// Rules are written as "KEY_CAPSLOCK=KEY_LEFTCTRL", or "KEY_F13=" to drop the code
+	static constexpr unsigned TYPES[] = { EV_KEY, EV_REL, EV_ABS };
+
+	std::size_t separator = rule.find('=');
+	if (separator == std::string::npos)
+	{
+		Logger::log(Logger::ERROR, "Remap rule is missing '=': %s", rule.c_str());
+		return false;
+	}
+	std::string from_name = rule.substr(0, separator);
+	std::string to_name = rule.substr(separator + 1);
+
+	for (unsigned type : TYPES)
+	{
+		int code = libevdev_event_code_from_name(type, from_name.c_str());
+		if (code < 0)
+			continue;
+
+		int new_code = (to_name.size() == 0) ? DROP : libevdev_event_code_from_name(type, to_name.c_str());
+		if (new_code < 0)
+		{
+			Logger::log(Logger::ERROR, "Cannot remap %s to %s", from_name.c_str(), to_name.c_str());
+			return false;
+		}
+
+		Event_Filter::lock_profiles();
+		Event_Filter::profiles[profile_name].push_back({ (uint16_t)type, (uint16_t)code, (uint16_t)new_code });
+		Event_Filter::invalidate(profile_name);
+		Event_Filter::unlock_profiles();
+		return true;
+	}
+
+	Logger::log(Logger::ERROR, "Unknown event code in remap rule: %s", from_name.c_str());
+	return false;
+}
+
+void Event_Filter::clear_profile(const std::string& profile_name)
+{
+	Event_Filter::lock_profiles();
+	Event_Filter::profiles.erase(profile_name);
+	Event_Filter::invalidate(profile_name);
+	Event_Filter::unlock_profiles();
+}
+
+bool Event_Filter::use_profile(const std::string& profile_name)
+{
+	Event_Filter::lock_profiles();
+	bool exists = (profile_name.size() == 0) || Event_Filter::profiles.contains(profile_name);
+	// Compiled tables stay cached, so switching back and forth never rebuilds or frees them
+	if (profile_name.size() == 0)	// No profile forwards every event untouched
+	{
+		Event_Filter::active_profile.exchange(nullptr);
+		Event_Filter::active_profile_name.clear();
+	}
+	else if (exists && Event_Filter::active_profile_name != profile_name)
+	{
+		Event_Filter::active_profile.exchange(Event_Filter::find_compiled(profile_name));
+		Event_Filter::active_profile_name = profile_name;
+	}
+	Event_Filter::unlock_profiles();
+
+	return exists;
+}
+
+std::string Event_Filter::return_active_profile()
+{
+	Event_Filter::lock_profiles();
+	std::string profile_name = Event_Filter::active_profile_name;
+	Event_Filter::unlock_profiles();
+
+	return profile_name;
+}
+
+BitField Event_Filter::return_remapped_codes(unsigned type)
+{
+	// Codes that only exist as remap targets still have to be enabled on the receiving side
+	BitField codes;
+
+	Event_Filter::lock_profiles();
+	for (const auto& [profile_name, rules] : Event_Filter::profiles)
+	{
+		for (const remap_rule& rule : rules)
+		{
+			if (rule.type == type && rule.new_code != DROP)
+				codes.insert(rule.new_code);
+		}
+	}
+	Event_Filter::unlock_profiles();
+
+	return codes;
+}
+
+void Event_Filter::reclaim()
+{
+	Event_Filter::active_profile.reclaim();
+}
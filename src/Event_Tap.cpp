@@ -0,0 +1,185 @@
+#include "Event_Tap.hpp"
+#include "Logger.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+void Event_Tap::lock_readers()
+{
+	bool prev_state = false;
+	while (!Event_Tap::in_progress.compare_exchange_strong(prev_state, true, std::memory_order_acq_rel))
+	{
+		Event_Tap::in_progress.wait(true, std::memory_order_acquire);
+		prev_state = false;
+	}
+}
+
+void Event_Tap::unlock_readers()
+{
+	Event_Tap::in_progress.store(false, std::memory_order_release);
+	Event_Tap::in_progress.notify_all();
+}
+
+bool Event_Tap::create_region()
+{
+	int fd = memfd_create("unikey-tap", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0 || ftruncate(fd, REGION_SIZE) < 0)
+	{
+		Logger::log(Logger::ERROR, "Failed to create event tap: %s", strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return false;
+	}
+	// Readers map the region writable for their waiting flags, sealing keeps them from resizing it under us
+	fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+
+	void* p_region = mmap(nullptr, REGION_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p_region == MAP_FAILED)
+	{
+		Logger::log(Logger::ERROR, "Failed to map event tap: %s", strerror(errno));
+		close(fd);
+		return false;
+	}
+
+	// A fresh memfd reads as zeros, which is the empty state of every slot and reader
+	Event_Tap::p_header = (tap_header*)p_region;
+	Event_Tap::p_slots = (tap_slot*)(Event_Tap::p_header + 1);
+	Event_Tap::p_header->magic = TAP_MAGIC;
+	Event_Tap::p_header->version = TAP_VERSION;
+	Event_Tap::p_header->slot_count = TAP_SLOT_COUNT;
+	Event_Tap::p_header->slot_events = TAP_SLOT_EVENTS;
+	Event_Tap::memfd = fd;
+	return true;
+}
+
+bool Event_Tap::open_reader(int& region_fd, int& event_fd, unsigned& reader_index, const std::string& owner)
+{
+	Event_Tap::lock_readers();
+
+	if (Event_Tap::p_header == nullptr && !Event_Tap::create_region())
+	{
+		Event_Tap::unlock_readers();
+		return false;
+	}
+
+	for (unsigned n = 0; n < TAP_MAX_READERS; ++n)
+	{
+		if (Event_Tap::reader_fds[n] < 0)
+		{
+			Event_Tap::reader_fds[n] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+			if (Event_Tap::reader_fds[n] < 0)
+				break;
+
+			Event_Tap::p_header->readers[n].waiting.store(0, std::memory_order_relaxed);
+			Event_Tap::p_header->readers[n].in_use.store(1, std::memory_order_release);
+			Event_Tap::reader_count.fetch_add(1, std::memory_order_acq_rel);
+			Event_Tap::reader_owners[n] = owner;
+
+			region_fd = Event_Tap::memfd;
+			event_fd = Event_Tap::reader_fds[n];
+			reader_index = n;
+			Event_Tap::unlock_readers();
+			return true;
+		}
+	}
+
+	Event_Tap::unlock_readers();
+	return false;
+}
+
+bool Event_Tap::close_reader(unsigned reader_index, const std::string& owner)
+{
+	if (reader_index >= TAP_MAX_READERS)
+		return false;
+
+	Event_Tap::lock_readers();
+
+	bool is_open = Event_Tap::reader_fds[reader_index] >= 0 && Event_Tap::reader_owners[reader_index] == owner;
+	if (is_open)
+	{
+		Event_Tap::reader_owners[reader_index].clear();
+		Event_Tap::p_header->readers[reader_index].in_use.store(0, std::memory_order_release);
+		Event_Tap::reader_count.fetch_sub(1, std::memory_order_acq_rel);
+		close(Event_Tap::reader_fds[reader_index]);
+		Event_Tap::reader_fds[reader_index] = -1;
+	}
+
+	Event_Tap::unlock_readers();
+	return is_open;
+}
+
+void Event_Tap::publish(const void* data)
+{
+	// Nothing to do, and nothing touched, while nobody is tapping the stream
+	if (Event_Tap::reader_count.load(std::memory_order_acquire) == 0)
+		return;
+
+	const uint64_t* p_event_count = (const uint64_t*)data;
+	const struct input_event* event_queue = (const struct input_event*)(p_event_count + 1);
+
+	uint64_t index = Event_Tap::p_header->write_index.load(std::memory_order_relaxed);
+	tap_slot& slot = Event_Tap::p_slots[index % TAP_SLOT_COUNT];
+
+	slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	slot.event_count = *p_event_count;
+	memcpy(slot.events, event_queue, sizeof(struct input_event) * ((*p_event_count < TAP_SLOT_EVENTS) ? *p_event_count : TAP_SLOT_EVENTS));
+	slot.sequence.store(2 * (index + 1), std::memory_order_release);
+	Event_Tap::p_header->write_index.store(index + 1, std::memory_order_seq_cst);
+
+	Event_Tap::wake_readers();
+}
+
+void Event_Tap::wake_readers()
+{
+	static constexpr uint64_t message = 1;
+
+	// Readers that are busy draining never cost a syscall, or the lock
+	for (unsigned n = 0; n < TAP_MAX_READERS; ++n)
+	{
+		tap_reader& reader = Event_Tap::p_header->readers[n];
+		if (reader.waiting.load(std::memory_order_seq_cst) && reader.waiting.exchange(0, std::memory_order_seq_cst))
+		{
+			// Held across the write so close_reader cannot free the fd number for reuse in between
+			Event_Tap::lock_readers();
+			if (Event_Tap::reader_fds[n] >= 0)
+				write(Event_Tap::reader_fds[n], &message, sizeof(uint64_t));
+			Event_Tap::unlock_readers();
+		}
+	}
+}
+
+void Event_Tap::destroy()
+{
+	Event_Tap::lock_readers();
+
+	for (unsigned n = 0; n < TAP_MAX_READERS; ++n)
+	{
+		if (Event_Tap::reader_fds[n] >= 0)
+		{
+			close(Event_Tap::reader_fds[n]);
+			Event_Tap::reader_fds[n] = -1;
+		}
+		Event_Tap::reader_owners[n].clear();
+	}
+	Event_Tap::reader_count.store(0, std::memory_order_release);
+
+	if (Event_Tap::p_header != nullptr)
+	{
+		munmap(Event_Tap::p_header, REGION_SIZE);
+		close(Event_Tap::memfd);
+		Event_Tap::p_header = nullptr;
+		Event_Tap::p_slots = nullptr;
+		Event_Tap::memfd = -1;
+	}
+
+	Event_Tap::unlock_readers();
+}
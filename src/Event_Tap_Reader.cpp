@@ -0,0 +1,167 @@
+#include "Event_Tap_Reader.hpp"
+
+#include <sdbus-c++/sdbus-c++.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static constexpr std::size_t REGION_SIZE = sizeof(tap_header) + sizeof(tap_slot) * TAP_SLOT_COUNT;
+
+Event_Tap_Reader::Event_Tap_Reader(int region_fd, int event_fd, unsigned reader_index)
+	: region_fd(region_fd), event_fd(event_fd), reader_index(reader_index)
+{
+	void* p_region = mmap(nullptr, REGION_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, region_fd, 0);
+	if (p_region == MAP_FAILED)
+		return;
+
+	tap_header* p_header = (tap_header*)p_region;
+	if (p_header->magic != TAP_MAGIC || p_header->version != TAP_VERSION
+		|| p_header->slot_count != TAP_SLOT_COUNT || p_header->slot_events != TAP_SLOT_EVENTS)
+	{
+		munmap(p_region, REGION_SIZE);
+		return;
+	}
+
+	this->p_header = p_header;
+	this->p_slots = (const tap_slot*)(p_header + 1);
+	this->read_index = p_header->write_index.load(std::memory_order_acquire);	// Only frames published from now on
+}
+
+Event_Tap_Reader::~Event_Tap_Reader()
+{
+	if (this->p_proxy != nullptr)
+	{
+		try
+		{
+			this->p_proxy->callMethod("CloseEventTap")
+				.onInterface("io.unikey.Device.Methods")
+					.withArguments((uint32_t)this->reader_index);
+		}
+		catch (const sdbus::Error&) { }
+	}
+
+	if (this->p_header != nullptr)
+		munmap(this->p_header, REGION_SIZE);
+	if (this->region_fd >= 0)
+		close(this->region_fd);
+	if (this->event_fd >= 0)
+		close(this->event_fd);
+}
+
+Event_Tap_Reader* Event_Tap_Reader::connect()
+{
+	try
+	{
+		auto proxy = sdbus::createProxy("io.unikey", "/io/unikey/Device");
+		sdbus::UnixFd region_fd;
+		sdbus::UnixFd event_fd;
+		uint32_t reader_index = TAP_MAX_READERS;
+		proxy->callMethod("OpenEventTap")
+			.onInterface("io.unikey.Device.Methods")
+				.storeResultsTo(region_fd, event_fd, reader_index);
+
+		// The UnixFd copies close their descriptors on scope exit
+		Event_Tap_Reader* p_reader = new Event_Tap_Reader(dup(region_fd.get()), dup(event_fd.get()), reader_index);
+		if (!p_reader->is_valid())
+		{
+			delete p_reader;
+			return nullptr;
+		}
+		p_reader->p_proxy = std::move(proxy);
+		return p_reader;
+	}
+	catch (const sdbus::Error&)
+	{
+		return nullptr;
+	}
+}
+
+bool Event_Tap_Reader::is_valid() const
+{
+	return this->p_header != nullptr && this->event_fd >= 0 && this->reader_index < TAP_MAX_READERS;
+}
+
+unsigned Event_Tap_Reader::return_reader_index() const
+{
+	return this->reader_index;
+}
+
+int Event_Tap_Reader::return_event_fd() const
+{
+	return this->event_fd;
+}
+
+// Non-blocking; returns false when there is no new frame
+bool Event_Tap_Reader::read_frame(std::vector<struct input_event>& ev_list, uint64_t& lost_frames)
+{
+	lost_frames = 0;
+	if (this->p_header == nullptr)
+		return false;
+
+	while (true)
+	{
+		uint64_t write_index = this->p_header->write_index.load(std::memory_order_acquire);
+		if (this->read_index == write_index)
+			return false;
+
+		if (write_index - this->read_index > TAP_SLOT_COUNT)
+		{
+			lost_frames += write_index - TAP_SLOT_COUNT - this->read_index;
+			this->read_index = write_index - TAP_SLOT_COUNT;
+		}
+
+		const tap_slot& slot = this->p_slots[this->read_index % TAP_SLOT_COUNT];
+		uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+		if (sequence == 2 * (this->read_index + 1))
+		{
+			uint64_t event_count = slot.event_count;
+			uint64_t copy_count = (event_count < TAP_SLOT_EVENTS) ? event_count : TAP_SLOT_EVENTS;
+			ev_list.resize(copy_count);
+			memcpy(ev_list.data(), slot.events, sizeof(struct input_event) * copy_count);
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (slot.sequence.load(std::memory_order_relaxed) == sequence)
+			{
+				++this->read_index;
+				return true;
+			}
+		}
+
+		// The writer lapped this slot while it was being read, count it and move on
+		++lost_frames;
+		++this->read_index;
+	}
+}
+
+// Blocks until a frame is available or the timeout expires, returns whether one is
+bool Event_Tap_Reader::wait(int timeout_ms)
+{
+	if (this->p_header == nullptr)
+		return false;
+
+	tap_reader& reader = this->p_header->readers[this->reader_index];
+	reader.waiting.store(1, std::memory_order_seq_cst);
+	// Recheck after announcing, a frame published in between would not signal us
+	if (this->p_header->write_index.load(std::memory_order_seq_cst) != this->read_index)
+	{
+		reader.waiting.store(0, std::memory_order_relaxed);
+		return true;
+	}
+
+	struct pollfd pfd = { this->event_fd, POLLIN, 0 };
+	int poll_result = poll(&pfd, 1, timeout_ms);
+	reader.waiting.store(0, std::memory_order_relaxed);
+
+	if (poll_result > 0)
+	{
+		uint64_t message = 0;
+		read(this->event_fd, &message, sizeof(uint64_t));
+	}
+	return this->p_header->write_index.load(std::memory_order_acquire) != this->read_index;
+}
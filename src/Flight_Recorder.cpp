@@ -0,0 +1,280 @@
+#include "Flight_Recorder.hpp"
+#include "Logger.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static uint64_t monotonic_ns()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+void Flight_Recorder::lock_dump()
+{
+	bool prev_state = false;
+	while (!Flight_Recorder::in_progress.compare_exchange_strong(prev_state, true, std::memory_order_acq_rel))
+	{
+		Flight_Recorder::in_progress.wait(true, std::memory_order_acquire);
+		prev_state = false;
+	}
+}
+
+void Flight_Recorder::unlock_dump()
+{
+	Flight_Recorder::in_progress.store(false, std::memory_order_release);
+	Flight_Recorder::in_progress.notify_all();
+}
+
+// Dump names are predictable, so nobody but the daemon may create or swap files in the directory
+bool Flight_Recorder::is_private_directory(const std::string& directory)
+{
+	mkdir(directory.c_str(), 0750);	// An existing directory is checked like a new one
+
+	struct stat info;
+	if (lstat(directory.c_str(), &info) < 0)
+		return false;
+	return S_ISDIR(info.st_mode) && info.st_uid == geteuid() && (info.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
+
+bool Flight_Recorder::start(const std::string& directory)
+{
+	if (Flight_Recorder::dumper_thread.joinable())
+		return false;
+
+	if (!Flight_Recorder::is_private_directory(directory))
+	{
+		Logger::log(Logger::ERROR, "Flight recorder dumps unavailable: %s is not a directory only this user can write to", directory.c_str());
+		return false;
+	}
+
+	// Threads started later inherit the mask, so SIGUSR1 only ever reaches the signalfd
+	sigset_t signal_set;
+	sigemptyset(&signal_set);
+	sigaddset(&signal_set, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &signal_set, nullptr);
+
+	Flight_Recorder::dump_directory = directory;
+	Flight_Recorder::request_fd = eventfd(0, EFD_CLOEXEC);
+	Flight_Recorder::signal_fd = signalfd(-1, &signal_set, SFD_CLOEXEC);
+	if (Flight_Recorder::request_fd < 0 || Flight_Recorder::signal_fd < 0)
+	{
+		Logger::log(Logger::ERROR, "Flight recorder dumps unavailable: %s", strerror(errno));
+		return false;
+	}
+
+	Flight_Recorder::is_exit.store(false, std::memory_order_release);
+	Flight_Recorder::dumper_thread = std::thread(Flight_Recorder::dumper_process);
+	return true;
+}
+
+void Flight_Recorder::stop()
+{
+	static constexpr uint64_t message = 1;
+
+	if (!Flight_Recorder::dumper_thread.joinable())
+		return;
+
+	Flight_Recorder::is_exit.store(true, std::memory_order_release);
+	write(Flight_Recorder::request_fd, &message, sizeof(uint64_t));
+	Flight_Recorder::dumper_thread.join();
+	close(Flight_Recorder::request_fd);
+	close(Flight_Recorder::signal_fd);
+	Flight_Recorder::request_fd = -1;
+	Flight_Recorder::signal_fd = -1;
+}
+
+void Flight_Recorder::record(Stage stage, uint64_t frame_id, uint64_t latency_ns, const struct input_event* events, uint64_t event_count, uint64_t stage_ns)
+{
+	// A key transition says more about a stuck key than the motion around it
+	const struct input_event* p_summary = (event_count != 0) ? &events[0] : nullptr;
+	for (uint64_t n = 0; n < event_count; ++n)
+	{
+		if (events[n].type == EV_KEY)
+		{
+			p_summary = &events[n];
+			break;
+		}
+	}
+
+	uint64_t index = Flight_Recorder::write_indices[stage].value.fetch_add(1, std::memory_order_relaxed);
+	flight_slot& slot = Flight_Recorder::slots[stage][index % FLIGHT_RING_SIZE];
+
+	slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	slot.record.frame_id = frame_id;
+	slot.record.stage_ns = stage_ns;
+	slot.record.latency_ns = latency_ns;
+	slot.record.event_count = (uint32_t)event_count;
+	slot.record.stage = stage;
+	slot.record.type = (p_summary != nullptr) ? p_summary->type : 0;
+	slot.record.code = (p_summary != nullptr) ? p_summary->code : 0;
+	slot.record.reserved = 0;
+	slot.record.value = (p_summary != nullptr) ? p_summary->value : 0;
+	slot.sequence.store(2 * (index + 1), std::memory_order_release);
+
+	// A frame_id of zero is a frame with no capture time, e.g. on a receiver without a clock estimate yet
+	uint64_t threshold_ns = Flight_Recorder::threshold_ns.load(std::memory_order_relaxed);
+	if (threshold_ns != 0 && frame_id != 0 && latency_ns > threshold_ns)
+		Flight_Recorder::trigger_dump(ON_THRESHOLD);
+}
+
+// Frames in the frame pool layout, with the first event's kernel timestamp as capture time
+void Flight_Recorder::record_frame(Stage stage, const void* data, uint64_t stage_ns)
+{
+	const uint64_t* p_event_count = (const uint64_t*)data;
+	const struct input_event* event_queue = (const struct input_event*)(p_event_count + 1);
+
+	uint64_t capture_ns = 0;
+	if (*p_event_count != 0)
+		capture_ns = (uint64_t)event_queue[0].input_event_sec * 1000000000ull + (uint64_t)event_queue[0].input_event_usec * 1000;
+
+	// Releases made up on removal carry no kernel time, there is nothing to match them by past capture
+	if (capture_ns == 0 && stage != CAPTURE)
+		return;
+
+	// Devices left on CLOCK_REALTIME stamp events ahead of the monotonic clock
+	uint64_t latency_ns = (capture_ns != 0 && stage_ns >= capture_ns) ? stage_ns - capture_ns : 0;
+	Flight_Recorder::record(stage, capture_ns, latency_ns, event_queue, *p_event_count, stage_ns);
+}
+
+void Flight_Recorder::set_threshold(uint64_t latency_ns)
+{
+	Flight_Recorder::threshold_ns.store(latency_ns, std::memory_order_relaxed);
+}
+
+void Flight_Recorder::trigger_dump(Reason reason)
+{
+	static constexpr uint64_t message = 1;
+
+	if (Flight_Recorder::request_fd < 0)
+		return;
+
+	// Only the first frame over the threshold in an interval asks, the rest return here
+	if (reason == ON_THRESHOLD)
+	{
+		uint64_t now_ns = monotonic_ns();
+		uint64_t last_ns = Flight_Recorder::last_auto_dump_ns.load(std::memory_order_relaxed);
+		if ((last_ns != 0 && now_ns - last_ns < AUTO_DUMP_INTERVAL_NS)
+			|| !Flight_Recorder::last_auto_dump_ns.compare_exchange_strong(last_ns, now_ns, std::memory_order_relaxed))
+			return;
+	}
+
+	Flight_Recorder::pending_reasons.fetch_or(1u << reason, std::memory_order_release);
+	write(Flight_Recorder::request_fd, &message, sizeof(uint64_t));
+}
+
+// Called with the dump lock held
+std::string Flight_Recorder::return_dump_path()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return Flight_Recorder::dump_directory + "/unikey-flight-" + std::to_string(now.tv_sec) + '-' + std::to_string(now.tv_nsec / 1000000)
+		+ '-' + std::to_string(Flight_Recorder::dump_count++) + ".bin";
+}
+
+// Returns the path written, or an empty string when the dump failed
+std::string Flight_Recorder::dump(Reason reason)
+{
+	if (Flight_Recorder::dump_directory.size() == 0)
+	{
+		Logger::log(Logger::ERROR, "Flight recorder dump failed: the recorder was never started");
+		return "";
+	}
+
+	std::vector<flight_record> records;
+	records.reserve(STAGE_CNT * FLIGHT_RING_SIZE);
+
+	Flight_Recorder::lock_dump();
+	std::string path = Flight_Recorder::return_dump_path();
+	for (unsigned stage = 0; stage < STAGE_CNT; ++stage)
+	{
+		uint64_t end = Flight_Recorder::write_indices[stage].value.load(std::memory_order_acquire);
+		for (uint64_t index = (end > FLIGHT_RING_SIZE) ? end - FLIGHT_RING_SIZE : 0; index < end; ++index)
+		{
+			const flight_slot& slot = Flight_Recorder::slots[stage][index % FLIGHT_RING_SIZE];
+			uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+			if (sequence != 2 * (index + 1))	// Still being written, or already overwritten
+				continue;
+
+			flight_record record = slot.record;
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (slot.sequence.load(std::memory_order_relaxed) == sequence)
+				records.push_back(record);
+		}
+	}
+
+	flight_header header = { FLIGHT_MAGIC, FLIGHT_VERSION, reason, sizeof(flight_record), monotonic_ns(), records.size() };
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0640);
+	bool is_written = (fd >= 0)
+		&& write(fd, &header, sizeof(header)) == (ssize_t)sizeof(header)
+		&& write(fd, records.data(), sizeof(flight_record) * records.size()) == (ssize_t)(sizeof(flight_record) * records.size());
+	if (fd >= 0)
+		close(fd);
+	Flight_Recorder::unlock_dump();
+
+	if (!is_written)
+	{
+		Logger::log(Logger::ERROR, "Flight recorder dump to %s failed: %s", path.c_str(), strerror(errno));
+		return "";
+	}
+	Logger::log(Logger::INFO, "Flight recorder dumped %zu frames to %s", records.size(), path.c_str());
+	return path;
+}
+
+void Flight_Recorder::dumper_process()
+{
+	struct pollfd pfd[2];
+	pfd[0].fd = Flight_Recorder::request_fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = Flight_Recorder::signal_fd;
+	pfd[1].events = POLLIN;
+
+	while (Flight_Recorder::is_exit.load(std::memory_order_acquire) == false)
+	{
+		pfd[0].revents = 0;
+		pfd[1].revents = 0;
+		if (poll(pfd, 2, -1) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			Logger::log(Logger::ERROR, "Flight recorder polling failed: %s", strerror(errno));
+			break;
+		}
+
+		if (pfd[1].revents & POLLIN)
+		{
+			struct signalfd_siginfo info;
+			read(pfd[1].fd, &info, sizeof(info));
+			Flight_Recorder::dump(ON_SIGNAL);
+		}
+
+		if (pfd[0].revents & POLLIN)
+		{
+			uint64_t request_count = 0;
+			read(pfd[0].fd, &request_count, sizeof(uint64_t));	// One read clears every request
+			uint32_t reasons = Flight_Recorder::pending_reasons.exchange(0, std::memory_order_acquire);
+			if ((reasons & (1u << ON_THRESHOLD)) && Flight_Recorder::is_exit.load(std::memory_order_acquire) == false)
+			{
+				std::this_thread::sleep_for(std::chrono::nanoseconds(POST_TRIGGER_NS));
+				Flight_Recorder::dump(ON_THRESHOLD);
+			}
+		}
+	}
+}
@@ -0,0 +1,154 @@
+#include "Frame_Pool.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <stdlib.h>
+
+unsigned Frame_Pool::size_class(uint64_t capacity)
+{
+	unsigned class_index = 0;
+	for (uint64_t class_capacity = SMALL_FRAME; class_capacity < capacity; class_capacity *= 4)
+		++class_index;
+	return class_index;
+}
+
+void Frame_Pool::lock_bank(frame_bank& bank)
+{
+	bool prev_state = false;
+	while (!bank.in_progress.compare_exchange_strong(prev_state, true, std::memory_order_acq_rel))
+	{
+		bank.in_progress.wait(true, std::memory_order_acquire);
+		prev_state = false;
+	}
+}
+
+void Frame_Pool::unlock_bank(frame_bank& bank)
+{
+	bank.in_progress.store(false, std::memory_order_release);
+	bank.in_progress.notify_all();
+}
+
+void* Frame_Pool::acquire(uint64_t min_events)
+{
+	unsigned class_index = Frame_Pool::size_class(min_events);
+	frame_info* p_info = nullptr;
+
+	if (class_index < CLASS_CNT)	// Use available buffer
+	{
+		frame_bank& bank = Frame_Pool::banks[class_index];
+		Frame_Pool::lock_bank(bank);
+		if (bank.p_head != nullptr)
+		{
+			p_info = bank.p_head;
+			bank.p_head = p_info->p_next;
+			--bank.frame_count;
+		}
+		Frame_Pool::unlock_bank(bank);
+	}
+
+	if (p_info == nullptr)
+	{
+		// Frames past the largest class are sized exactly and freed on release
+		uint64_t capacity = (class_index < CLASS_CNT) ? (SMALL_FRAME << (2 * class_index)) : min_events;
+		p_info = (frame_info*)malloc(sizeof(frame_info) + sizeof(uint64_t) + sizeof(struct input_event) * capacity);
+		p_info->capacity = capacity;
+	}
+
+	// A banked frame still carries the times and trigger of the frame it last held
+	p_info->read_ns = 0;
+	p_info->queued_ns = 0;
+	p_info->trigger = Chord_Matcher::Trigger();
+	*(uint64_t*)(p_info + 1) = 0;
+	return p_info + 1;
+}
+
+void* Frame_Pool::grow(void* p_frame)
+{
+	// Move a full frame into the next size class so an oversized SYN group stays in one frame
+	uint64_t event_count = *(uint64_t*)p_frame;
+	void* p_new_frame = Frame_Pool::acquire(Frame_Pool::capacity(p_frame) * 4);
+
+	memcpy(p_new_frame, p_frame, sizeof(uint64_t) + sizeof(struct input_event) * event_count);
+	Frame_Pool::set_read_time(p_new_frame, Frame_Pool::return_read_time(p_frame));
+	Frame_Pool::set_queued_time(p_new_frame, Frame_Pool::return_queued_time(p_frame));
+	Frame_Pool::set_trigger(p_new_frame, Frame_Pool::return_trigger(p_frame));
+	Frame_Pool::release(p_frame);
+
+	return p_new_frame;
+}
+
+void Frame_Pool::release(void* p_frame)
+{
+	if (p_frame == nullptr)
+		return;
+
+	frame_info* p_info = (frame_info*)p_frame - 1;
+	unsigned class_index = Frame_Pool::size_class(p_info->capacity);
+
+	if (class_index < CLASS_CNT)
+	{
+		frame_bank& bank = Frame_Pool::banks[class_index];
+		Frame_Pool::lock_bank(bank);
+		if (bank.frame_count < BANK_FRAMES)
+		{
+			p_info->p_next = bank.p_head;
+			bank.p_head = p_info;
+			++bank.frame_count;
+			p_info = nullptr;
+		}
+		Frame_Pool::unlock_bank(bank);
+	}
+	free(p_info);
+}
+
+uint64_t Frame_Pool::capacity(const void* p_frame)
+{
+	return ((const frame_info*)p_frame - 1)->capacity;
+}
+
+void Frame_Pool::set_read_time(void* p_frame, uint64_t read_ns)
+{
+	((frame_info*)p_frame - 1)->read_ns = read_ns;
+}
+
+uint64_t Frame_Pool::return_read_time(const void* p_frame)
+{
+	return ((const frame_info*)p_frame - 1)->read_ns;
+}
+
+void Frame_Pool::set_queued_time(void* p_frame, uint64_t queued_ns)
+{
+	((frame_info*)p_frame - 1)->queued_ns = queued_ns;
+}
+
+uint64_t Frame_Pool::return_queued_time(const void* p_frame)
+{
+	return ((const frame_info*)p_frame - 1)->queued_ns;
+}
+
+void Frame_Pool::set_trigger(void* p_frame, const Chord_Matcher::Trigger& trigger)
+{
+	((frame_info*)p_frame - 1)->trigger = trigger;
+}
+
+Chord_Matcher::Trigger Frame_Pool::return_trigger(const void* p_frame)
+{
+	return ((const frame_info*)p_frame - 1)->trigger;
+}
+
+void Frame_Pool::clear()
+{
+	for (frame_bank& bank : Frame_Pool::banks)
+	{
+		Frame_Pool::lock_bank(bank);
+		while (bank.p_head != nullptr)
+		{
+			frame_info* p_info = bank.p_head;
+			bank.p_head = p_info->p_next;
+			free(p_info);
+		}
+		bank.frame_count = 0;
+		Frame_Pool::unlock_bank(bank);
+	}
+}
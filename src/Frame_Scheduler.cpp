@@ -0,0 +1,160 @@
+#include "Frame_Scheduler.hpp"
+#include "Frame_Pool.hpp"
+#include "Metrics.hpp"
+#include "Tracepoints.hpp"
+
+#include <atomic>
+#include <cstdint>
+
+#include <linux/input.h>
+
+// Frames still queued go back to the pool, the queues only hold them
+Frame_Scheduler::~Frame_Scheduler()
+{
+	for (Cyclic_Queue& queue : this->queues)
+	{
+		while (queue.size() != 0)
+		{
+			void* p_frame = queue.pop();
+			if (p_frame == nullptr)	// Claimed by a producer that never stored it, nothing to release
+				break;
+			Frame_Pool::release(p_frame);
+		}
+	}
+}
+
+Frame_Scheduler::Frame_Class Frame_Scheduler::classify(const void* p_frame)
+{
+	const uint64_t* p_event_count = (const uint64_t*)p_frame;
+	const struct input_event* event_queue = (const struct input_event*)(p_event_count + 1);
+	for (uint64_t n = 0; n < *p_event_count; ++n)
+	{
+		if (event_queue[n].type == EV_KEY)
+			return KEY_FRAME;
+	}
+	return MOTION_FRAME;
+}
+
+bool Frame_Scheduler::is_relative_only(const void* p_frame)
+{
+	const uint64_t* p_event_count = (const uint64_t*)p_frame;
+	const struct input_event* event_queue = (const struct input_event*)(p_event_count + 1);
+	for (uint64_t n = 0; n < *p_event_count; ++n)
+	{
+		if (event_queue[n].type != EV_REL)
+			return false;
+	}
+	return true;
+}
+
+void Frame_Scheduler::set_prioritized(bool prioritized)
+{
+	this->is_prioritized.store(prioritized, std::memory_order_relaxed);
+}
+
+bool Frame_Scheduler::push(void* p_frame, Frame_Class frame_class)
+{
+	Cyclic_Queue& queue = this->queues[this->is_prioritized.load(std::memory_order_relaxed) ? frame_class : CONTROL_FRAME];
+	if (!queue.push(p_frame))
+		return false;
+	TRACEPOINT(frame_queued, p_frame, frame_class, queue.size());
+	return true;
+}
+
+void Frame_Scheduler::wait_for_room(Frame_Class frame_class) const
+{
+	this->queues[this->is_prioritized.load(std::memory_order_relaxed) ? frame_class : CONTROL_FRAME].wait_for_room();
+}
+
+// Folds the queued EV_REL-only frames behind p_frame into it, up to the first one queued after until_ns
+void Frame_Scheduler::coalesce_motion(void* p_frame, uint64_t until_ns, uint64_t& frame_cnt, void (*observer)(const void*))
+{
+	if (!Frame_Scheduler::is_relative_only(p_frame))
+		return;
+
+	uint64_t* p_event_count = (uint64_t*)p_frame;
+	struct input_event* event_queue = (struct input_event*)(p_event_count + 1);
+	void* p_next = nullptr;
+	while ((p_next = this->queues[MOTION_FRAME].peek()) != nullptr
+		&& Frame_Pool::return_queued_time(p_next) <= until_ns && Frame_Scheduler::is_relative_only(p_next))
+	{
+		this->queues[MOTION_FRAME].pop();
+		if (observer != nullptr)
+			observer(p_next);
+
+		// Each code appears once per frame, so the result holds at most REL_CNT events
+		const uint64_t* p_next_count = (const uint64_t*)p_next;
+		const struct input_event* next_queue = (const struct input_event*)(p_next_count + 1);
+		for (uint64_t n = 0; n < *p_next_count; ++n)
+		{
+			uint64_t m = 0;
+			while (m < *p_event_count && event_queue[m].code != next_queue[n].code)
+				++m;
+			if (m == *p_event_count)
+			{
+				event_queue[m] = next_queue[n];
+				++*p_event_count;
+			}
+			else
+				event_queue[m].value += next_queue[n].value;
+		}
+
+		// A chord action carried by the folded frame runs after the merged one instead
+		if (Frame_Pool::return_trigger(p_next).action != Chord_Matcher::NONE)
+			Frame_Pool::set_trigger(p_frame, Frame_Pool::return_trigger(p_next));
+
+		++frame_cnt;
+		Metrics::add(Metrics::FRAMES_COALESCED);
+		Frame_Pool::release(p_next);
+	}
+}
+
+/*
+	Returns the next frame to send and, in frame_cnt, how many queued frames
+	it stands for. The observer sees every queued frame as captured, before
+	any folding.
+*/
+void* Frame_Scheduler::pop(uint64_t& frame_cnt, void (*observer)(const void*))
+{
+	frame_cnt = 0;
+
+	// Control and key frames are one stream split by class, the older of the two heads goes first
+	unsigned frame_class = CONTROL_FRAME;
+	void* p_frame = this->queues[CONTROL_FRAME].peek();
+	void* p_key = this->queues[KEY_FRAME].peek();
+	if (p_key != nullptr && (p_frame == nullptr || Frame_Pool::return_queued_time(p_key) < Frame_Pool::return_queued_time(p_frame)))
+	{
+		frame_class = KEY_FRAME;
+		p_frame = p_key;
+	}
+
+	uint64_t until_ns = UINT64_MAX;
+	void* p_motion = this->queues[MOTION_FRAME].peek();
+	if (p_motion != nullptr && (p_frame == nullptr || Frame_Pool::return_queued_time(p_motion) <= Frame_Pool::return_queued_time(p_frame)))
+	{
+		// Motion queued earlier goes first, folded into one frame
+		if (p_frame != nullptr)
+			until_ns = Frame_Pool::return_queued_time(p_frame);
+		frame_class = MOTION_FRAME;
+		p_frame = p_motion;
+	}
+	if (p_frame == nullptr)
+		return nullptr;
+
+	this->queues[frame_class].pop();
+	frame_cnt = 1;
+	if (observer != nullptr)
+		observer(p_frame);
+	if (frame_class == MOTION_FRAME)
+		this->coalesce_motion(p_frame, until_ns, frame_cnt, observer);
+	TRACEPOINT(frame_dequeued, p_frame, frame_class, frame_cnt);
+	return p_frame;
+}
+
+std::size_t Frame_Scheduler::size() const
+{
+	std::size_t frame_cnt = 0;
+	for (const Cyclic_Queue& queue : this->queues)
+		frame_cnt += queue.size();
+	return frame_cnt;
+}
@@ -0,0 +1,156 @@
+#include "IO_Engine.hpp"
+#include "Logger.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+IO_Engine::IO_Engine(bool use_io_uring)
+{
+#ifdef UNIKEY_HAVE_LIBURING
+	if (!use_io_uring)
+		return;
+
+	// Fails on kernels without io_uring or where it is disabled, e.g. kernel.io_uring_disabled or seccomp
+	int result = io_uring_queue_init(QUEUE_DEPTH, &this->ring, 0);
+	if (result < 0)
+	{
+		Logger::log(Logger::INFO, "io_uring unavailable (%s), using direct writes", strerror(-result));
+		return;
+	}
+
+	this->slot_buffers.resize(QUEUE_DEPTH * SLOT_SIZE);
+	struct iovec slot_iov[QUEUE_DEPTH];
+	for (unsigned n = 0; n < QUEUE_DEPTH; ++n)
+	{
+		slot_iov[n].iov_base = this->slot_buffers.data() + n * SLOT_SIZE;
+		slot_iov[n].iov_len = SLOT_SIZE;
+	}
+	if ((result = io_uring_register_buffers(&this->ring, slot_iov, QUEUE_DEPTH)) < 0)
+	{
+		Logger::log(Logger::INFO, "io_uring buffer registration failed (%s), using direct writes", strerror(-result));
+		io_uring_queue_exit(&this->ring);
+		this->slot_buffers.clear();
+		return;
+	}
+	this->is_uring = true;
+#else
+	(void)use_io_uring;
+#endif
+}
+
+IO_Engine::~IO_Engine()
+{
+	this->flush();
+#ifdef UNIKEY_HAVE_LIBURING
+	if (this->is_uring)
+		io_uring_queue_exit(&this->ring);
+#endif
+}
+
+bool IO_Engine::uses_io_uring() const
+{
+	return this->is_uring;
+}
+
+bool IO_Engine::write_direct(int fd, const struct iovec* p_iov, int iov_count)
+{
+	ssize_t bytes_written;
+	do
+	{
+		bytes_written = writev(fd, p_iov, iov_count);
+		++this->syscall_count;
+	} while (bytes_written < 0 && errno == EINTR);
+	return bytes_written >= 0;
+}
+
+bool IO_Engine::write(int fd, const struct iovec* p_iov, int iov_count)
+{
+#ifdef UNIKEY_HAVE_LIBURING
+	if (this->is_uring)
+	{
+		std::size_t length = 0;
+		for (int n = 0; n < iov_count; ++n)
+			length += p_iov[n].iov_len;
+
+		if (length > SLOT_SIZE)
+		{
+			this->flush();	// Keeps it behind everything queued before it
+			return this->write_direct(fd, p_iov, iov_count);
+		}
+		if (this->queued_writes == QUEUE_DEPTH)
+			this->flush();
+
+		unsigned slot = this->queued_writes++;
+		uint8_t* p_slot = this->slot_buffers.data() + slot * SLOT_SIZE;
+		this->slot_fds[slot] = fd;
+		this->slot_lengths[slot] = length;
+		uint8_t* p_end = p_slot;
+		for (int n = 0; n < iov_count; ++n)
+		{
+			memcpy(p_end, p_iov[n].iov_base, p_iov[n].iov_len);
+			p_end += p_iov[n].iov_len;
+		}
+
+		// Linking each write to the one before keeps them in order on the same descriptor
+		if (this->p_last_sqe != nullptr)
+			io_uring_sqe_set_flags(this->p_last_sqe, IOSQE_IO_LINK);
+		this->p_last_sqe = io_uring_get_sqe(&this->ring);
+		io_uring_prep_write_fixed(this->p_last_sqe, fd, p_slot, length, (uint64_t)-1, slot);	// -1 writes at the file position, like write()
+		io_uring_sqe_set_data(this->p_last_sqe, (void*)(uintptr_t)slot);
+		return true;
+	}
+#endif
+	return this->write_direct(fd, p_iov, iov_count);
+}
+
+void IO_Engine::flush()
+{
+#ifdef UNIKEY_HAVE_LIBURING
+	if (this->queued_writes == 0)
+		return;
+
+	// Slots are reused by the next batch, so wait until every write has completed
+	int result = io_uring_submit_and_wait(&this->ring, this->queued_writes);
+	++this->syscall_count;
+	if (result < 0)
+		Logger::log(Logger::WARNING, "io_uring submit failed: %s", strerror(-result));
+
+	// A failed write cancels every write linked behind it
+	bool is_cancelled[QUEUE_DEPTH] = { false };
+	struct io_uring_cqe* p_cqe;
+	unsigned head;
+	unsigned completed = 0;
+	io_uring_for_each_cqe(&this->ring, head, p_cqe)
+	{
+		uintptr_t slot = (uintptr_t)io_uring_cqe_get_data(p_cqe);
+		if (p_cqe->res == -ECANCELED && slot < QUEUE_DEPTH)
+			is_cancelled[slot] = true;
+		else if (p_cqe->res < 0)
+			Logger::log(Logger::WARNING, "io_uring write failed: %s", strerror(-p_cqe->res));
+		++completed;
+	}
+	io_uring_cq_advance(&this->ring, completed);
+
+	// Resent directly in queue order, so they still land in the order they were written
+	unsigned queued_writes = this->queued_writes;
+	this->queued_writes = 0;
+	this->p_last_sqe = nullptr;
+	for (unsigned slot = 0; slot < queued_writes; ++slot)
+	{
+		if (!is_cancelled[slot])
+			continue;
+		struct iovec iov = { this->slot_buffers.data() + slot * SLOT_SIZE, this->slot_lengths[slot] };
+		if (!this->write_direct(this->slot_fds[slot], &iov, 1))
+			Logger::log(Logger::WARNING, "Resending a cancelled write failed: %s", strerror(errno));
+	}
+#endif
+}
+
+uint64_t IO_Engine::return_syscall_count() const
+{
+	return this->syscall_count;
+}
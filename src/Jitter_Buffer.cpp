@@ -0,0 +1,103 @@
+#include "Jitter_Buffer.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <linux/input.h>
+
+bool Jitter_Buffer::is_motion(const std::vector<struct input_event>& ev_list)
+{
+	for (const struct input_event& ev : ev_list)
+	{
+		if (ev.type != EV_REL && ev.type != EV_ABS)
+			return false;
+	}
+	return true;
+}
+
+void Jitter_Buffer::track_transit(int64_t transit_ns)
+{
+	if (!this->has_transit)
+	{
+		this->mean_transit_ns = transit_ns;
+		this->jitter_ns = 0;
+		this->has_transit = true;
+		return;
+	}
+
+	this->mean_transit_ns += (transit_ns - this->mean_transit_ns) / (1 << GAIN_SHIFT);
+	int64_t deviation_ns = transit_ns - this->mean_transit_ns;
+	this->jitter_ns += ((deviation_ns < 0 ? -deviation_ns : deviation_ns) - this->jitter_ns) / (1 << GAIN_SHIFT);
+}
+
+void Jitter_Buffer::set_budget(uint64_t budget_ns)
+{
+	this->budget_ns = budget_ns;
+}
+
+// Takes ev_list over and returns true if the frame was buffered, false if it must be written now
+bool Jitter_Buffer::push(std::vector<struct input_event>& ev_list, uint64_t capture_ns, uint64_t now_ns)
+{
+	if (capture_ns == 0)	// No timestamp or no clock estimate yet
+		return false;
+	this->track_transit((int64_t)now_ns - (int64_t)capture_ns);
+
+	if (this->budget_ns == 0 || this->count == CAPACITY || !Jitter_Buffer::is_motion(ev_list))
+		return false;
+
+	uint64_t due_ns = std::max(capture_ns + this->return_delay(), this->last_due_ns);
+	if (due_ns <= now_ns)	// Late already
+		return false;
+
+	pending_frame& frame = this->frames[(this->head + this->count) % CAPACITY];
+	frame.due_ns = due_ns;
+	frame.capture_ns = capture_ns;
+	frame.ev_list.swap(ev_list);
+	++this->count;
+	this->last_due_ns = due_ns;
+	return true;
+}
+
+uint64_t Jitter_Buffer::return_next_due() const
+{
+	return (this->count != 0) ? this->frames[this->head].due_ns : NOT_DUE;
+}
+
+uint64_t Jitter_Buffer::return_delay() const
+{
+	int64_t delay_ns = this->mean_transit_ns + 4 * this->jitter_ns;
+	if (delay_ns < 0)	// Only possible with a poor clock estimate
+		return 0;
+	return std::min((uint64_t)delay_ns, this->budget_ns);
+}
+
+bool Jitter_Buffer::pop_due(uint64_t now_ns, std::vector<struct input_event>& ev_list, uint64_t& capture_ns)
+{
+	if (this->return_next_due() > now_ns)
+		return false;
+	return this->pop(ev_list, capture_ns);
+}
+
+bool Jitter_Buffer::pop(std::vector<struct input_event>& ev_list, uint64_t& capture_ns)
+{
+	if (this->count == 0)
+		return false;
+
+	pending_frame& frame = this->frames[this->head];
+	ev_list.swap(frame.ev_list);
+	capture_ns = frame.capture_ns;
+	this->head = (this->head + 1) % CAPACITY;
+	--this->count;
+	return true;
+}
+
+void Jitter_Buffer::clear()
+{
+	this->head = 0;
+	this->count = 0;
+	this->has_transit = false;
+	this->mean_transit_ns = 0;
+	this->jitter_ns = 0;
+	this->last_due_ns = 0;
+}
@@ -0,0 +1,66 @@
+#include "Latency_Histogram.hpp"
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+void Latency_Histogram::record(uint64_t latency_ns)
+{
+	unsigned bucket = 63 - __builtin_clzll(latency_ns | 1);
+	this->buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+
+	uint64_t prev_max = this->max_ns.load(std::memory_order_relaxed);
+	while (latency_ns > prev_max && !this->max_ns.compare_exchange_weak(prev_max, latency_ns, std::memory_order_relaxed));
+}
+
+void Latency_Histogram::clear()
+{
+	for (std::atomic_uint64_t& bucket : this->buckets)
+		bucket.store(0, std::memory_order_relaxed);
+	this->max_ns.store(0, std::memory_order_relaxed);
+}
+
+uint64_t Latency_Histogram::return_count() const
+{
+	uint64_t count = 0;
+	for (const std::atomic_uint64_t& bucket : this->buckets)
+		count += bucket.load(std::memory_order_relaxed);
+	return count;
+}
+
+uint64_t Latency_Histogram::return_percentile(double percentile) const
+{
+	// Upper bound of the bucket the percentile falls into
+	uint64_t count = this->return_count();
+	uint64_t target = (uint64_t)(count * percentile / 100.0);
+	uint64_t seen = 0;
+	for (unsigned n = 0; n < BUCKET_CNT; ++n)
+	{
+		seen += this->buckets[n].load(std::memory_order_relaxed);
+		if (seen > target)
+			return (n < BUCKET_CNT - 1) ? (2ULL << n) : UINT64_MAX;
+	}
+	return 0;
+}
+
+uint64_t Latency_Histogram::return_max() const
+{
+	return this->max_ns.load(std::memory_order_relaxed);
+}
+
+std::string Latency_Histogram::report(const std::string& name) const
+{
+	std::ostringstream text;
+	text << name << ": samples=" << this->return_count()
+		<< " p50<" << this->return_percentile(50) / 1000 << "us"
+		<< " p99<" << this->return_percentile(99) / 1000 << "us"
+		<< " max=" << this->return_max() / 1000 << "us" << '\n';
+
+	for (unsigned n = 0; n < BUCKET_CNT; ++n)
+	{
+		uint64_t bucket_count = this->buckets[n].load(std::memory_order_relaxed);
+		if (bucket_count != 0)
+			text << "\t[" << (1ULL << n) << ", " << (2ULL << n) << ") ns: " << bucket_count << '\n';
+	}
+	return text.str();
+}
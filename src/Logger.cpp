@@ -0,0 +1,164 @@
+#include "Logger.hpp"
+
+#include <atomic>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+void Logger::start()
+{
+	bool prev_state = false;
+	if (!Logger::is_started.compare_exchange_strong(prev_state, true, std::memory_order_acq_rel))
+		return;
+
+	Logger::wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	Logger::flusher_thread = std::thread(Logger::flusher_process);
+	std::atexit(Logger::stop);	// Whatever is still queued is written out on exit
+}
+
+void Logger::set_level(Level level)
+{
+	Logger::min_level.store(level, std::memory_order_release);
+}
+
+bool Logger::is_enabled(Level level)
+{
+	return level >= Logger::min_level.load(std::memory_order_relaxed);
+}
+
+void Logger::log(Level level, const char* format, ...)
+{
+	if (!Logger::is_enabled(level))
+		return;
+	if (!Logger::is_started.load(std::memory_order_acquire))
+		Logger::start();
+
+	// Claim a slot, it is free for this lap of the ring once its sequence reads 2 * lap
+	std::size_t position = Logger::head.load(std::memory_order_relaxed);
+	log_record* p_record;
+	while (true)
+	{
+		p_record = &Logger::ring[position & (RING_SIZE - 1)];
+		std::size_t sequence = p_record->sequence.load(std::memory_order_acquire);
+		std::size_t free_sequence = 2 * (position / RING_SIZE);
+		if (sequence == free_sequence)
+		{
+			if (Logger::head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				break;
+		}
+		else if (sequence < free_sequence)	// Ring is full, never wait on the flusher
+		{
+			Logger::dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		else
+			position = Logger::head.load(std::memory_order_relaxed);
+	}
+
+	va_list args;
+	va_start(args, format);
+	int length = vsnprintf(p_record->text, MESSAGE_SIZE - 1, format, args);
+	va_end(args);
+
+	if (length < 0)
+		length = 0;
+	else if (length > (int)MESSAGE_SIZE - 2)
+		length = MESSAGE_SIZE - 2;	// Truncated
+	p_record->text[length++] = '\n';
+	p_record->length = length;
+	p_record->level = level;
+	p_record->sequence.store(2 * (position / RING_SIZE) + 1, std::memory_order_release);	// Publish to the flusher
+
+	Logger::wake_flusher();
+}
+
+void Logger::wake_flusher()
+{
+	static constexpr uint64_t message = 1;
+
+	// Only costs a syscall when the flusher has gone to sleep
+	if (Logger::flusher_waiting.load(std::memory_order_seq_cst) && Logger::flusher_waiting.exchange(false, std::memory_order_seq_cst))
+		write(Logger::wake_fd, &message, sizeof(uint64_t));
+}
+
+void Logger::flusher_process()
+{
+	static constexpr std::size_t BATCH_SIZE = 64;
+
+	struct pollfd pfd;
+	pfd.fd = Logger::wake_fd;
+	pfd.events = POLLIN;
+
+	while (true)
+	{
+		// Collect a batch of published records per destination and write each with one call
+		struct iovec out_batch[BATCH_SIZE];
+		struct iovec err_batch[BATCH_SIZE];
+		int out_count = 0;
+		int err_count = 0;
+		std::size_t first = Logger::tail;
+
+		while (out_count + err_count < (int)BATCH_SIZE)
+		{
+			log_record& record = Logger::ring[Logger::tail & (RING_SIZE - 1)];
+			if (record.sequence.load(std::memory_order_acquire) != 2 * (Logger::tail / RING_SIZE) + 1)
+				break;
+
+			struct iovec& entry = (record.level >= WARNING) ? err_batch[err_count++] : out_batch[out_count++];
+			entry.iov_base = record.text;
+			entry.iov_len = record.length;
+			++Logger::tail;
+		}
+
+		if (out_count)
+			writev(STDOUT_FILENO, out_batch, out_count);
+		if (err_count)
+			writev(STDERR_FILENO, err_batch, err_count);
+
+		// Hand the flushed slots back to the producers for the next lap
+		for (std::size_t position = first; position != Logger::tail; ++position)
+			Logger::ring[position & (RING_SIZE - 1)].sequence.store(2 * (position / RING_SIZE + 1), std::memory_order_release);
+
+		if (Logger::tail != first)
+			continue;
+
+		if (Logger::is_stopping.load(std::memory_order_acquire))
+			break;
+
+		Logger::flusher_waiting.store(true, std::memory_order_seq_cst);
+		if (Logger::ring[Logger::tail & (RING_SIZE - 1)].sequence.load(std::memory_order_seq_cst) == 2 * (Logger::tail / RING_SIZE) + 1)
+			continue;	// A record was published before the flag was visible
+
+		poll(&pfd, 1, -1);
+		uint64_t message = 0;
+		read(Logger::wake_fd, &message, sizeof(uint64_t));
+	}
+}
+
+uint64_t Logger::return_dropped_count()
+{
+	return Logger::dropped.load(std::memory_order_relaxed);
+}
+
+void Logger::stop()
+{
+	static constexpr uint64_t message = 1;
+
+	if (!Logger::is_started.load(std::memory_order_acquire) || Logger::is_stopping.exchange(true, std::memory_order_acq_rel))
+		return;
+
+	write(Logger::wake_fd, &message, sizeof(uint64_t));
+	Logger::flusher_thread.join();
+	close(Logger::wake_fd);
+
+	uint64_t dropped_count = Logger::dropped.load(std::memory_order_relaxed);
+	if (dropped_count)
+		fprintf(stderr, "Logger dropped %lu messages\n", (unsigned long)dropped_count);
+}
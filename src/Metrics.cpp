@@ -0,0 +1,227 @@
+#include "Metrics.hpp"
+#include "Logger.hpp"
+#include "Socket_Address.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+static constexpr uint16_t DEFAULT_METRICS_PORT = 9469;
+static constexpr std::size_t MAX_REQUEST_SIZE = 4096;
+
+static constexpr const char* COUNTER_INFO[Metrics::COUNTER_CNT][2] = {
+	{ "unikey_frames_captured_total", "Frames read from input devices and queued for forwarding" },
+	{ "unikey_frames_resynced_total", "Kernel buffer overflows (SYN_DROPPED) recovered by resynchronizing" },
+	{ "unikey_frames_coalesced_total", "Queued motion frames folded into an earlier frame" },
+	{ "unikey_frames_forwarded_total", "Frames sent to the active target" },
+	{ "unikey_frames_unrouted_total", "Frames processed while no target was ready to take them" },
+	{ "unikey_frames_received_total", "Event frames received from a sender" },
+	{ "unikey_frames_injected_total", "Frames written to the virtual device" },
+	{ "unikey_client_connects_total", "Connections established to targets, reconnects included" },
+	{ "unikey_client_send_failures_total", "Sends to a target that failed on a broken connection" },
+	{ "unikey_server_connections_total", "Senders accepted by the server" }
+};
+
+Metrics::Thread_Block::Thread_Block()
+{
+	for (unsigned n = 0; n < MAX_THREADS; ++n)
+	{
+		bool prev_state = false;
+		if (!Metrics::is_claimed[n].load(std::memory_order_relaxed) && Metrics::is_claimed[n].compare_exchange_strong(prev_state, true, std::memory_order_acq_rel))
+		{
+			this->index = n;
+			return;
+		}
+	}
+}
+
+Metrics::Thread_Block::~Thread_Block()
+{
+	if (this->index == SHARED_BLOCK)
+		return;
+
+	// Folded under the lock so that a scrape sees the counts either here or in the line, never both
+	Metrics::lock_metrics();
+	for (unsigned counter = 0; counter < COUNTER_CNT; ++counter)
+	{
+		Metrics::retired_values[counter] += Metrics::blocks[this->index].values[counter].load(std::memory_order_relaxed);
+		Metrics::blocks[this->index].values[counter].store(0, std::memory_order_relaxed);
+	}
+	Metrics::unlock_metrics();
+	Metrics::is_claimed[this->index].store(false, std::memory_order_release);
+}
+
+void Metrics::lock_metrics()
+{
+	bool prev_state = false;
+	while (!Metrics::in_progress.compare_exchange_strong(prev_state, true, std::memory_order_acq_rel))
+	{
+		Metrics::in_progress.wait(true, std::memory_order_acquire);
+		prev_state = false;
+	}
+}
+
+void Metrics::unlock_metrics()
+{
+	Metrics::in_progress.store(false, std::memory_order_release);
+	Metrics::in_progress.notify_all();
+}
+
+uint64_t Metrics::return_count(Counter counter)
+{
+	Metrics::lock_metrics();
+	uint64_t value = Metrics::retired_values[counter];
+	for (const counter_block& block : Metrics::blocks)
+		value += block.values[counter].load(std::memory_order_relaxed);
+	Metrics::unlock_metrics();
+	return value;
+}
+
+void Metrics::add_collector(std::function<void(std::string&)> collector)
+{
+	Metrics::lock_metrics();
+	Metrics::collectors.push_back(std::move(collector));
+	Metrics::unlock_metrics();
+}
+
+void Metrics::append_header(std::string& text, const std::string& name, const char* type, const char* help)
+{
+	text += "# HELP " + name + ' ' + help + "\n# TYPE " + name + ' ' + type + '\n';
+}
+
+void Metrics::append_sample(std::string& text, const std::string& name, const std::string& labels, uint64_t value)
+{
+	text += name;
+	if (labels.size() != 0)
+		text += '{' + labels + '}';
+	text += ' ' + std::to_string(value) + '\n';
+}
+
+std::string Metrics::escape_label(const std::string& value)
+{
+	std::string escaped;
+	for (char c : value)
+	{
+		if (c == '\\' || c == '"')
+			escaped += '\\';
+		escaped += (c == '\n') ? 'n' : c;
+	}
+	return escaped;
+}
+
+std::string Metrics::return_report()
+{
+	std::string text;
+	for (unsigned counter = 0; counter < COUNTER_CNT; ++counter)
+	{
+		Metrics::append_header(text, COUNTER_INFO[counter][0], "counter", COUNTER_INFO[counter][1]);
+		Metrics::append_sample(text, COUNTER_INFO[counter][0], "", Metrics::return_count((Counter)counter));
+	}
+
+	Metrics::lock_metrics();
+	for (const std::function<void(std::string&)>& collector : Metrics::collectors)
+		collector(text);
+	Metrics::unlock_metrics();
+	return text;
+}
+
+/*
+	Any address Socket_Address accepts; unix: sockets are opened as streams,
+	which HTTP needs. An empty address only stops the endpoint.
+*/
+bool Metrics::start_endpoint(const std::string& address)
+{
+	Metrics::stop_endpoint();
+	if (address.size() == 0)
+		return true;
+
+	Socket_Address endpoint_addr;
+	if (!endpoint_addr.parse(address, DEFAULT_METRICS_PORT) || endpoint_addr.is_encrypted())
+		return false;
+
+	int listen_fd = socket(endpoint_addr.return_family(), SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listen_fd < 0)
+		return false;
+
+	int enable = 1;
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+	// Only a socket left behind by an earlier endpoint is removed, never whatever else the path names
+	std::string unix_path = endpoint_addr.return_unix_path();
+	struct stat path_info;
+	if (unix_path.size() != 0 && lstat(unix_path.c_str(), &path_info) == 0 && S_ISSOCK(path_info.st_mode))
+		unlink(unix_path.c_str());
+
+	if (bind(listen_fd, endpoint_addr.return_sockaddr(), endpoint_addr.return_sockaddr_len()) < 0 || listen(listen_fd, 8) < 0)
+	{
+		Logger::log(Logger::ERROR, "Metrics endpoint %s unavailable: %s", address.c_str(), strerror(errno));
+		close(listen_fd);
+		return false;
+	}
+
+	Metrics::endpoint_fd = listen_fd;
+	Metrics::endpoint_thread = std::thread(&Metrics::endpoint_process, listen_fd);
+	return true;
+}
+
+void Metrics::stop_endpoint()
+{
+	if (Metrics::endpoint_fd == -1)
+		return;
+
+	shutdown(Metrics::endpoint_fd, SHUT_RDWR);	// Wakes the blocked accept()
+	if (Metrics::endpoint_thread.joinable())
+		Metrics::endpoint_thread.join();
+	close(Metrics::endpoint_fd);
+	Metrics::endpoint_fd = -1;
+}
+
+void Metrics::endpoint_process(int listen_fd)
+{
+	int client_fd;
+	while ((client_fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC)) >= 0 || errno == EINTR || errno == ECONNABORTED)
+	{
+		if (client_fd < 0)
+			continue;
+
+		// A scraper that stalls mid-request must not hold up the next one for long
+		struct timeval timeout = { 1, 0 };
+		setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+		std::string request;
+		char buffer[512];
+		ssize_t bytes_read;
+		while (request.find("\r\n\r\n") == std::string::npos && request.size() < MAX_REQUEST_SIZE
+			&& (bytes_read = recv(client_fd, buffer, sizeof(buffer), 0)) > 0)
+			request.append(buffer, bytes_read);
+
+		std::string status = "200 OK";
+		std::string body;
+		if (request.compare(0, 4, "GET ") != 0)
+			status = "405 Method Not Allowed";
+		else if (request.compare(4, 9, "/metrics ") != 0 && request.compare(4, 2, "/ ") != 0)
+			status = "404 Not Found";
+		else
+			body = Metrics::return_report();
+
+		std::string response = "HTTP/1.1 " + status + "\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+			"Content-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+		for (std::size_t sent = 0; sent < response.size();)
+		{
+			ssize_t bytes_sent = send(client_fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+			if (bytes_sent <= 0)
+				break;
+			sent += bytes_sent;
+		}
+		close(client_fd);
+	}
+}
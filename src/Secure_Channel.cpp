@@ -0,0 +1,410 @@
+#include "Secure_Channel.hpp"
+#include "Logger.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <linux/tls.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+
+static constexpr uint8_t HANDSHAKE_MAGIC[4] = { 'U', 'N', 'K', 'T' };
+static constexpr uint8_t HANDSHAKE_VERSION = 1;
+static constexpr int HANDSHAKE_TIMEOUT_S = 5;
+
+static constexpr uint32_t SHA256_K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+// Minimal SHA-256, only used for the handshake, so it favours size over speed
+class SHA256
+{
+	private:
+		uint32_t state[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+		uint8_t block[64];
+		std::size_t block_size = 0;
+		uint64_t total_bytes = 0;
+
+		static uint32_t rotate_right(uint32_t value, unsigned count)
+		{
+			return (value >> count) | (value << (32 - count));
+		}
+
+		void compress()
+		{
+			uint32_t w[64];
+			for (unsigned n = 0; n < 16; ++n)
+				w[n] = ((uint32_t)this->block[4 * n] << 24) | ((uint32_t)this->block[4 * n + 1] << 16) | ((uint32_t)this->block[4 * n + 2] << 8) | this->block[4 * n + 3];
+			for (unsigned n = 16; n < 64; ++n)
+			{
+				uint32_t s0 = rotate_right(w[n - 15], 7) ^ rotate_right(w[n - 15], 18) ^ (w[n - 15] >> 3);
+				uint32_t s1 = rotate_right(w[n - 2], 17) ^ rotate_right(w[n - 2], 19) ^ (w[n - 2] >> 10);
+				w[n] = w[n - 16] + s0 + w[n - 7] + s1;
+			}
+
+			uint32_t a = this->state[0], b = this->state[1], c = this->state[2], d = this->state[3];
+			uint32_t e = this->state[4], f = this->state[5], g = this->state[6], h = this->state[7];
+			for (unsigned n = 0; n < 64; ++n)
+			{
+				uint32_t t1 = h + (rotate_right(e, 6) ^ rotate_right(e, 11) ^ rotate_right(e, 25)) + ((e & f) ^ (~e & g)) + SHA256_K[n] + w[n];
+				uint32_t t2 = (rotate_right(a, 2) ^ rotate_right(a, 13) ^ rotate_right(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+				h = g; g = f; f = e; e = d + t1;
+				d = c; c = b; b = a; a = t1 + t2;
+			}
+			this->state[0] += a; this->state[1] += b; this->state[2] += c; this->state[3] += d;
+			this->state[4] += e; this->state[5] += f; this->state[6] += g; this->state[7] += h;
+		}
+
+	public:
+		void update(const uint8_t* data, std::size_t size)
+		{
+			this->total_bytes += size;
+			while (size != 0)
+			{
+				std::size_t chunk = std::min(size, sizeof(this->block) - this->block_size);
+				memcpy(this->block + this->block_size, data, chunk);
+				this->block_size += chunk;
+				data += chunk;
+				size -= chunk;
+				if (this->block_size == sizeof(this->block))
+				{
+					this->compress();
+					this->block_size = 0;
+				}
+			}
+		}
+
+		void finish(uint8_t* digest)
+		{
+			uint64_t total_bits = this->total_bytes * 8;
+			uint8_t padding = 0x80;
+			this->update(&padding, 1);
+			padding = 0;
+			while (this->block_size != 56)
+				this->update(&padding, 1);
+
+			uint8_t length[8];
+			for (unsigned n = 0; n < 8; ++n)
+				length[n] = (uint8_t)(total_bits >> (56 - 8 * n));
+			this->update(length, 8);
+
+			for (unsigned n = 0; n < 8; ++n)
+			{
+				digest[4 * n] = (uint8_t)(this->state[n] >> 24);
+				digest[4 * n + 1] = (uint8_t)(this->state[n] >> 16);
+				digest[4 * n + 2] = (uint8_t)(this->state[n] >> 8);
+				digest[4 * n + 3] = (uint8_t)this->state[n];
+			}
+		}
+};
+
+static bool send_all(int socket_fd, const uint8_t* p_data, std::size_t size)
+{
+	while (size != 0)
+	{
+		ssize_t bytes_sent = send(socket_fd, p_data, size, MSG_NOSIGNAL);
+		if (bytes_sent < 0 && errno == EINTR)
+			continue;
+		else if (bytes_sent <= 0)
+			return false;
+		p_data += bytes_sent;
+		size -= bytes_sent;
+	}
+	return true;
+}
+
+// Reads exactly size bytes; anything after them stays queued for kernel TLS to pick up
+static bool recv_exact(int socket_fd, uint8_t* p_data, std::size_t size)
+{
+	while (size != 0)
+	{
+		ssize_t bytes_read = recv(socket_fd, p_data, size, MSG_WAITALL);
+		if (bytes_read < 0 && errno == EINTR)
+			continue;
+		else if (bytes_read <= 0)
+			return false;
+		p_data += bytes_read;
+		size -= bytes_read;
+	}
+	return true;
+}
+
+static bool digests_match(const uint8_t* digest_a, const uint8_t* digest_b, std::size_t size)
+{
+	uint8_t difference = 0;
+	for (std::size_t n = 0; n < size; ++n)
+		difference |= digest_a[n] ^ digest_b[n];
+	return difference == 0;
+}
+
+static void set_handshake_timeout(int socket_fd, int seconds)
+{
+	// A peer that stalls mid-handshake must not hold the connection forever
+	struct timeval timeout = { seconds, 0 };
+	setsockopt(socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(socket_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+void Secure_Channel::lock_psk()
+{
+	bool prev_state = false;
+	while (!Secure_Channel::in_progress.compare_exchange_strong(prev_state, true, std::memory_order_acq_rel))
+	{
+		Secure_Channel::in_progress.wait(true, std::memory_order_acquire);
+		prev_state = false;
+	}
+}
+
+void Secure_Channel::unlock_psk()
+{
+	Secure_Channel::in_progress.store(false, std::memory_order_release);
+	Secure_Channel::in_progress.notify_all();
+}
+
+void Secure_Channel::hmac_sha256(const uint8_t* key, std::size_t key_size, const uint8_t* data, std::size_t data_size, uint8_t* digest)
+{
+	uint8_t key_block[64] = { 0 };
+	if (key_size > sizeof(key_block))
+	{
+		SHA256 key_hash;
+		key_hash.update(key, key_size);
+		key_hash.finish(key_block);
+	}
+	else
+		memcpy(key_block, key, key_size);
+
+	uint8_t pad[64];
+	uint8_t inner_digest[DIGEST_SIZE];
+
+	SHA256 inner_hash;
+	for (unsigned n = 0; n < sizeof(pad); ++n)
+		pad[n] = key_block[n] ^ 0x36;
+	inner_hash.update(pad, sizeof(pad));
+	inner_hash.update(data, data_size);
+	inner_hash.finish(inner_digest);
+
+	SHA256 outer_hash;
+	for (unsigned n = 0; n < sizeof(pad); ++n)
+		pad[n] = key_block[n] ^ 0x5c;
+	outer_hash.update(pad, sizeof(pad));
+	outer_hash.update(inner_digest, sizeof(inner_digest));
+	outer_hash.finish(digest);
+
+	explicit_bzero(key_block, sizeof(key_block));
+	explicit_bzero(pad, sizeof(pad));
+}
+
+bool Secure_Channel::load_psk(const std::string& path)
+{
+	std::ifstream psk_file(path, std::ios::binary);
+	if (!psk_file.is_open())
+		return false;
+
+	struct stat file_stat;
+	if (stat(path.c_str(), &file_stat) == 0 && (file_stat.st_mode & (S_IRWXG | S_IRWXO)))
+		Logger::log(Logger::WARNING, "%s is accessible by other users, restrict it with chmod 600", path.c_str());
+
+	std::string contents((std::istreambuf_iterator<char>(psk_file)), std::istreambuf_iterator<char>());
+	while (!contents.empty() && isspace((unsigned char)contents.back()))
+		contents.pop_back();
+
+	// Hex text as written by scripts/unikey_generate_psk.sh, otherwise the raw bytes
+	std::vector<uint8_t> key;
+	bool is_hex = !contents.empty() && contents.size() % 2 == 0;
+	for (char digit : contents)
+		is_hex = is_hex && isxdigit((unsigned char)digit);
+	if (is_hex)
+	{
+		for (std::size_t n = 0; n < contents.size(); n += 2)
+			key.push_back((uint8_t)std::stoul(contents.substr(n, 2), nullptr, 16));
+	}
+	else
+		key.assign(contents.begin(), contents.end());
+
+	bool is_set = Secure_Channel::set_psk(key);
+	explicit_bzero(contents.data(), contents.size());
+	explicit_bzero(key.data(), key.size());
+	return is_set;
+}
+
+bool Secure_Channel::set_psk(const std::vector<uint8_t>& key)
+{
+	if (key.size() < MIN_PSK_SIZE)
+	{
+		Logger::log(Logger::ERROR, "Pre-shared key must be at least %zu bytes", MIN_PSK_SIZE);
+		return false;
+	}
+
+	Secure_Channel::lock_psk();
+	explicit_bzero(Secure_Channel::psk.data(), Secure_Channel::psk.size());
+	Secure_Channel::psk = key;
+	Secure_Channel::unlock_psk();
+	return true;
+}
+
+bool Secure_Channel::has_psk()
+{
+	Secure_Channel::lock_psk();
+	bool is_set = !Secure_Channel::psk.empty();
+	Secure_Channel::unlock_psk();
+	return is_set;
+}
+
+std::vector<uint8_t> Secure_Channel::derive_secret(const uint8_t* client_nonce, const uint8_t* server_nonce)
+{
+	static constexpr char LABEL[] = "unikey-ktls-v1";
+
+	uint8_t seed[sizeof(LABEL) - 1 + 2 * NONCE_SIZE];
+	memcpy(seed, LABEL, sizeof(LABEL) - 1);
+	memcpy(seed + sizeof(LABEL) - 1, client_nonce, NONCE_SIZE);
+	memcpy(seed + sizeof(LABEL) - 1 + NONCE_SIZE, server_nonce, NONCE_SIZE);
+
+	std::vector<uint8_t> secret(DIGEST_SIZE);
+	Secure_Channel::lock_psk();
+	Secure_Channel::hmac_sha256(Secure_Channel::psk.data(), Secure_Channel::psk.size(), seed, sizeof(seed), secret.data());
+	Secure_Channel::unlock_psk();
+	return secret;
+}
+
+static void expand_secret(const std::vector<uint8_t>& secret, const char* label, uint8_t* digest)
+{
+	Secure_Channel::hmac_sha256(secret.data(), secret.size(), (const uint8_t*)label, strlen(label), digest);
+}
+
+static bool set_crypto_info(int socket_fd, int direction, const uint8_t* key_block)
+{
+	struct tls12_crypto_info_aes_gcm_128 crypto_info;
+	memset(&crypto_info, 0, sizeof(crypto_info));
+	crypto_info.info.version = TLS_1_2_VERSION;
+	crypto_info.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+	memcpy(crypto_info.key, key_block, TLS_CIPHER_AES_GCM_128_KEY_SIZE);
+	memcpy(crypto_info.salt, key_block + TLS_CIPHER_AES_GCM_128_KEY_SIZE, TLS_CIPHER_AES_GCM_128_SALT_SIZE);
+	memcpy(crypto_info.iv, key_block + TLS_CIPHER_AES_GCM_128_KEY_SIZE + TLS_CIPHER_AES_GCM_128_SALT_SIZE, TLS_CIPHER_AES_GCM_128_IV_SIZE);
+
+	bool is_set = setsockopt(socket_fd, SOL_TLS, direction, &crypto_info, sizeof(crypto_info)) == 0;
+	explicit_bzero(&crypto_info, sizeof(crypto_info));
+	return is_set;
+}
+
+bool Secure_Channel::install_keys(int socket_fd, const char* tx_label, const char* rx_label, const std::vector<uint8_t>& secret)
+{
+	// Each direction gets its own key, so client records and server replies never share a nonce sequence
+	uint8_t tx_block[DIGEST_SIZE];
+	uint8_t rx_block[DIGEST_SIZE];
+	expand_secret(secret, tx_label, tx_block);
+	expand_secret(secret, rx_label, rx_block);
+
+	// The ULP can only be attached once, both directions are keyed on it afterwards
+	bool is_installed = setsockopt(socket_fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) == 0
+		&& set_crypto_info(socket_fd, TLS_TX, tx_block)
+		&& set_crypto_info(socket_fd, TLS_RX, rx_block);
+	if (!is_installed)
+		Logger::log(Logger::ERROR, "Kernel TLS unavailable: %s (is the tls module loaded?)", strerror(errno));
+
+	explicit_bzero(tx_block, sizeof(tx_block));
+	explicit_bzero(rx_block, sizeof(rx_block));
+	return is_installed;
+}
+
+bool Secure_Channel::client_handshake(int socket_fd)
+{
+	if (!Secure_Channel::has_psk())
+	{
+		Logger::log(Logger::ERROR, "Encrypted transport requested without a pre-shared key");
+		return false;
+	}
+
+	uint8_t hello[sizeof(HANDSHAKE_MAGIC) + 1 + NONCE_SIZE];
+	memcpy(hello, HANDSHAKE_MAGIC, sizeof(HANDSHAKE_MAGIC));
+	hello[sizeof(HANDSHAKE_MAGIC)] = HANDSHAKE_VERSION;
+	uint8_t* client_nonce = hello + sizeof(HANDSHAKE_MAGIC) + 1;
+	if (getrandom(client_nonce, NONCE_SIZE, 0) != (ssize_t)NONCE_SIZE)
+		return false;
+
+	set_handshake_timeout(socket_fd, HANDSHAKE_TIMEOUT_S);
+	uint8_t server_reply[NONCE_SIZE + DIGEST_SIZE];
+	if (!send_all(socket_fd, hello, sizeof(hello)) || !recv_exact(socket_fd, server_reply, sizeof(server_reply)))
+		return false;
+
+	std::vector<uint8_t> secret = Secure_Channel::derive_secret(client_nonce, server_reply);
+	uint8_t expected[DIGEST_SIZE];
+	expand_secret(secret, "server finished", expected);
+	if (!digests_match(expected, server_reply + NONCE_SIZE, DIGEST_SIZE))
+	{
+		Logger::log(Logger::ERROR, "Server failed the handshake, pre-shared keys differ");
+		explicit_bzero(secret.data(), secret.size());
+		return false;
+	}
+
+	uint8_t client_finished[DIGEST_SIZE];
+	expand_secret(secret, "client finished", client_finished);
+	bool is_secured = send_all(socket_fd, client_finished, sizeof(client_finished))
+		&& Secure_Channel::install_keys(socket_fd, "client write", "server write", secret);
+	set_handshake_timeout(socket_fd, 0);
+
+	explicit_bzero(secret.data(), secret.size());
+	return is_secured;
+}
+
+bool Secure_Channel::server_handshake(int socket_fd)
+{
+	if (!Secure_Channel::has_psk())
+	{
+		Logger::log(Logger::ERROR, "Encrypted transport requested without a pre-shared key");
+		return false;
+	}
+
+	set_handshake_timeout(socket_fd, HANDSHAKE_TIMEOUT_S);
+	uint8_t hello[sizeof(HANDSHAKE_MAGIC) + 1 + NONCE_SIZE];
+	if (!recv_exact(socket_fd, hello, sizeof(hello))
+		|| memcmp(hello, HANDSHAKE_MAGIC, sizeof(HANDSHAKE_MAGIC)) != 0 || hello[sizeof(HANDSHAKE_MAGIC)] != HANDSHAKE_VERSION)
+		return false;
+	const uint8_t* client_nonce = hello + sizeof(HANDSHAKE_MAGIC) + 1;
+
+	uint8_t server_reply[NONCE_SIZE + DIGEST_SIZE];
+	if (getrandom(server_reply, NONCE_SIZE, 0) != (ssize_t)NONCE_SIZE)
+		return false;
+	std::vector<uint8_t> secret = Secure_Channel::derive_secret(client_nonce, server_reply);
+	expand_secret(secret, "server finished", server_reply + NONCE_SIZE);
+
+	uint8_t client_finished[DIGEST_SIZE];
+	uint8_t expected[DIGEST_SIZE];
+	expand_secret(secret, "client finished", expected);
+	bool is_secured = send_all(socket_fd, server_reply, sizeof(server_reply))
+		&& recv_exact(socket_fd, client_finished, sizeof(client_finished));
+	if (is_secured && !digests_match(expected, client_finished, DIGEST_SIZE))
+	{
+		Logger::log(Logger::ERROR, "Client failed the handshake, pre-shared keys differ");
+		is_secured = false;
+	}
+
+	// Installed before anything else is read, the client's first records may already be queued
+	is_secured = is_secured && Secure_Channel::install_keys(socket_fd, "server write", "client write", secret);
+	set_handshake_timeout(socket_fd, 0);
+
+	explicit_bzero(secret.data(), secret.size());
+	return is_secured;
+}
@@ -0,0 +1,158 @@
+#include "Socket_Address.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <arpa/inet.h>
+#include <linux/vm_sockets.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static constexpr int TCP_UNSENT_LIMIT = 16 * 1024;
+
+static bool parse_port(const std::string& port_str, uint32_t& port)
+{
+	char* p_end = nullptr;
+	unsigned long value = strtoul(port_str.c_str(), &p_end, 10);
+	if (port_str.empty() || *p_end != '\0' || value > UINT32_MAX)
+		return false;
+	port = (uint32_t)value;
+	return true;
+}
+
+bool Socket_Address::parse(const std::string& address_str, uint16_t default_port)
+{
+	this->address = { };
+	this->address_len = 0;
+	this->socket_type = SOCK_STREAM;
+	this->encrypted = false;
+
+	if (address_str.rfind("unix:", 0) == 0)
+	{
+		std::string path = address_str.substr(5);
+		struct sockaddr_un* p_addr = (struct sockaddr_un*)&this->address;
+		if (path.empty() || path.size() >= sizeof(p_addr->sun_path))
+			return false;
+
+		p_addr->sun_family = AF_UNIX;
+		memcpy(p_addr->sun_path, path.data(), path.size());
+		if (path[0] == '@')
+			p_addr->sun_path[0] = '\0';	// Abstract namespace, the length below bounds the name
+		this->address_len = offsetof(struct sockaddr_un, sun_path) + path.size() + ((path[0] == '@') ? 0 : 1);
+		this->socket_type = SOCK_SEQPACKET;
+		return true;
+	}
+	else if (address_str.rfind("vsock:", 0) == 0)
+	{
+		std::string cid_str = address_str.substr(6);
+		uint32_t port = default_port;
+		std::size_t split = cid_str.find(':');
+		if (split != std::string::npos)
+		{
+			if (!parse_port(cid_str.substr(split + 1), port))
+				return false;
+			cid_str.resize(split);
+		}
+
+		uint32_t cid = 0;
+		if (cid_str == "any")
+			cid = VMADDR_CID_ANY;
+		else if (cid_str == "local")
+			cid = VMADDR_CID_LOCAL;
+		else if (cid_str == "host")
+			cid = VMADDR_CID_HOST;
+		else if (!parse_port(cid_str, cid))
+			return false;
+
+		struct sockaddr_vm* p_addr = (struct sockaddr_vm*)&this->address;
+		p_addr->svm_family = AF_VSOCK;
+		p_addr->svm_cid = cid;
+		p_addr->svm_port = port;
+		this->address_len = sizeof(struct sockaddr_vm);
+		return true;
+	}
+
+	this->encrypted = address_str.rfind("tls:", 0) == 0;
+	std::string ip_str = (address_str.rfind("tcp:", 0) == 0 || this->encrypted) ? address_str.substr(4) : address_str;
+	uint32_t port = default_port;
+	std::size_t split = ip_str.find(':');
+	if (split != std::string::npos)
+	{
+		if (!parse_port(ip_str.substr(split + 1), port) || port > UINT16_MAX)
+			return false;
+		ip_str.resize(split);
+	}
+
+	struct sockaddr_in* p_addr = (struct sockaddr_in*)&this->address;
+	p_addr->sin_family = AF_INET;
+	p_addr->sin_port = htons(port);
+	if (inet_pton(AF_INET, ip_str.c_str(), &p_addr->sin_addr) != 1)
+	{
+		this->address = { };
+		return false;
+	}
+	this->address_len = sizeof(struct sockaddr_in);
+	return true;
+}
+
+int Socket_Address::create_socket() const
+{
+	int socket_fd = socket(this->address.ss_family, this->socket_type | SOCK_CLOEXEC, 0);
+	if (socket_fd != -1 && (this->address.ss_family == AF_INET || this->address.ss_family == AF_INET6))
+	{
+		/*
+			Frames are small and latency bound, so Nagle's delay only hurts. Capping
+			the unsent bytes makes a send block early on a slow link, which keeps the
+			backlog in the daemon's queues where key frames can overtake motion.
+			Accepted sockets inherit both from the listening one.
+		*/
+		int enable = 1;
+		int unsent_limit = TCP_UNSENT_LIMIT;
+		setsockopt(socket_fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+		setsockopt(socket_fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &unsent_limit, sizeof(unsent_limit));
+	}
+	return socket_fd;
+}
+
+int Socket_Address::return_family() const
+{
+	return this->address.ss_family;
+}
+
+bool Socket_Address::is_packet_based() const
+{
+	return this->socket_type == SOCK_SEQPACKET;
+}
+
+bool Socket_Address::is_encrypted() const
+{
+	return this->encrypted;
+}
+
+bool Socket_Address::is_valid() const
+{
+	return this->address_len != 0;
+}
+
+const struct sockaddr* Socket_Address::return_sockaddr() const
+{
+	return (const struct sockaddr*)&this->address;
+}
+
+socklen_t Socket_Address::return_sockaddr_len() const
+{
+	return this->address_len;
+}
+
+std::string Socket_Address::return_unix_path() const
+{
+	const struct sockaddr_un* p_addr = (const struct sockaddr_un*)&this->address;
+	if (this->address.ss_family != AF_UNIX || p_addr->sun_path[0] == '\0')
+		return "";
+	return p_addr->sun_path;
+}
@@ -0,0 +1,48 @@
+#include "State_Notifier.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <thread>
+
+void State_Notifier::start(std::function<void(uint32_t)> emitter_function)
+{
+	if (State_Notifier::notifier_thread.joinable())
+		return;
+
+	State_Notifier::emitter = std::move(emitter_function);
+	State_Notifier::notifier_thread = std::thread(State_Notifier::notifier_process);
+}
+
+void State_Notifier::stop()
+{
+	if (!State_Notifier::notifier_thread.joinable())
+		return;
+
+	State_Notifier::mark_changed(STOP_REQUEST);
+	State_Notifier::notifier_thread.join();
+	State_Notifier::pending_states.fetch_and(~STOP_REQUEST, std::memory_order_acq_rel);
+}
+
+void State_Notifier::mark_changed(uint32_t states)
+{
+	// Only the change that finds nothing pending has to wake the notifier
+	if (State_Notifier::pending_states.fetch_or(states, std::memory_order_acq_rel) == 0)
+		State_Notifier::pending_states.notify_one();
+}
+
+void State_Notifier::notifier_process()
+{
+	while (true)
+	{
+		State_Notifier::pending_states.wait(0, std::memory_order_acquire);
+		if (State_Notifier::pending_states.load(std::memory_order_acquire) & STOP_REQUEST)
+			break;
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(COALESCE_INTERVAL_MS));
+		uint32_t states = State_Notifier::pending_states.fetch_and(STOP_REQUEST, std::memory_order_acq_rel) & ~STOP_REQUEST;
+		if (states != 0)
+			State_Notifier::emitter(states);
+	}
+}
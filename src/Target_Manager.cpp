@@ -0,0 +1,465 @@
+#include "Target_Manager.hpp"
+#include "BitField.hpp"
+#include "Clock_Sync.hpp"
+#include "Device.hpp"
+#include "Event_Filter.hpp"
+#include "Flight_Recorder.hpp"
+#include "Frame_Pool.hpp"
+#include "Metrics.hpp"
+#include "State_Notifier.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <stdlib.h>
+#include <thread>
+
+#include <linux/input.h>
+#include <time.h>
+
+void Target_Manager::lock_targets()
+{
+	bool prev_state = false;
+	while (!Target_Manager::in_progress.compare_exchange_strong(prev_state, true, std::memory_order_acq_rel))
+	{
+		Target_Manager::in_progress.wait(true, std::memory_order_acquire);
+		prev_state = false;
+	}
+}
+
+void Target_Manager::unlock_targets()
+{
+	Target_Manager::in_progress.store(false, std::memory_order_release);
+	Target_Manager::in_progress.notify_all();
+}
+
+void Target_Manager::wait_for_senders()
+{
+	while (uint32_t in_flight = Target_Manager::senders_in_flight.load(std::memory_order_acquire))
+	{
+		Target_Manager::senders_in_flight.wait(in_flight, std::memory_order_acquire);
+	}
+}
+
+void Target_Manager::wait_for_probe(unsigned slot)
+{
+	while (Target_Manager::probing_slot.load(std::memory_order_acquire) == slot)
+	{
+		Target_Manager::probing_slot.wait(slot, std::memory_order_acquire);
+	}
+}
+
+// Closing the connection first ends the handshake loop, and fails the sends of one mid-way
+void Target_Manager::close_target(unsigned slot, WiFi_Client* p_client)
+{
+	if (p_client != nullptr)
+		p_client->close_connection();
+	if (Target_Manager::handshake_threads[slot].joinable())
+		Target_Manager::handshake_threads[slot].join();
+	delete p_client;
+}
+
+void Target_Manager::set_handshake_process(void (*handshake_function)(WiFi_Client&))
+{
+	Target_Manager::handshake_process = handshake_function;
+}
+
+int Target_Manager::find_target_slot(const std::string& ip_addr)
+{
+	for (unsigned slot = 0; slot < MAX_TARGETS; ++slot)
+	{
+		if (Target_Manager::targets[slot].load(std::memory_order_acquire) != nullptr && Target_Manager::target_addresses[slot] == ip_addr)
+		{
+			return slot;
+		}
+	}
+	return -1;
+}
+
+int Target_Manager::add_target(const std::string& ip_addr)
+{
+	Target_Manager::lock_targets();
+
+	int slot = Target_Manager::find_target_slot(ip_addr);
+	if (slot < 0)
+	{
+		for (unsigned n = 0; n < MAX_TARGETS && slot < 0; ++n)
+		{
+			if (Target_Manager::targets[n].load(std::memory_order_acquire) == nullptr)
+				slot = n;
+		}
+		if (slot >= 0)
+		{
+			// Connect and handshake in the background so that switching later costs no round trips
+			WiFi_Client* p_client = new WiFi_Client;
+			if (!p_client->set_server_addr(ip_addr.c_str()))
+			{
+				delete p_client;
+				Target_Manager::unlock_targets();
+				return -1;
+			}
+			p_client->connect_to_server();
+
+			Target_Manager::target_addresses[slot] = ip_addr;
+			Target_Manager::target_ready[slot].store(false, std::memory_order_release);
+			Target_Manager::target_clocks[slot].reset();
+			Target_Manager::targets[slot].store(p_client, std::memory_order_release);
+			State_Notifier::mark_changed(State_Notifier::TARGET_CONNECTIONS);
+			if (!Target_Manager::clock_probe_thread.joinable())
+			{
+				Target_Manager::stop_probing.store(false, std::memory_order_release);
+				Target_Manager::clock_probe_thread = std::thread(&Target_Manager::clock_probe_process);
+			}
+
+			// Joined before the client is deleted, see close_target()
+			Target_Manager::handshake_threads[slot] = std::thread([p_client, slot]
+			{
+				// The client reconnects on its own after a dropped link, each new connection is handshaken again
+				while (p_client->wait_until_connected())
+				{
+					if (Target_Manager::handshake_process != nullptr)
+						Target_Manager::handshake_process(*p_client);
+
+					// Frames are only encoded once the handshake is out, so both codecs start from the same state
+					Target_Manager::target_codecs[slot].reset();
+					if (Target_Manager::targets[slot].load(std::memory_order_acquire) == p_client)
+						Target_Manager::target_ready[slot].store(true, std::memory_order_release);
+
+					p_client->wait_until_disconnected();
+					Target_Manager::target_ready[slot].store(false, std::memory_order_release);
+					// A frame encoded against the lost connection must be out before the codec is reset
+					Target_Manager::wait_for_senders();
+				}
+			});
+		}
+	}
+
+	Target_Manager::unlock_targets();
+	return slot;
+}
+
+bool Target_Manager::remove_target(const std::string& ip_addr)
+{
+	Target_Manager::lock_targets();
+
+	int slot = Target_Manager::find_target_slot(ip_addr);
+	if (slot < 0)
+	{
+		Target_Manager::unlock_targets();
+		return false;
+	}
+
+	unsigned active_slot = slot;
+	bool was_active = Target_Manager::active_target.compare_exchange_strong(active_slot, NO_TARGET, std::memory_order_acq_rel);
+
+	// Wait for the sender to drop its reference before the client is destroyed
+	Target_Manager::wait_for_senders();
+	if (was_active)
+	{
+		Target_Manager::release_held_keys(slot);
+		Device::set_timeout_override(0);
+	}
+
+	WiFi_Client* p_client = Target_Manager::targets[slot].exchange(nullptr, std::memory_order_acq_rel);
+	Target_Manager::target_ready[slot].store(false, std::memory_order_release);
+	Target_Manager::wait_for_probe(slot);
+	Target_Manager::target_addresses[slot].clear();
+	Target_Manager::target_profiles[slot].clear();
+	Target_Manager::target_timeouts[slot] = 0;
+	Target_Manager::close_target(slot, p_client);
+	State_Notifier::mark_changed(State_Notifier::TARGET_CONNECTIONS | (was_active ? State_Notifier::ACTIVE_TARGET : 0u));
+
+	Target_Manager::unlock_targets();
+	return true;
+}
+
+bool Target_Manager::switch_to(unsigned slot)
+{
+	if (slot >= MAX_TARGETS)
+		return false;
+
+	Target_Manager::lock_targets();
+
+	WiFi_Client* p_client = Target_Manager::targets[slot].load(std::memory_order_acquire);
+	if (p_client == nullptr)
+	{
+		Target_Manager::unlock_targets();
+		return false;
+	}
+
+	unsigned prev_slot = Target_Manager::active_target.exchange(slot, std::memory_order_acq_rel);
+	// A target without a profile gets events untouched, not the previous target's layout
+	Event_Filter::use_profile(Target_Manager::target_profiles[slot]);
+	Device::set_timeout_override(Target_Manager::target_timeouts[slot]);
+	if (prev_slot != slot)
+		State_Notifier::mark_changed(State_Notifier::ACTIVE_TARGET);
+	if (prev_slot != slot && prev_slot != NO_TARGET)
+	{
+		// A frame already headed to the old target must land before its keys are released
+		Target_Manager::wait_for_senders();
+		// Keys held down during the switch would otherwise stay pressed on the old target
+		Target_Manager::release_held_keys(prev_slot);
+	}
+
+	Target_Manager::unlock_targets();
+	return true;
+}
+
+bool Target_Manager::switch_to(const std::string& ip_addr)
+{
+	int slot = Target_Manager::find_target_slot(ip_addr);
+	return (slot < 0) ? false : Target_Manager::switch_to((unsigned)slot);
+}
+
+bool Target_Manager::switch_to_next()
+{
+	unsigned slot = Target_Manager::active_target.load(std::memory_order_acquire);
+	for (unsigned n = 1; n <= MAX_TARGETS; ++n)
+	{
+		unsigned next_slot = (slot + n) % MAX_TARGETS;
+		if (Target_Manager::targets[next_slot].load(std::memory_order_acquire) != nullptr)
+			return Target_Manager::switch_to(next_slot);
+	}
+	return false;
+}
+
+bool Target_Manager::set_target_profile(const std::string& ip_addr, const std::string& profile_name)
+{
+	Target_Manager::lock_targets();
+
+	int slot = Target_Manager::find_target_slot(ip_addr);
+	if (slot >= 0)
+	{
+		Target_Manager::target_profiles[slot] = profile_name;
+		if (Target_Manager::active_target.load(std::memory_order_acquire) == (unsigned)slot)
+			Event_Filter::use_profile(profile_name);
+	}
+
+	Target_Manager::unlock_targets();
+	return slot >= 0;
+}
+
+bool Target_Manager::set_target_timeout(const std::string& ip_addr, unsigned seconds)
+{
+	Target_Manager::lock_targets();
+
+	int slot = Target_Manager::find_target_slot(ip_addr);
+	if (slot >= 0)
+	{
+		Target_Manager::target_timeouts[slot] = seconds;
+		if (Target_Manager::active_target.load(std::memory_order_acquire) == (unsigned)slot)
+			Device::set_timeout_override(seconds);
+	}
+
+	Target_Manager::unlock_targets();
+	return slot >= 0;
+}
+
+std::string Target_Manager::return_active_target()
+{
+	Target_Manager::lock_targets();
+	unsigned slot = Target_Manager::active_target.load(std::memory_order_acquire);
+	std::string ip_addr = (slot == NO_TARGET) ? "" : Target_Manager::target_addresses[slot];
+	Target_Manager::unlock_targets();
+
+	return ip_addr;
+}
+
+std::map<std::string, bool> Target_Manager::return_target_states()
+{
+	std::map<std::string, bool> target_states;
+	Target_Manager::lock_targets();
+	for (unsigned slot = 0; slot < MAX_TARGETS; ++slot)
+	{
+		WiFi_Client* p_client = Target_Manager::targets[slot].load(std::memory_order_acquire);
+		if (p_client != nullptr)
+			target_states[Target_Manager::target_addresses[slot]] = p_client->server_connection_status();
+	}
+	Target_Manager::unlock_targets();
+
+	return target_states;
+}
+
+void Target_Manager::send_to_active(const void* data, uint64_t unit_size)
+{
+	Target_Manager::senders_in_flight.fetch_add(1, std::memory_order_acq_rel);
+
+	unsigned slot = Target_Manager::active_target.load(std::memory_order_acquire);
+	WiFi_Client* p_client = nullptr;
+	if (slot != NO_TARGET && unit_size == sizeof(struct input_event) && Target_Manager::target_ready[slot].load(std::memory_order_acquire))
+		p_client = Target_Manager::targets[slot].load(std::memory_order_acquire);
+
+	if (p_client != nullptr)
+	{
+		Target_Manager::send_frame(p_client, Target_Manager::target_codecs[slot], Target_Manager::encode_buffer, data);
+		// Read from the kernel to handed to the network, the daemon's own share of the delay
+		uint64_t sent_ns = Clock_Sync::now_ns();
+		uint64_t read_ns = Frame_Pool::return_read_time(data);
+		if (read_ns != 0)	// Frames made up outside a capture thread were never read
+			Target_Manager::send_latency.record(sent_ns - read_ns);
+		Flight_Recorder::record_frame(Flight_Recorder::SEND, data, sent_ns);
+		Metrics::add(Metrics::FRAMES_FORWARDED);
+	}
+	else
+		Metrics::add(Metrics::FRAMES_UNROUTED);
+
+	if (Target_Manager::senders_in_flight.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		Target_Manager::senders_in_flight.notify_all();
+}
+
+std::string Target_Manager::return_latency_report()
+{
+	return Target_Manager::send_latency.report("Send latency (kernel read to network)");
+}
+
+void Target_Manager::close_all()
+{
+	// The probe thread takes the lock itself, so it is stopped first
+	Target_Manager::stop_probing.store(true, std::memory_order_release);
+	if (Target_Manager::clock_probe_thread.joinable())
+		Target_Manager::clock_probe_thread.join();
+
+	Target_Manager::lock_targets();
+
+	Target_Manager::active_target.store(NO_TARGET, std::memory_order_release);
+	Target_Manager::wait_for_senders();
+	for (unsigned slot = 0; slot < MAX_TARGETS; ++slot)
+	{
+		Target_Manager::close_target(slot, Target_Manager::targets[slot].exchange(nullptr, std::memory_order_acq_rel));
+		Target_Manager::target_ready[slot].store(false, std::memory_order_release);
+		Target_Manager::target_addresses[slot].clear();
+		Target_Manager::target_profiles[slot].clear();
+		Target_Manager::target_timeouts[slot] = 0;
+	}
+	Device::set_timeout_override(0);
+	State_Notifier::mark_changed(State_Notifier::ACTIVE_TARGET | State_Notifier::TARGET_CONNECTIONS);
+
+	Target_Manager::unlock_targets();
+}
+
+void Target_Manager::send_frame(WiFi_Client* p_client, Event_Codec& codec, std::vector<uint8_t>& buffer, const void* data)
+{
+	const uint64_t* p_event_count = (const uint64_t*)data;
+	const struct input_event* event_queue = (const struct input_event*)(p_event_count + 1);
+
+	// The send would bail, and an encoder that moved on without the decoder puts every later delta off
+	if (!p_client->server_connection_status())
+		return;
+
+	/*
+		Encoded memory structure, sent as single-byte blocks:
+		{ uint64_t, uint8_t[] }
+	*/
+	uint64_t max_size = sizeof(uint64_t) + Event_Codec::max_encoded_size(*p_event_count);
+	if (buffer.size() < max_size)
+		buffer.resize(max_size);
+
+	// The first event's kernel timestamp stands for the whole frame
+	uint64_t capture_ns = 0;
+	if (*p_event_count != 0)
+		capture_ns = Clock_Sync::to_sender_clock((uint64_t)event_queue[0].input_event_sec * 1000000000ull + (uint64_t)event_queue[0].input_event_usec * 1000);
+
+	*(uint64_t*)buffer.data() = codec.encode(event_queue, *p_event_count, buffer.data() + sizeof(uint64_t), capture_ns);
+	p_client->send_formatted_data(buffer.data(), sizeof(uint8_t));
+}
+
+void Target_Manager::probe_clock(WiFi_Client* p_client, Clock_Estimator& estimator)
+{
+	/*
+		Ping and clock frames share the event frame structure:
+		{ uint64_t, uint8_t[] }
+	*/
+	uint8_t buffer[sizeof(uint64_t) + Event_Codec::max_encoded_size(0)];
+	uint64_t t1 = Clock_Sync::sender_now_ns();
+	*(uint64_t*)buffer = Event_Codec::encode_ping(t1, buffer + sizeof(uint64_t));
+	p_client->send_formatted_data(buffer, sizeof(uint8_t));
+
+	uint64_t pong[3];	// { t1, t2, t3 }
+	do
+	{
+		if (!p_client->receive_reply(pong, sizeof(pong), PROBE_TIMEOUT_MS))
+			return;
+	}
+	while (pong[0] != t1);	// Pongs to probes that timed out earlier are stale
+
+	estimator.add_sample(t1, pong[1], pong[2], Clock_Sync::sender_now_ns());
+
+	int64_t offset_ns = 0;
+	uint64_t rtt_ns = 0;
+	estimator.return_estimate(offset_ns, rtt_ns);
+	*(uint64_t*)buffer = Event_Codec::encode_clock(offset_ns, rtt_ns, buffer + sizeof(uint64_t));
+	p_client->send_formatted_data(buffer, sizeof(uint8_t));
+}
+
+void Target_Manager::clock_probe_process()
+{
+	while (!Target_Manager::stop_probing.load(std::memory_order_acquire))
+	{
+		for (unsigned slot = 0; slot < MAX_TARGETS; ++slot)
+		{
+			// The lock is only held to claim the slot, so a probe waiting on its pong never delays a switch
+			Target_Manager::lock_targets();
+			WiFi_Client* p_client = Target_Manager::targets[slot].load(std::memory_order_acquire);
+			bool is_ready = p_client != nullptr && Target_Manager::target_ready[slot].load(std::memory_order_acquire);
+			if (is_ready)
+				Target_Manager::probing_slot.store(slot, std::memory_order_release);
+			Target_Manager::unlock_targets();
+
+			if (is_ready)
+			{
+				Target_Manager::probe_clock(p_client, Target_Manager::target_clocks[slot]);
+				Target_Manager::probing_slot.store(NO_TARGET, std::memory_order_release);
+				Target_Manager::probing_slot.notify_all();
+			}
+		}
+
+		for (unsigned n = 0; n < PROBE_INTERVAL_MS / 100 && !Target_Manager::stop_probing.load(std::memory_order_acquire); ++n)
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+}
+
+void Target_Manager::release_held_keys(unsigned slot)
+{
+	WiFi_Client* p_client = Target_Manager::targets[slot].load(std::memory_order_acquire);
+	if (p_client == nullptr || !Target_Manager::target_ready[slot].load(std::memory_order_acquire))
+		return;
+
+	const BitField pressed_keys = Device::return_pressed_global_key_states();
+	const std::vector<uint64_t>& pressed = pressed_keys.return_vector();
+	uint64_t count = 0;
+	for (uint64_t bits : pressed)
+		count += __builtin_popcountll(bits);
+	if (count == 0)
+		return;
+
+	/*
+		Memory structure matches the frames produced by Device:
+		{ uint64_t, struct input_event[count] }
+	*/
+	void* p_data = malloc(sizeof(uint64_t) + sizeof(struct input_event) * count);
+	uint64_t* p_event_count = (uint64_t*)p_data;
+	struct input_event* event_queue = (struct input_event*)(p_event_count + 1);
+	*p_event_count = 0;
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);	// The clock captured events are stamped with
+	for (std::size_t word = 0; word < pressed.size(); ++word)
+	{
+		for (uint64_t bits = pressed[word]; bits != 0; bits &= bits - 1)
+		{
+			event_queue[*p_event_count].input_event_sec = now.tv_sec;
+			event_queue[*p_event_count].input_event_usec = now.tv_nsec / 1000;
+			event_queue[*p_event_count].type = EV_KEY;
+			event_queue[*p_event_count].code = word * 64 + __builtin_ctzll(bits);
+			event_queue[*p_event_count].value = 0;
+			++*p_event_count;
+		}
+	}
+
+	// Key events carry no delta state, so a scratch codec keeps the target's codec untouched
+	Event_Codec release_codec;
+	std::vector<uint8_t> release_buffer;
+	Target_Manager::send_frame(p_client, release_codec, release_buffer, p_data);
+	free(p_data);
+}
@@ -0,0 +1,261 @@
+#include "Thread_Policy.hpp"
+#include "Logger.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static pid_t current_tid()
+{
+	return (pid_t)syscall(SYS_gettid);
+}
+
+static std::string trim(const std::string& text)
+{
+	std::size_t begin = text.find_first_not_of(" \t");
+	std::size_t end = text.find_last_not_of(" \t\r");
+	return (begin == std::string::npos) ? "" : text.substr(begin, end - begin + 1);
+}
+
+void Thread_Policy::lock_policies()
+{
+	bool prev_state = false;
+	while (!Thread_Policy::in_progress.compare_exchange_strong(prev_state, true, std::memory_order_acq_rel))
+	{
+		Thread_Policy::in_progress.wait(true, std::memory_order_acquire);
+		prev_state = false;
+	}
+}
+
+void Thread_Policy::unlock_policies()
+{
+	Thread_Policy::in_progress.store(false, std::memory_order_release);
+	Thread_Policy::in_progress.notify_all();
+}
+
+bool Thread_Policy::apply(pid_t tid, const role_policy& policy)
+{
+	static std::atomic_bool warned_rt = false;
+	bool is_applied = true;
+
+	if (policy.has_cpus && sched_setaffinity(tid, sizeof(cpu_set_t), &policy.cpus) < 0)
+	{
+		Logger::log(Logger::ERROR, "Failed to set CPU affinity: %s", strerror(errno));
+		is_applied = false;
+	}
+
+	struct sched_param param;
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = policy.priority;
+	if (sched_setscheduler(tid, policy.policy, &param) < 0)
+	{
+		// Expected when running with only cap_setgid, the thread stays in its current class
+		if (errno != EPERM || !warned_rt.exchange(true))
+			Logger::log(Logger::WARNING, "Failed to set scheduling policy, keeping the default: %s", strerror(errno));
+		is_applied = false;
+	}
+
+	return is_applied;
+}
+
+bool Thread_Policy::parse_role(const std::string& role_name, Role& role)
+{
+	static const char* ROLE_NAMES[ROLE_CNT] = { "capture", "watchdog", "receiver" };
+
+	for (unsigned n = 0; n < ROLE_CNT; ++n)
+	{
+		if (role_name == ROLE_NAMES[n])
+		{
+			role = (Role)n;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool Thread_Policy::set_policy(Role role, const std::string& cpus, const std::string& policy, int priority)
+{
+	if (role >= ROLE_CNT)
+		return false;
+
+	role_policy new_policy = { };
+	CPU_ZERO(&new_policy.cpus);
+
+	// CPU list such as "2,3" or "4-7", empty means every CPU
+	std::stringstream cpu_list(cpus);
+	std::string range;
+	while (std::getline(cpu_list, range, ','))
+	{
+		range = trim(range);
+		if (range.size() == 0)
+			continue;
+
+		unsigned first = 0;
+		unsigned last = 0;
+		std::size_t dash = range.find('-');
+		try
+		{
+			first = std::stoul(range.substr(0, dash));
+			last = (dash == std::string::npos) ? first : std::stoul(range.substr(dash + 1));
+		}
+		catch (const std::exception&)
+		{
+			Logger::log(Logger::ERROR, "Invalid CPU list: %s", cpus.c_str());
+			return false;
+		}
+		if (first > last || last >= CPU_SETSIZE)
+		{
+			Logger::log(Logger::ERROR, "Invalid CPU list: %s", cpus.c_str());
+			return false;
+		}
+		for (unsigned cpu = first; cpu <= last; ++cpu)
+			CPU_SET(cpu, &new_policy.cpus);
+		new_policy.has_cpus = true;
+	}
+	if (!new_policy.has_cpus)
+	{
+		for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)	// Undo any earlier pinning
+			CPU_SET(cpu, &new_policy.cpus);
+		new_policy.has_cpus = true;
+	}
+
+	if (policy == "fifo")
+		new_policy.policy = SCHED_FIFO;
+	else if (policy == "rr")
+		new_policy.policy = SCHED_RR;
+	else if (policy == "other" || policy.size() == 0)
+		new_policy.policy = SCHED_OTHER;
+	else
+	{
+		Logger::log(Logger::ERROR, "Unknown scheduling policy: %s", policy.c_str());
+		return false;
+	}
+	new_policy.priority = std::clamp(priority, sched_get_priority_min(new_policy.policy), sched_get_priority_max(new_policy.policy));
+
+	Thread_Policy::lock_policies();
+	bool is_applied = true;
+	Thread_Policy::policies[role] = new_policy;
+	for (pid_t tid : Thread_Policy::role_threads[role])
+		is_applied &= Thread_Policy::apply(tid, new_policy);
+	Thread_Policy::unlock_policies();
+
+	return is_applied;
+}
+
+bool Thread_Policy::set_policy(const std::string& role_name, const std::string& cpus, const std::string& policy, int priority)
+{
+	Role role;
+	if (!Thread_Policy::parse_role(role_name, role))
+	{
+		Logger::log(Logger::ERROR, "Unknown thread role: %s", role_name.c_str());
+		return false;
+	}
+	return Thread_Policy::set_policy(role, cpus, policy, priority);
+}
+
+bool Thread_Policy::lock_memory(bool is_locked)
+{
+	// Keeps page faults off the event path; needs CAP_IPC_LOCK or a large enough RLIMIT_MEMLOCK
+	if ((is_locked ? mlockall(MCL_CURRENT | MCL_FUTURE) : munlockall()) < 0)
+	{
+		Logger::log(Logger::ERROR, "Failed to %s process memory: %s", is_locked ? "lock" : "unlock", strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+bool Thread_Policy::load_config(const std::string& filepath)
+{
+	/*
+		Config lines are "key = value", '#' starts a comment:
+		<role>.cpus = 2,3			<role>.policy = other | fifo | rr
+		<role>.priority = 1-99		memory.lock = true | false
+	*/
+	std::ifstream config(filepath);
+	if (!config.is_open())
+		return false;
+
+	std::string role_settings[ROLE_CNT][2];	// { cpus, policy }
+	int role_priority[ROLE_CNT] = { 0 };
+	bool is_set[ROLE_CNT] = { false };
+	bool is_valid = true;
+
+	std::string line;
+	while (std::getline(config, line))
+	{
+		line = trim(line.substr(0, line.find('#')));
+		std::size_t equals = line.find('=');
+		if (line.size() == 0 || equals == std::string::npos)
+			continue;
+
+		std::string key = trim(line.substr(0, equals));
+		std::string value = trim(line.substr(equals + 1));
+		std::size_t dot = key.find('.');
+		Role role;
+
+		if (key == "memory.lock")
+			is_valid &= (value == "true") ? Thread_Policy::lock_memory(true) : true;
+		else if (dot != std::string::npos && Thread_Policy::parse_role(key.substr(0, dot), role))
+		{
+			std::string setting = key.substr(dot + 1);
+			is_set[role] = true;
+			if (setting == "cpus")
+				role_settings[role][0] = value;
+			else if (setting == "policy")
+				role_settings[role][1] = value;
+			else if (setting == "priority")
+				role_priority[role] = std::atoi(value.c_str());
+			else
+			{
+				Logger::log(Logger::ERROR, "Unknown config key: %s", key.c_str());
+				is_valid = false;
+			}
+		}
+		else
+		{
+			Logger::log(Logger::ERROR, "Unknown config key: %s", key.c_str());
+			is_valid = false;
+		}
+	}
+
+	for (unsigned n = 0; n < ROLE_CNT; ++n)
+	{
+		if (is_set[n])
+			is_valid &= Thread_Policy::set_policy((Role)n, role_settings[n][0], role_settings[n][1], role_priority[n]);
+	}
+	return is_valid;
+}
+
+void Thread_Policy::enter(Role role)
+{
+	if (role >= ROLE_CNT)
+		return;
+
+	pid_t tid = current_tid();
+	Thread_Policy::lock_policies();
+	Thread_Policy::role_threads[role].push_back(tid);
+	if (Thread_Policy::policies[role].has_cpus || Thread_Policy::policies[role].policy != SCHED_OTHER)
+		Thread_Policy::apply(tid, Thread_Policy::policies[role]);
+	Thread_Policy::unlock_policies();
+}
+
+void Thread_Policy::leave(Role role)
+{
+	if (role >= ROLE_CNT)
+		return;
+
+	pid_t tid = current_tid();
+	Thread_Policy::lock_policies();
+	std::vector<pid_t>& threads = Thread_Policy::role_threads[role];
+	threads.erase(std::remove(threads.begin(), threads.end(), tid), threads.end());
+	Thread_Policy::unlock_policies();
+}
@@ -1,8 +1,11 @@
 #include "Virtual_Device.hpp"
+#include "Logger.hpp"
+#include "Tracepoints.hpp"
 
-#include <iostream>
 #include <linux/input.h>
 #include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 #include "libevdev/libevdev-uinput.h"
 #include "libevdev/libevdev.h"
@@ -20,6 +23,12 @@ static bool check_if_power_button(const struct input_event& ev)
 	return check_if_power_button(ev.type, ev.code);
 }
 
+static bool check_if_key_repeat(unsigned type, int value)
+{
+	// Repeats are generated locally by the kernel, forwarded ones would double them up
+	return type == EV_KEY && value == 2;
+}
+
 Virtual_Device::Virtual_Device()
 {
 	this->init_virt_libevdev();
@@ -71,7 +80,13 @@ void Virtual_Device::create_virt_device()
 	{
 		if (libevdev_uinput_create_from_device(this->dev, LIBEVDEV_UINPUT_OPEN_MANAGED, &this->virt_dev) != 0)
 		{
-			std::cerr << "Creating virtual device failed: " << strerror(errno) << std::endl;
+			Logger::log(Logger::ERROR, "Creating virtual device failed: %s", strerror(errno));
+		}
+		else if (this->repeat_settings[0] != 0)
+		{
+			// uinput has no ioctl for the repeat rate; the input core takes it from EV_REP events
+			libevdev_uinput_write_event(this->virt_dev, EV_REP, REP_DELAY, this->repeat_settings[0]);
+			libevdev_uinput_write_event(this->virt_dev, EV_REP, REP_PERIOD, this->repeat_settings[1]);
 		}
 	}
 }
@@ -95,7 +110,11 @@ void Virtual_Device::enable_codes(const unsigned type, const BitField& enabled_k
 		if (enabled_key_field.contains(code))
 		{
 			libevdev_enable_event_code(this->dev, type, code, NULL);
-			std::cout << "Enabled " << libevdev_event_value_get_name(type, code, 0) << std::endl;
+			if (Logger::is_enabled(Logger::DEBUG))
+			{
+				const char* name = libevdev_event_code_get_name(type, code);
+				Logger::log(Logger::DEBUG, "Enabled %s", (name != nullptr) ? name : "unknown code");
+			}
 		}
 	}
 }
@@ -107,9 +126,52 @@ void Virtual_Device::enable_codes(const unsigned type, const std::vector<uint64_
 	this->enable_codes(type, codes);
 }
 
+void Virtual_Device::enable_abs_axes(const struct abs_axis_info* axis_list, const uint64_t& list_size)
+{
+	this->init_virt_libevdev();
+	if (list_size != 0)
+		libevdev_enable_event_type(this->dev, EV_ABS);
+
+	for (uint64_t n = 0; n < list_size; ++n)
+	{
+		// Axis ranges must match the source, otherwise absolute positions get rescaled
+		libevdev_enable_event_code(this->dev, EV_ABS, axis_list[n].code, &axis_list[n].info);
+		if (Logger::is_enabled(Logger::DEBUG))
+		{
+			const char* name = libevdev_event_code_get_name(EV_ABS, axis_list[n].code);
+			Logger::log(Logger::DEBUG, "Enabled %s", (name != nullptr) ? name : "unknown axis");
+		}
+	}
+}
+
+void Virtual_Device::enable_properties(const BitField& enabled_props)
+{
+	this->init_virt_libevdev();
+	for (unsigned prop = 0; prop < INPUT_PROP_CNT; ++prop)
+	{
+		if (enabled_props.contains(prop))
+			libevdev_enable_property(this->dev, prop);
+	}
+}
+
+void Virtual_Device::enable_repeat(int delay, int period)
+{
+	this->init_virt_libevdev();
+	if (delay <= 0 || period <= 0)
+		return;
+
+	this->repeat_settings[0] = delay;
+	this->repeat_settings[1] = period;
+
+	// With EV_REP set the kernel repeats held keys itself, so no repeat events cross the network
+	libevdev_enable_event_type(this->dev, EV_REP);
+	libevdev_enable_event_code(this->dev, EV_REP, REP_DELAY, &this->repeat_settings[0]);
+	libevdev_enable_event_code(this->dev, EV_REP, REP_PERIOD, &this->repeat_settings[1]);
+}
+
 void Virtual_Device::write_event(const struct input_event& ev)
 {
-	if (check_if_power_button(ev))
+	if (check_if_power_button(ev) || check_if_key_repeat(ev.type, ev.value))
 		return;
 
 	this->create_virt_device();
@@ -122,22 +184,65 @@ void Virtual_Device::write_event(const struct input_event* ev_list, const uint64
 	this->create_virt_device();
 	for (uint64_t n = 0; n < list_size; ++n)
 	{
-		if (check_if_power_button(ev_list[n]) == false)
+		if (check_if_power_button(ev_list[n]) == false && check_if_key_repeat(ev_list[n].type, ev_list[n].value) == false)
 			libevdev_uinput_write_event(this->virt_dev, ev_list[n].type, ev_list[n].code, ev_list[n].value);
 	}
 }
 
 void Virtual_Device::write_event(unsigned type, unsigned code, int value)
 {
-	if (check_if_power_button(type, code))
+	if (check_if_power_button(type, code) || check_if_key_repeat(type, value))
 		return;
 
 	this->create_virt_device();
 	libevdev_uinput_write_event(this->virt_dev, type, code, value);
 }
 
+void Virtual_Device::set_io_engine(IO_Engine* p_engine)
+{
+	// The engine has to be flushed before it is swapped out or the device goes away
+	if (this->io_engine != nullptr)
+		this->io_engine->flush();
+	this->io_engine = p_engine;
+}
+
+// Writes the frame followed by SYN_REPORT with a single write, or queues it on the I/O engine
+void Virtual_Device::write_frame(const struct input_event* ev_list, uint64_t list_size)
+{
+	this->create_virt_device();
+	if (this->virt_dev == nullptr)
+		return;
+
+	this->frame_buffer.clear();
+	for (uint64_t n = 0; n < list_size; ++n)
+	{
+		if (check_if_power_button(ev_list[n]) == false && check_if_key_repeat(ev_list[n].type, ev_list[n].value) == false)
+		{
+			struct input_event ev = { };	// The kernel stamps uinput events itself
+			ev.type = ev_list[n].type;
+			ev.code = ev_list[n].code;
+			ev.value = ev_list[n].value;
+			this->frame_buffer.push_back(ev);
+		}
+	}
+	struct input_event syn_report = { };
+	syn_report.type = EV_SYN;
+	syn_report.code = SYN_REPORT;
+	this->frame_buffer.push_back(syn_report);
+
+	struct iovec iov = { this->frame_buffer.data(), sizeof(struct input_event) * this->frame_buffer.size() };
+	int uinput_fd = libevdev_uinput_get_fd(this->virt_dev);
+	if (this->io_engine != nullptr)
+		this->io_engine->write(uinput_fd, &iov, 1);
+	else
+		writev(uinput_fd, &iov, 1);
+	TRACEPOINT(frame_written, ev_list, list_size);
+}
+
 void Virtual_Device::clear()
 {
+	if (this->io_engine != nullptr)
+		this->io_engine->flush();
 	if (this->virt_dev != nullptr)
 	{
 		libevdev_uinput_destroy(this->virt_dev);
@@ -148,4 +253,6 @@ void Virtual_Device::clear()
 		libevdev_free(this->dev);
 		this->dev = nullptr;
 	}
+	this->repeat_settings[0] = 0;
+	this->repeat_settings[1] = 0;
 }
\ No newline at end of file
@@ -1,11 +1,26 @@
 #include "WiFi_Client.hpp"
+#include "Metrics.hpp"
+#include "Secure_Channel.hpp"
+#include "State_Notifier.hpp"
+#include "Tracepoints.hpp"
 
 #include <atomic>
+#include <cerrno>
 #include <chrono>
 #include <cstdint>
 
 #include <thread>
+#include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
+#include <sys/time.h>
+
+// Bounds a blocking connect(), zero blocks without limit again
+static void set_send_timeout(int socket_fd, int timeout_ms)
+{
+	struct timeval timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
+	setsockopt(socket_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
 
 WiFi_Client::WiFi_Client(const char* ip_addr, uint16_t port_num)
 {
@@ -23,79 +38,232 @@ WiFi_Client::~WiFi_Client()
 	this->close_connection();
 }
 
-void WiFi_Client::set_server_addr(const char* ip_addr, uint16_t port_num)
+bool WiFi_Client::set_server_addr(const char* address, uint16_t port_num)
 {
-	this->server_addr = { .sin_family = AF_INET, .sin_port = htons(port_num) };
-	inet_pton(AF_INET, ip_addr, &(this->server_addr.sin_addr));
+	// See Socket_Address for the accepted unix:, vsock: and tcp: syntax
+	return this->server_addr.parse(address, port_num);
 }
 
 bool WiFi_Client::server_connection_status() const
 {
-	return this->connected_to_server.load(std::memory_order_acquire);
+	return this->connection_state.load(std::memory_order_acquire) == CONNECTED;
+}
+
+void WiFi_Client::lock_send() const
+{
+	// A partially sent message is resumed by the same sender, so concurrent senders must not interleave
+	bool prev_state = false;
+	while (!this->is_sending.compare_exchange_weak(prev_state, true, std::memory_order_acquire))
+	{
+		this->is_sending.wait(true, std::memory_order_relaxed);
+		prev_state = false;
+	}
+}
+
+void WiFi_Client::unlock_send() const
+{
+	this->is_sending.store(false, std::memory_order_release);
+	this->is_sending.notify_one();
+}
+
+void WiFi_Client::send_message(struct iovec* p_iov, int iov_count) const
+{
+	// One sendmsg() per message, which packet-based transports deliver as a single record
+	struct msghdr message = { };
+	message.msg_iov = p_iov;
+	message.msg_iovlen = iov_count;
+
+	while (message.msg_iovlen != 0)
+	{
+		ssize_t bytes_sent = sendmsg(this->client_socket, &message, MSG_NOSIGNAL);
+		if (bytes_sent < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			Metrics::add(Metrics::CLIENT_SEND_FAILURES);
+			this->mark_connection_lost();	// The connect thread picks it up again
+			return;
+		}
+
+		// Stream transports may take part of the message, resume where they stopped
+		while (message.msg_iovlen != 0 && (std::size_t)bytes_sent >= message.msg_iov->iov_len)
+		{
+			bytes_sent -= message.msg_iov->iov_len;
+			++message.msg_iov;
+			--message.msg_iovlen;
+		}
+		if (message.msg_iovlen != 0)
+		{
+			message.msg_iov->iov_base = (uint8_t*)message.msg_iov->iov_base + bytes_sent;
+			message.msg_iov->iov_len -= bytes_sent;
+		}
+	}
+}
+
+void WiFi_Client::mark_connection_lost() const
+{
+	// Only a live connection is handed back to the connect thread, a closed one stays closed
+	uint8_t prev_state = CONNECTED;
+	if (this->connection_state.compare_exchange_strong(prev_state, CONNECTING, std::memory_order_acq_rel))
+	{
+		this->connection_state.notify_all();
+		State_Notifier::mark_changed(State_Notifier::TARGET_CONNECTIONS);
+	}
 }
 
 void WiFi_Client::send_formatted_data(const void* formatted_data, uint64_t data_unit_size) const
 {
 	// Data should be formatted in the form of (uint64_t, struct[])
-	if (!this->connected_to_server.load(std::memory_order_acquire)) return;
+	if (this->connection_state.load(std::memory_order_acquire) != CONNECTED) return;
 	else if (!(formatted_data || data_unit_size))
 	{
-		send(this->client_socket, &data_unit_size, sizeof(uint64_t), 0);
+		struct iovec iov[1] = { { &data_unit_size, sizeof(uint64_t) } };
+		this->lock_send();
+		this->send_message(iov, 1);
+		this->unlock_send();
 	}
 	else if (formatted_data == nullptr) return;
 	else
 	{
-		send(this->client_socket, &data_unit_size, sizeof(uint64_t), 0);
-		send(this->client_socket, formatted_data, sizeof(uint64_t) + *(uint64_t*)formatted_data * data_unit_size, 0);
+		uint64_t frame_bytes = sizeof(uint64_t) + *(const uint64_t*)formatted_data * data_unit_size;
+		struct iovec iov[2] = {
+			{ &data_unit_size, sizeof(uint64_t) },
+			{ (void*)formatted_data, frame_bytes }
+		};
+		this->lock_send();
+		this->send_message(iov, 2);
+		this->unlock_send();
+		TRACEPOINT(frame_sent, this->client_socket, frame_bytes);
 	}
 }
 
 void WiFi_Client::send_unformatted_data(const void* data, uint64_t data_unit_size, uint64_t length) const
 {
-	if (!this->connected_to_server.load(std::memory_order_acquire)) return;
+	if (this->connection_state.load(std::memory_order_acquire) != CONNECTED) return;
 	else if (!(data || data_unit_size || length))
 	{
-		send(this->client_socket, &data_unit_size, sizeof(uint64_t), 0);
+		struct iovec iov[1] = { { &data_unit_size, sizeof(uint64_t) } };
+		this->lock_send();
+		this->send_message(iov, 1);
+		this->unlock_send();
 	}
-	else if (data == nullptr) return;
-	else
+	else if (data == nullptr && length != 0) return;
+	else	// An empty list is still sent with its zero length, the receiving side reads one message per list
 	{
-		send(this->client_socket, &data_unit_size, sizeof(uint64_t), 0);
-		send(this->client_socket, &length, sizeof(uint64_t), 0);
-		send(this->client_socket, data, data_unit_size * length, 0);
+		struct iovec iov[3] = {
+			{ &data_unit_size, sizeof(uint64_t) },
+			{ &length, sizeof(uint64_t) },
+			{ (void*)data, data_unit_size * length }
+		};
+		this->lock_send();
+		this->send_message(iov, 3);
+		this->unlock_send();
 	}
 }
 
-void WiFi_Client::connect_to_server()
+// Reads exactly size bytes sent back by the server, false on timeout or error
+bool WiFi_Client::receive_reply(void* p_buffer, uint64_t size, int timeout_ms) const
 {
-	if (this->client_socket == -1)
+	if (this->connection_state.load(std::memory_order_acquire) != CONNECTED)
+		return false;
+
+	uint8_t* p_bytes = (uint8_t*)p_buffer;
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+	while (size != 0)
 	{
-		this->client_socket = socket(AF_INET, SOCK_STREAM, 0);
+		int remaining_ms = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+		struct pollfd pfd = { this->client_socket, POLLIN, 0 };
+		if (remaining_ms < 0 || poll(&pfd, 1, remaining_ms) <= 0)
+			return false;
+
+		ssize_t bytes_read = recv(this->client_socket, p_bytes, size, MSG_DONTWAIT);
+		if (bytes_read == 0 || (bytes_read < 0 && errno != EAGAIN && errno != EINTR))
+			this->mark_connection_lost();
+		if (bytes_read <= 0)
+			return false;
+		p_bytes += bytes_read;
+		size -= bytes_read;
 	}
+	return true;
+}
 
-	std::thread connecting_thread([&] {
-		uint8_t fail_count = 0;
+// Swapped in at the same descriptor number, so a shutdown from close_connection() never hits an unrelated file
+void WiFi_Client::replace_socket()
+{
+	int socket_fd = this->server_addr.create_socket();
+	if (socket_fd == -1)
+		return;
+
+	// A sender part way through a message must not resume it on the new connection
+	this->lock_send();
+	dup3(socket_fd, this->client_socket, O_CLOEXEC);
+	this->unlock_send();
+	close(socket_fd);
+}
+
+void WiFi_Client::connect_process()
+{
+	uint8_t fail_count = 0;
+
+	while (this->connection_state.load(std::memory_order_acquire) != CLOSED)
+	{
+		if (fail_count == 5)
+		{
+			fail_count = 0;
+			// Slept in steps, close_connection() waits for this thread
+			for (unsigned n = 0; n < 10 && this->connection_state.load(std::memory_order_acquire) != CLOSED; ++n)
+				std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			continue;
+		}
 
-		while (this->client_socket != -1)
+		set_send_timeout(this->client_socket, CONNECT_TIMEOUT_MS);
+		if (connect(this->client_socket, this->server_addr.return_sockaddr(), this->server_addr.return_sockaddr_len()) < 0)
 		{
-			if (fail_count == 5)
-			{
-				fail_count = 0;
-				std::this_thread::sleep_for(std::chrono::seconds(1));
-			}
-			else if (connect(this->client_socket, (struct sockaddr*)&this->server_addr, sizeof(this->server_addr)) < 0)
-			{
-				++fail_count;
-			}
-			else
-			{
-				this->connected_to_server.store(true, std::memory_order_release);
-				this->connected_to_server.notify_all();
-				this->connected_to_server.wait(true, std::memory_order_acquire);
-			}
+			// A connect that timed out is still pending on the old socket
+			this->replace_socket();
+			++fail_count;
+			continue;
 		}
-	});
-	connecting_thread.detach();
+		set_send_timeout(this->client_socket, 0);
+
+		if (this->server_addr.is_encrypted() && !Secure_Channel::client_handshake(this->client_socket))
+		{
+			// A connected socket cannot connect again, start over with a fresh one
+			this->replace_socket();
+			fail_count = 5;	// Back off, a key mismatch will not fix itself right away
+			continue;
+		}
+
+		uint8_t prev_state = CONNECTING;
+		if (!this->connection_state.compare_exchange_strong(prev_state, CONNECTED, std::memory_order_acq_rel))
+			break;	// Closed while connecting
+		Metrics::add(Metrics::CLIENT_CONNECTS);
+		this->connection_state.notify_all();
+		State_Notifier::mark_changed(State_Notifier::TARGET_CONNECTIONS);
+
+		// A failed send or receive hands the connection back, see mark_connection_lost()
+		this->connection_state.wait(CONNECTED, std::memory_order_acquire);
+		if (this->connection_state.load(std::memory_order_acquire) != CLOSED)
+			this->replace_socket();
+	}
+}
+
+void WiFi_Client::connect_to_server()
+{
+	// Starting over joins the previous connect thread first
+	if (this->connecting_thread.joinable())
+		this->close_connection();
+
+	this->client_socket = this->server_addr.create_socket();
+	if (this->client_socket == -1)
+	{
+		this->connection_state.store(CLOSED, std::memory_order_release);
+		this->connection_state.notify_all();
+		return;
+	}
+
+	this->connection_state.store(CONNECTING, std::memory_order_release);
+	this->connecting_thread = std::thread(&WiFi_Client::connect_process, this);
 }
 
 void WiFi_Client::connect_to_server(const char* ip_addr, uint16_t port_num)
@@ -104,27 +272,36 @@ void WiFi_Client::connect_to_server(const char* ip_addr, uint16_t port_num)
 	this->connect_to_server();
 }
 
-void WiFi_Client::wait_until_connected()
+bool WiFi_Client::wait_until_connected() const
+{
+	uint8_t state;
+	while ((state = this->connection_state.load(std::memory_order_acquire)) == CONNECTING)
+		this->connection_state.wait(CONNECTING, std::memory_order_acquire);
+	return state == CONNECTED;
+}
+
+void WiFi_Client::wait_until_disconnected() const
 {
-	this->connected_to_server.wait(false, std::memory_order_acquire);
+	while (this->connection_state.load(std::memory_order_acquire) == CONNECTED)
+		this->connection_state.wait(CONNECTED, std::memory_order_acquire);
 }
 
 void WiFi_Client::close_connection()
 {
+	uint8_t prev_state = this->connection_state.exchange(CLOSED, std::memory_order_acq_rel);
+	this->connection_state.notify_all();
+
+	// Wakes a connect thread blocked on the socket, and a send stuck on a stalled link
+	if (this->client_socket != -1)
+		shutdown(this->client_socket, SHUT_RDWR);
+	if (this->connecting_thread.joinable())
+		this->connecting_thread.join();
+
 	if (this->client_socket != -1)
 	{
 		close(this->client_socket);
 		this->client_socket = -1;
-
-		if (this->connected_to_server.load(std::memory_order_acquire) == true)
-		{
-			this->connected_to_server.store(false, std::memory_order_release);
-			this->connected_to_server.notify_one();
-		}
-		else
-		{
-			this->connected_to_server.store(true, std::memory_order_release);
-			this->connected_to_server.notify_all();
-		}
 	}
+	if (prev_state == CONNECTED)
+		State_Notifier::mark_changed(State_Notifier::TARGET_CONNECTIONS);
 }
\ No newline at end of file
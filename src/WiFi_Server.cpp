@@ -1,28 +1,41 @@
 #include "WiFi_Server.hpp"
+#include "Metrics.hpp"
+#include "Secure_Channel.hpp"
+#include "Tracepoints.hpp"
 
+#include <algorithm>
 #include <atomic>
+#include <cerrno>
 #include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <stdlib.h>
+#include <string>
 #include <thread>
 
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
+// Larger than any record a client can queue with the default socket buffer limits
+static constexpr std::size_t MAX_RECORD_SIZE = 256 * 1024;
+
 WiFi_Server::WiFi_Server()
 {
-	this->server_addr.sin_family = AF_INET;
-	this->server_addr.sin_port = 0;
-	this->server_addr.sin_addr.s_addr = INADDR_ANY;
 }
 
 WiFi_Server::WiFi_Server(uint16_t port_num)
 {
-	this->server_addr.sin_family = AF_INET;
-	this->server_addr.sin_addr.s_addr = INADDR_ANY;
-	
 	this->init_server(port_num);
 }
 
+WiFi_Server::WiFi_Server(const char* address)
+{
+	this->init_server(address);
+}
+
 WiFi_Server::~WiFi_Server()
 {
 	if (this->client_socket != -1)
@@ -33,16 +46,36 @@ WiFi_Server::~WiFi_Server()
 }
 
 const WiFi_Server& WiFi_Server::init_server(uint16_t port_num)
+{
+	return this->init_server(("tcp:0.0.0.0:" + std::to_string(port_num)).c_str());
+}
+
+const WiFi_Server& WiFi_Server::init_server(const char* address)
 {
 	if (this->is_connected.load(std::memory_order_acquire))
 		return *this;
 
 	if (this->server_socket != -1)
+	{
 		close(this->server_socket);
+		this->server_socket = -1;
+	}
+
+	// See Socket_Address for the accepted unix:, vsock: and tcp: syntax
+	if (!this->server_addr.parse(address))
+	{
+		fprintf(stderr, "Invalid Server Address: %s\n", address);
+		return *this;
+	}
+
+	// A socket file left behind by a previous run would make bind() fail; anything else at the path is left alone
+	std::string unix_path = this->server_addr.return_unix_path();
+	struct stat path_info;
+	if (!unix_path.empty() && lstat(unix_path.c_str(), &path_info) == 0 && S_ISSOCK(path_info.st_mode))
+		unlink(unix_path.c_str());
 
-	this->server_socket = socket(AF_INET, SOCK_STREAM, 0);
-	this->server_addr.sin_port = htons(port_num);
-	if (bind(this->server_socket, (struct sockaddr*)&this->server_addr, sizeof(this->server_addr)) < 0)
+	this->server_socket = this->server_addr.create_socket();
+	if (bind(this->server_socket, this->server_addr.return_sockaddr(), this->server_addr.return_sockaddr_len()) < 0)
 	{
 		perror("Bind Failed");
 		return *this;
@@ -60,17 +93,21 @@ const WiFi_Server& WiFi_Server::begin_listening()
 	}
 	std::thread listen_for_client([&]
 	{
-		socklen_t addr_len = sizeof(this->server_addr);
-		
-		if ((this->client_socket = accept(this->server_socket, (struct sockaddr*)&this->server_addr, &addr_len)) < 0)
+		while ((this->client_socket = accept4(this->server_socket, nullptr, nullptr, SOCK_CLOEXEC)) >= 0)
 		{
-			perror("Client Connection Not Accepted");
-		}
-		else
-		{
-			this->is_connected.store(true, std::memory_order_release);
-			this->is_connected.notify_all();
+			if (!this->server_addr.is_encrypted() || Secure_Channel::server_handshake(this->client_socket))
+			{
+				Metrics::add(Metrics::SERVER_CONNECTIONS);
+				this->is_connected.store(true, std::memory_order_release);
+				this->is_connected.notify_all();
+				return;
+			}
+
+			// Keep listening for a client that knows the pre-shared key
+			close(this->client_socket);
+			this->client_socket = -1;
 		}
+		perror("Client Connection Not Accepted");
 	});
 	listen_for_client.detach();
 
@@ -88,32 +125,115 @@ bool WiFi_Server::is_connected_to_client() const
 	return this->is_connected.load(std::memory_order_acquire);
 }
 
-void* WiFi_Server::read_sent_data(void* p_data)
-{	
-	// Define a function that guarantees packet delivery of size min_bytes
-	ssize_t (*recv_all)(int, void*, ssize_t, int) = [](int __fd, void* __buf, ssize_t min_bytes, int __flags)
+bool WiFi_Server::has_buffered_data() const
+{
+	return this->buffered_offset != this->buffered_size;
+}
+
+// Whether the next read_sent_data_packet() is served from the buffer without touching the socket
+bool WiFi_Server::has_buffered_record() const
+{
+	const uint8_t* p_bytes = this->receive_buffer.data() + this->buffered_offset;
+	std::size_t available = this->buffered_size - this->buffered_offset;
+	uint64_t header[2];	// { block size, block count }, a zero block size alone asks to close
+
+	if (this->blocks_left.load(std::memory_order_acquire) != 0 || available < sizeof(uint64_t))
+		return false;
+	memcpy(&header[0], p_bytes, sizeof(uint64_t));
+	if (header[0] == 0)
+		return true;
+	if (available < sizeof(header))
+		return false;
+	memcpy(&header[1], p_bytes + sizeof(uint64_t), sizeof(uint64_t));
+	return header[1] <= (available - sizeof(header)) / header[0];
+}
+
+// Deadline on CLOCK_MONOTONIC; returns false if it passed with nothing to read
+bool WiFi_Server::wait_for_data(uint64_t deadline_ns) const
+{
+	if (this->has_buffered_data())
+		return true;
+
+	struct pollfd pfd;
+	pfd.fd = this->client_socket;
+	pfd.events = POLLIN;
+	int poll_value;
+	do
+	{
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		uint64_t now_ns = (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+		uint64_t timeout_ns = (deadline_ns > now_ns) ? deadline_ns - now_ns : 0;
+		struct timespec timeout = { (time_t)(timeout_ns / 1000000000), (long)(timeout_ns % 1000000000) };
+		poll_value = ppoll(&pfd, 1, &timeout, nullptr);
+	} while (poll_value < 0 && errno == EINTR);
+
+	return poll_value != 0;	// Errors and hang-ups are left for the next read to report
+}
+
+ssize_t WiFi_Server::receive(void* p_buffer, std::size_t length)
+{
+	/*
+		Take in as much as the socket has and hand it out in as many pieces as
+		asked for, so a header and its payload usually cost a single recv().
+		Packet-based transports have to be read a whole record at a time anyway.
+	*/
+	bool is_packet_based = this->server_addr.is_packet_based();
+	if (this->buffered_offset == this->buffered_size)
 	{
-		uint8_t* p_buffer = (uint8_t*)__buf;
-		ssize_t bytes_read = 0;
-		ssize_t recv_value = 0;
+		if (!is_packet_based && length >= MAX_RECORD_SIZE)
+			return recv(this->client_socket, p_buffer, length, 0);	// Large reads go straight to the caller
+
+		if (this->receive_buffer.empty())
+			this->receive_buffer.resize(MAX_RECORD_SIZE);
 
-		while (bytes_read < min_bytes)
+		ssize_t received;
+		do
 		{
-			if ((recv_value = recv(__fd, p_buffer + bytes_read, min_bytes - bytes_read, __flags)) > 0)
-				bytes_read += recv_value;
-			else
-				return recv_value;
-		}
-		return min_bytes;
-	};
+			received = recv(this->client_socket, this->receive_buffer.data(), MAX_RECORD_SIZE, is_packet_based ? MSG_TRUNC : 0);
+		} while (received < 0 && errno == EINTR);
+
+		this->buffered_offset = 0;
+		this->buffered_size = 0;
+		if (received <= 0)	// Closed or failed
+			return received;
+		else if ((std::size_t)received > MAX_RECORD_SIZE)	// Truncated record, the stream can no longer be trusted
+			return -1;
+		this->buffered_size = received;
+	}
+
+	std::size_t bytes_copied = std::min(length, this->buffered_size - this->buffered_offset);
+	memcpy(p_buffer, this->receive_buffer.data() + this->buffered_offset, bytes_copied);
+	this->buffered_offset += bytes_copied;
+	return bytes_copied;
+}
+
+// Guarantees delivery of min_bytes, or returns what the failing receive did
+ssize_t WiFi_Server::receive_all(void* p_buffer, std::size_t min_bytes)
+{
+	uint8_t* p_bytes = (uint8_t*)p_buffer;
+	std::size_t bytes_read = 0;
+	ssize_t recv_value = 0;
+
+	while (bytes_read < min_bytes)
+	{
+		if ((recv_value = this->receive(p_bytes + bytes_read, min_bytes - bytes_read)) > 0)
+			bytes_read += recv_value;
+		else
+			return recv_value;
+	}
+	return min_bytes;
+}
 
+void* WiFi_Server::read_sent_data(void* p_data)
+{	
 	if (this->is_connected.load(std::memory_order_acquire))
 	{
 		uint64_t bytes = 0;
 
 		if (this->blocks_left.load(std::memory_order_acquire) == 0)	// If previous recv was incomplete
 		{
-			if (recv_all(this->client_socket, &bytes, sizeof(bytes), 0) <= 0)	// Error or closed connection
+			if (this->receive_all(&bytes, sizeof(bytes)) <= 0)	// Error or closed connection
 			{
 				return nullptr;
 			}
@@ -125,7 +245,7 @@ void* WiFi_Server::read_sent_data(void* p_data)
 			else
 			{
 				this->block_size.store(bytes, std::memory_order_release);	// First recv_all returns size of a single block
-				recv_all(this->client_socket, &bytes, sizeof(bytes), 0);	// Second recv_all returns how many blocks
+				this->receive_all(&bytes, sizeof(bytes));	// Second recv_all returns how many blocks
 				this->blocks_left.store(bytes, std::memory_order_release);
 			}
 		}
@@ -155,7 +275,7 @@ void* WiFi_Server::read_sent_data(void* p_data)
 		uint64_t bytes_read = 0;
 		do	// Loop until the last memory block in the buffer is atomically received
 		{
-			ssize_t received = recv(this->client_socket, p_data_buffer, total_bytes_remaining() - bytes_read, 0);
+			ssize_t received = this->receive(p_data_buffer, total_bytes_remaining() - bytes_read);
 			if (received <= 0)
 			{
 				/*
@@ -183,29 +303,13 @@ void* WiFi_Server::read_sent_data(void* p_data)
 
 void* WiFi_Server::read_sent_data_packet(void* p_data)
 {
-	ssize_t (*recv_all)(int, void*, ssize_t, int) = [](int __fd, void* __buf, ssize_t min_bytes, int __flags)
-	{
-		uint8_t* p_buffer = (uint8_t*)__buf;
-		ssize_t bytes_read = 0;
-		ssize_t recv_value = 0;
-
-		while (bytes_read < min_bytes)
-		{
-			if ((recv_value = recv(__fd, p_buffer + bytes_read, min_bytes - bytes_read, __flags)) > 0)
-				bytes_read += recv_value;
-			else
-				return recv_value;
-		}
-		return min_bytes;
-	};
-
 	if (this->is_connected.load(std::memory_order_acquire))
 	{
 		uint64_t bytes = 0;
 
 		if (this->blocks_left.load(std::memory_order_acquire) == 0)	// If previous recv was incomplete
 		{
-			if (recv_all(this->client_socket, &bytes, sizeof(bytes), 0) <= 0)	// Error or closed connection
+			if (this->receive_all(&bytes, sizeof(bytes)) <= 0)	// Error or closed connection
 			{
 				return nullptr;
 			}
@@ -217,7 +321,7 @@ void* WiFi_Server::read_sent_data_packet(void* p_data)
 			else
 			{
 				this->block_size.store(bytes, std::memory_order_release);	// First recv_all returns size of a single block
-				recv_all(this->client_socket, &bytes, sizeof(bytes), 0);	// Second recv_all returns how many blocks
+				this->receive_all(&bytes, sizeof(bytes));	// Second recv_all returns how many blocks
 				this->blocks_left.store(bytes, std::memory_order_release);
 			}
 		}
@@ -245,9 +349,9 @@ void* WiFi_Server::read_sent_data_packet(void* p_data)
 		*/
 		uint8_t* p_data_buffer = (uint8_t*)(1 + (uint64_t*)p_data);	
 		uint64_t bytes_read = 0;
-		do	// Loop until the last memory block in the buffer is atomically received
+		while (bytes_read != total_bytes_remaining())	// Loop until every block is received (an empty message has none)
 		{
-			ssize_t received = recv(this->client_socket, p_data_buffer, total_bytes_remaining() - bytes_read, 0);
+			ssize_t received = this->receive(p_data_buffer, total_bytes_remaining() - bytes_read);
 			if (received <= 0)
 			{
 				/*
@@ -260,18 +364,36 @@ void* WiFi_Server::read_sent_data_packet(void* p_data)
 
 			bytes_read += received;	// Count total bytes read
 			p_data_buffer += received;	// Shift buffer memory location over
-		} while (bytes_read != total_bytes_remaining());
+		}
 
 		// Set the first 8 bytes of p_data to be how many data blocks were read
 		*(uint64_t*)p_data = (uint64_t)(bytes_read / this->block_size.load(std::memory_order_acquire));
 
 		this->blocks_left.store(0, std::memory_order_release);
 		this->block_size.store(0, std::memory_order_release);
+		TRACEPOINT(frame_read, p_data, bytes_read);
 	}
 
 	return p_data;
 }
 
+// Sends bytes back to the client outside of the framed protocol, e.g. answers to pings
+bool WiFi_Server::send_reply(const void* p_data, uint64_t size)
+{
+	const uint8_t* p_bytes = (const uint8_t*)p_data;
+	while (size != 0)
+	{
+		ssize_t bytes_sent = send(this->client_socket, p_bytes, size, MSG_NOSIGNAL);
+		if (bytes_sent < 0 && errno == EINTR)
+			continue;
+		else if (bytes_sent <= 0)
+			return false;
+		p_bytes += bytes_sent;
+		size -= bytes_sent;
+	}
+	return true;
+}
+
 void WiFi_Server::close_connection()
 {
 	if (this->client_socket != -1)
@@ -282,6 +404,8 @@ void WiFi_Server::close_connection()
 
 	this->is_connected.store(false, std::memory_order_release);
 
+	this->buffered_size = 0;
+	this->buffered_offset = 0;
 	this->blocks_left.store(0, std::memory_order_relaxed);
 	this->block_size.store(0, std::memory_order_relaxed);
 }
\ No newline at end of file
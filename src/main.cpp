@@ -1,8 +1,14 @@
 #include "Device.hpp"
+#include "Flight_Recorder.hpp"
+#include "Logger.hpp"
+#include "Metrics.hpp"
+#include "Secure_Channel.hpp"
+#include "State_Notifier.hpp"
+#include "Target_Manager.hpp"
+#include "Thread_Policy.hpp"
 // #include <sys/mman.h>
 #include <unikey.hpp>
 
-#include <iostream>
 #include <string>
 #include <stdlib.h>
 #include <sys/poll.h>
@@ -11,19 +17,38 @@
 int main()
 {
 	int old_gid = change_group_permissions();
-	std::cout << std::endl;
 
-	std::cout << "Initializing all available input sources..." << std::endl;
-	Device::initialize_devices("/dev/input");
-	std::cout << "Devices have been initialized..." << std::endl;
+	// Started ahead of every other thread so that they all leave SIGUSR1 to it
+	if (Flight_Recorder::start("/var/lib/unikey"))
+		Logger::log(Logger::INFO, "Flight recorder dumps to /var/lib/unikey on SIGUSR1");
+
+	// Thread placement and scheduling, applied to each thread as it starts
+	if (Thread_Policy::load_config("/etc/unikey/unikey.conf"))
+		Logger::log(Logger::INFO, "Loaded /etc/unikey/unikey.conf");
+
+	// Needed for encrypted "tls:" targets
+	if (Secure_Channel::load_psk("/etc/unikey/unikey.psk"))
+		Logger::log(Logger::INFO, "Loaded /etc/unikey/unikey.psk");
+
+	Logger::log(Logger::INFO, "Discovering available input sources...");
+	Device::initialize_devices("/dev/input");	// Devices come online in the background
 	
-	std::cout << "Begin unikey..." << std::endl;
+	Logger::log(Logger::INFO, "Begin unikey...");
+
+	// Prometheus scrape target, also available as GetStats over D-Bus
+	register_metrics_collectors();
+	if (Metrics::start_endpoint("tcp:127.0.0.1:9469"))
+		Logger::log(Logger::INFO, "Serving metrics on 127.0.0.1:9469");
 	
 	register_to_dbus();
 	Device::wait_for_exit();
+	State_Notifier::stop();	// Emits through the connection, so it goes first
 	unikey_dbus_connection->leaveEventLoop();
+	Target_Manager::close_all();
+	Metrics::stop_endpoint();
+	Flight_Recorder::stop();
 	
-	std::cout << "Process 'unikey' has exited successfully" << std::endl;
+	Logger::log(Logger::INFO, "Process 'unikey' has exited successfully");
 
 	return_to_original_group_permissions(old_gid);
 	return 0;
@@ -1,12 +1,28 @@
 #include "unikey.hpp"
 #include "BitField.hpp"
+#include "Chord_Matcher.hpp"
+#include "Clock_Sync.hpp"
 #include "Device.hpp"
+#include "Event_Filter.hpp"
+#include "Event_Tap.hpp"
+#include "Flight_Recorder.hpp"
+#include "IO_Engine.hpp"
+#include "Jitter_Buffer.hpp"
+#include "Logger.hpp"
+#include "Metrics.hpp"
+#include "State_Notifier.hpp"
+#include "Target_Manager.hpp"
+#include "Thread_Policy.hpp"
+#include "Tracepoints.hpp"
 #include "Virtual_Device.hpp"
 #include "WiFi_Client.hpp"
 #include "WiFi_Server.hpp"
 
 #include <atomic>
-#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <vector>
 
 #include <grp.h>
 #include <asm-generic/socket.h>
@@ -15,6 +31,7 @@
 #include <memory>
 #include <sdbus-c++/IObject.h>
 #include <sys/socket.h>
+#include <sys/sysmacros.h>
 
 #include <sdbus-c++/Message.h>
 
@@ -24,6 +41,9 @@ std::unique_ptr<sdbus::IObject> unikey_root_dbus_obj;
 std::unique_ptr<sdbus::IObject> unikey_device_dbus_obj;
 std::unique_ptr<sdbus::IObject> unikey_wifi_dbus_obj;
 
+static std::atomic_uint32_t jitter_budget_ms{0};	// Zero writes every frame as soon as it arrives
+static std::atomic_bool is_sender_connected{false};	// A sender is forwarding to this machine's server
+
 void register_to_dbus()
 {
 	// Initialize the D-Bus connection
@@ -37,6 +57,7 @@ void register_to_dbus()
 	// Add additional functionality to D-Bus
 	register_device_dbus_cmds();
 	register_wifi_dbus_cmds();
+	State_Notifier::start(&emit_state_changes);
 	
 	// Begin listening to D-Bus Signals
 	unikey_dbus_connection->enterEventLoopAsync();
@@ -53,10 +74,64 @@ void register_device_dbus_cmds()
 		.onInterface("io.unikey.Device.Methods")
 			.implementedAs(&dbus_trigger_cmd);
 
+	unikey_device_dbus_obj->registerMethod("io.unikey.Device.Methods",
+		"AddHotkey", "ssu", "b", &dbus_add_hotkey);
+
+	unikey_device_dbus_obj->registerMethod("io.unikey.Device.Methods",
+		"AddRemapRule", "ss", "b", &dbus_add_remap_rule);
+
+	unikey_device_dbus_obj->registerMethod("io.unikey.Device.Methods",
+		"UseRemapProfile", "s", "b", &dbus_use_remap_profile);
+
+	unikey_device_dbus_obj->registerMethod("io.unikey.Device.Methods",
+		"ClearRemapProfile", "s", "", &dbus_clear_remap_profile);
+
+	unikey_device_dbus_obj->registerMethod("io.unikey.Device.Methods",
+		"SetThreadPolicy", "sssi", "b", &dbus_set_thread_policy);
+
+	unikey_device_dbus_obj->registerMethod("io.unikey.Device.Methods",
+		"LockMemory", "b", "b", &dbus_lock_memory);
+
+	unikey_device_dbus_obj->registerMethod("io.unikey.Device.Methods",
+		"SetLogLevel", "s", "b", &dbus_set_log_level);
+
+	unikey_device_dbus_obj->registerMethod("io.unikey.Device.Methods",
+		"OpenEventTap", "", "hhu", &dbus_open_event_tap);
+
+	unikey_device_dbus_obj->registerMethod("io.unikey.Device.Methods",
+		"CloseEventTap", "u", "b", &dbus_close_event_tap);
+
+	unikey_device_dbus_obj->registerMethod("GetLatencyReport")
+		.onInterface("io.unikey.Device.Methods")
+			.implementedAs([] { return Device::return_latency_report() + Target_Manager::return_latency_report() + Clock_Sync::return_report(); });
+
+	unikey_device_dbus_obj->registerMethod("GetStats")
+		.onInterface("io.unikey.Device.Methods")
+			.implementedAs(&Metrics::return_report);
+
+	unikey_device_dbus_obj->registerMethod("io.unikey.Device.Methods",
+		"SetMetricsEndpoint", "s", "b", &dbus_set_metrics_endpoint);
+
+	// Dumps to the daemon's own directory; returns the path written, empty on failure
+	unikey_device_dbus_obj->registerMethod("io.unikey.Device.Methods",
+		"DumpFlightRecorder", "", "s", &dbus_dump_flight_recorder);
+
+	// Dumps by itself once a frame is slower than this many milliseconds to reach a stage, zero turns it off
+	unikey_device_dbus_obj->registerMethod("io.unikey.Device.Methods",
+		"SetFlightThreshold", "u", "", &dbus_set_flight_threshold);
+
+	unikey_device_dbus_obj->registerMethod("ClearHotkeys")
+		.onInterface("io.unikey.Device.Methods")
+			.implementedAs(&Chord_Matcher::clear_chords);
+
 	unikey_device_dbus_obj->registerMethod("Exit")
 		.onInterface("io.unikey.Device.Methods")
 			.implementedAs(&Device::trigger_exit);
 
+	unikey_device_dbus_obj->registerProperty("Grabbed")
+		.onInterface("io.unikey.Device")
+			.withGetter(&Device::return_grab_state);
+
 	unikey_device_dbus_obj->finishRegistration();
 }
 
@@ -66,17 +141,83 @@ void register_wifi_dbus_cmds()
 
 	unikey_wifi_dbus_obj->registerMethod("io.unikey.WiFi.Methods",
 		"ConnectTo", "s", "", &dbus_connect_to_ip);
+
+	unikey_wifi_dbus_obj->registerMethod("io.unikey.WiFi.Methods",
+		"AddTarget", "s", "", &dbus_add_target);
+
+	unikey_wifi_dbus_obj->registerMethod("io.unikey.WiFi.Methods",
+		"RemoveTarget", "s", "", &dbus_remove_target);
+
+	unikey_wifi_dbus_obj->registerMethod("io.unikey.WiFi.Methods",
+		"SwitchTarget", "s", "", &dbus_switch_target);
+
+	unikey_wifi_dbus_obj->registerMethod("io.unikey.WiFi.Methods",
+		"SetTargetProfile", "ss", "b", &dbus_set_target_profile);
+
+	unikey_wifi_dbus_obj->registerMethod("io.unikey.WiFi.Methods",
+		"SetTargetTimeout", "su", "b", &dbus_set_target_timeout);
 	
+	unikey_wifi_dbus_obj->registerMethod("SetJitterBudget")
+		.onInterface("io.unikey.WiFi.Methods")
+			.implementedAs([](uint32_t milliseconds) { jitter_budget_ms.store(milliseconds, std::memory_order_relaxed); });
+
+	// Listen address in the Socket_Address syntax (tcp:, tls:, unix:, vsock:), empty for plain TCP on the default port
 	unikey_wifi_dbus_obj->registerMethod("ToggleServer")
 		.onInterface("io.unikey.WiFi.Methods")
 			.implementedAs(&dbus_toggle_unikey_server);
+
+	unikey_wifi_dbus_obj->registerProperty("ActiveTarget")
+		.onInterface("io.unikey.WiFi")
+			.withGetter(&Target_Manager::return_active_target);
+
+	// Target address to whether its connection is up
+	unikey_wifi_dbus_obj->registerProperty("Targets")
+		.onInterface("io.unikey.WiFi")
+			.withGetter(&Target_Manager::return_target_states);
+
+	unikey_wifi_dbus_obj->registerProperty("SenderConnected")
+		.onInterface("io.unikey.WiFi")
+			.withGetter([] { return is_sender_connected.load(std::memory_order_acquire); });
 	
 	unikey_wifi_dbus_obj->finishRegistration();
+
+	Chord_Matcher::set_action_handler(Chord_Matcher::SWITCH_TARGET, [](uint32_t slot)
+	{
+		Target_Manager::switch_to(slot);
+	});
+	Chord_Matcher::set_action_handler(Chord_Matcher::NEXT_TARGET, [](uint32_t)
+	{
+		Target_Manager::switch_to_next();
+	});
+}
+
+// Runs on the notifier thread; the getters read the values as they are now
+void emit_state_changes(uint32_t states)
+{
+	std::vector<std::string> wifi_properties;
+	if (states & State_Notifier::ACTIVE_TARGET)
+		wifi_properties.push_back("ActiveTarget");
+	if (states & State_Notifier::TARGET_CONNECTIONS)
+		wifi_properties.push_back("Targets");
+	if (states & State_Notifier::SENDER_CONNECTION)
+		wifi_properties.push_back("SenderConnected");
+
+	try
+	{
+		if (states & State_Notifier::GRAB_STATE)
+			unikey_device_dbus_obj->emitPropertiesChangedSignal("io.unikey.Device", std::vector<std::string>{ "Grabbed" });
+		if (wifi_properties.size() != 0)
+			unikey_wifi_dbus_obj->emitPropertiesChangedSignal("io.unikey.WiFi", wifi_properties);
+	}
+	catch (const sdbus::Error& error)
+	{
+		Logger::log(Logger::WARNING, "PropertiesChanged not sent: %s", error.what());
+	}
 }
 
 void dbus_trigger_cmd()
 {
-	std::cout << (Device::trigger_activation() ? "\n---GRABBED---" : "\n--UNGRABBED--") << std::endl;
+	Logger::log(Logger::INFO, "%s", Device::trigger_activation() ? "---GRABBED---" : "--UNGRABBED--");
 }
 
 void dbus_set_timeout_cmd(sdbus::MethodCall call)
@@ -87,77 +228,480 @@ void dbus_set_timeout_cmd(sdbus::MethodCall call)
 	call.createReply().send();
 }
 
-static WiFi_Client* messenger_wifi = nullptr;
-void dbus_connect_to_ip(sdbus::MethodCall call)
+void dbus_add_hotkey(sdbus::MethodCall call)
 {
-	std::string ip_addr_str;
-	call >> ip_addr_str;
+	std::string chord;
+	std::string action;
+	uint32_t argument;
+	call >> chord >> action >> argument;
+
+	auto reply = call.createReply();
+	reply << Chord_Matcher::add_chord(chord, action, argument);
+	reply.send();
+}
+
+void dbus_add_remap_rule(sdbus::MethodCall call)
+{
+	std::string profile_name;
+	std::string rule;
+	call >> profile_name >> rule;
+
+	auto reply = call.createReply();
+	reply << Event_Filter::add_rule(profile_name, rule);
+	reply.send();
+}
+
+void dbus_use_remap_profile(sdbus::MethodCall call)
+{
+	std::string profile_name;
+	call >> profile_name;
+
+	auto reply = call.createReply();
+	reply << Event_Filter::use_profile(profile_name);
+	reply.send();
+}
+
+void dbus_clear_remap_profile(sdbus::MethodCall call)
+{
+	std::string profile_name;
+	call >> profile_name;
+	Event_Filter::clear_profile(profile_name);
 	call.createReply().send();
-	
-	if (messenger_wifi != nullptr)
+}
+
+// Root, or a member of the input group that can read the devices anyway
+static bool is_privileged_caller(const sdbus::MethodCall& call)
+{
+	if (call.getCredsEuid() == 0)
+		return true;
+
+	auto grp = getgrnam("input");
+	if (grp == NULL)
+		return false;
+	if (call.getCredsGid() == grp->gr_gid)
+		return true;
+	for (gid_t gid : call.getCredsSupplementaryGids())
 	{
-		delete messenger_wifi;
-		messenger_wifi = nullptr;
+		if (gid == grp->gr_gid)
+			return true;
 	}
+	return false;
+}
+
+static void require_privileged_caller(const sdbus::MethodCall& call)
+{
+	if (!is_privileged_caller(call))
+		throw sdbus::Error("org.freedesktop.DBus.Error.AccessDenied", "Only root or the input group may call this method");
+}
+
+// Real-time scheduling and CPU pinning can starve the rest of the machine
+void dbus_set_thread_policy(sdbus::MethodCall call)
+{
+	require_privileged_caller(call);
+
+	std::string role;
+	std::string cpus;
+	std::string policy;
+	int32_t priority;
+	call >> role >> cpus >> policy >> priority;
+
+	auto reply = call.createReply();
+	reply << Thread_Policy::set_policy(role, cpus, policy, priority);
+	reply.send();
+}
+
+void dbus_lock_memory(sdbus::MethodCall call)
+{
+	require_privileged_caller(call);
+
+	bool is_locked;
+	call >> is_locked;
 
-	messenger_wifi = new WiFi_Client;
-	messenger_wifi->set_server_addr(ip_addr_str.c_str());
-	messenger_wifi->connect_to_server();
+	auto reply = call.createReply();
+	reply << Thread_Policy::lock_memory(is_locked);
+	reply.send();
+}
 
-	Device::set_event_processor(
-		[](const void* data, uint64_t unit_size)
+void dbus_set_log_level(sdbus::MethodCall call)
+{
+	static const char* LEVEL_NAMES[] = { "debug", "info", "warning", "error" };
+
+	std::string level_name;
+	call >> level_name;
+
+	bool is_valid = false;
+	for (unsigned n = Logger::DEBUG; n <= Logger::ERROR; ++n)
+	{
+		if (level_name == LEVEL_NAMES[n])
 		{
-			messenger_wifi->send_formatted_data(data, unit_size);
+			Logger::set_level((Logger::Level)n);
+			is_valid = true;
 		}
+	}
+
+	auto reply = call.createReply();
+	reply << is_valid;
+	reply.send();
+}
+
+void dbus_open_event_tap(sdbus::MethodCall call)
+{
+	require_privileged_caller(call);
+
+	int region_fd = -1;
+	int event_fd = -1;
+	unsigned reader_index = 0;
+	if (!Event_Tap::open_reader(region_fd, event_fd, reader_index, call.getSender()))
+		throw sdbus::Error("io.unikey.Error.TapUnavailable", "No event tap reader slot is available");
+
+	// UnixFd duplicates the descriptors, the daemon keeps its own
+	auto reply = call.createReply();
+	reply << sdbus::UnixFd(region_fd) << sdbus::UnixFd(event_fd) << (uint32_t)reader_index;
+	reply.send();
+}
+
+void dbus_close_event_tap(sdbus::MethodCall call)
+{
+	uint32_t reader_index;
+	call >> reader_index;
+
+	// Only the connection that opened the reader can close it
+	auto reply = call.createReply();
+	reply << Event_Tap::close_reader(reader_index, call.getSender());
+	reply.send();
+}
+
+// Binds a listening socket wherever the caller asks, so it is kept to the same callers as the tap
+void dbus_set_metrics_endpoint(sdbus::MethodCall call)
+{
+	require_privileged_caller(call);
+
+	std::string address;
+	call >> address;
+
+	auto reply = call.createReply();
+	reply << Metrics::start_endpoint(address);
+	reply.send();
+}
+
+void dbus_dump_flight_recorder(sdbus::MethodCall call)
+{
+	require_privileged_caller(call);
+
+	auto reply = call.createReply();
+	reply << Flight_Recorder::dump(Flight_Recorder::ON_REQUEST);
+	reply.send();
+}
+
+void dbus_set_flight_threshold(sdbus::MethodCall call)
+{
+	require_privileged_caller(call);
+
+	uint32_t threshold_ms;
+	call >> threshold_ms;
+	Flight_Recorder::set_threshold(threshold_ms * 1000000ull);
+	call.createReply().send();
+}
+
+void send_virtual_device_config(WiFi_Client& client)
+{
+	/*
+		Handshake order:
+		EV_KEY codes, EV_REL codes, EV_ABS axis ranges, input properties, key repeat { delay, period }
+	*/
+	BitField enabled_codes = Device::return_enabled_global_key_states() | Event_Filter::return_remapped_codes(EV_KEY);
+	client.send_unformatted_data(
+		enabled_codes.return_vector().data(),
+		sizeof(uint64_t),
+		enabled_codes.return_vector().size()
 	);
 
-	std::thread send_init_virtual_device_data(
-		[&]()
+	enabled_codes = Device::return_enabled_global_rel_states() | Event_Filter::return_remapped_codes(EV_REL);
+	client.send_unformatted_data(
+		enabled_codes.return_vector().data(),
+		sizeof(uint64_t),
+		enabled_codes.return_vector().size()
+	);
+
+	std::vector<struct abs_axis_info> axes = Device::return_enabled_global_abs_info();
+	client.send_unformatted_data(
+		axes.data(),
+		sizeof(struct abs_axis_info),
+		axes.size()
+	);
+
+	enabled_codes = Device::return_enabled_global_properties();
+	client.send_unformatted_data(
+		enabled_codes.return_vector().data(),
+		sizeof(uint64_t),
+		enabled_codes.return_vector().size()
+	);
+
+	int32_t repeat_settings[2] = { 0, 0 };
+	client.send_unformatted_data(
+		repeat_settings,
+		sizeof(int32_t),
+		Device::return_global_repeat_settings(repeat_settings[0], repeat_settings[1]) ? 2 : 0
+	);
+}
+
+bool receive_virtual_device_config(WiFi_Server& server, Virtual_Device& virt_dev)
+{
+	uint64_t* p_data = nullptr;
+
+	if ((p_data = (uint64_t*)server.read_sent_data_packet()) == nullptr)	// Get enabled EV_KEY codes
+		return false;
+	virt_dev.enable_codes(EV_KEY, std::vector<uint64_t>(1 + p_data, 1 + p_data + *p_data));
+	free(p_data);
+
+	if ((p_data = (uint64_t*)server.read_sent_data_packet()) == nullptr)	// Get enabled EV_REL codes
+		return false;
+	virt_dev.enable_codes(EV_REL, std::vector<uint64_t>(1 + p_data, 1 + p_data + *p_data));
+	free(p_data);
+
+	if ((p_data = (uint64_t*)server.read_sent_data_packet()) == nullptr)	// Get EV_ABS axes and their ranges
+		return false;
+	virt_dev.enable_abs_axes((struct abs_axis_info*)(1 + p_data), *p_data);
+	free(p_data);
+
+	if ((p_data = (uint64_t*)server.read_sent_data_packet()) == nullptr)	// Get input properties
+		return false;
+	BitField enabled_props;
+	enabled_props.copy_bit_vector(std::vector<uint64_t>(1 + p_data, 1 + p_data + *p_data));
+	virt_dev.enable_properties(enabled_props);
+	free(p_data);
+
+	if ((p_data = (uint64_t*)server.read_sent_data_packet()) == nullptr)	// Get the source's key repeat delay and period
+		return false;
+	if (*p_data == 2)
+		virt_dev.enable_repeat(((int32_t*)(1 + p_data))[0], ((int32_t*)(1 + p_data))[1]);
+	free(p_data);
+
+	return true;
+}
+
+void forward_to_virtual_device(WiFi_Server& server, Virtual_Device& virt_dev)
+{
+	Event_Codec decoder;
+	Jitter_Buffer jitter_buffer;
+	std::vector<struct input_event> ev_list;
+	std::vector<struct input_event> buffered_list;
+	uint64_t* p_data = nullptr;
+	uint64_t capture_ns = 0;
+	IO_Engine io_engine;	// Frames that arrived together reach uinput with one submission
+
+	// Write received inputs followed by SYN_REPORT
+	auto inject = [&](const std::vector<struct input_event>& frame, uint64_t local_capture_ns)
+	{
+		TRACEPOINT(frame_inject, local_capture_ns, frame.size());
+		virt_dev.write_frame(frame.data(), frame.size());
+		Clock_Sync::record_frame(local_capture_ns);
+		uint64_t inject_ns = Clock_Sync::now_ns();
+		Flight_Recorder::record(Flight_Recorder::INJECT, local_capture_ns, (local_capture_ns != 0 && inject_ns >= local_capture_ns) ? inject_ns - local_capture_ns : 0,
+			frame.data(), frame.size(), inject_ns);
+		Metrics::add(Metrics::FRAMES_INJECTED);
+	};
+
+	Thread_Policy::enter(Thread_Policy::RECEIVER);
+	virt_dev.set_io_engine(&io_engine);
+	Clock_Sync::reset_peer();	// A new sender brings its own clock
+	while (server.is_connected_to_client())
+	{
+		jitter_buffer.set_budget(jitter_budget_ms.load(std::memory_order_relaxed) * 1000000ull);
+		while (jitter_buffer.pop_due(Clock_Sync::now_ns(), buffered_list, capture_ns))
+			inject(buffered_list, capture_ns);
+
+		// Both the wait and the read below can block, nothing queued may sit behind them
+		if (!server.has_buffered_record())
+			io_engine.flush();
+
+		uint64_t due_ns = jitter_buffer.return_next_due();
+		if (due_ns != Jitter_Buffer::NOT_DUE && !server.wait_for_data(due_ns))
+			continue;	// Nothing arrived before the next buffered frame is due
+
+		if ((p_data = (uint64_t*)server.read_sent_data_packet()) == nullptr)
+		{
+			server.close_connection();
+		}
+		else
 		{
-			messenger_wifi->wait_until_connected();
+			uint64_t receive_ns = Clock_Sync::now_ns();
+			const uint8_t* p_frame = (const uint8_t*)(1 + p_data);
+			uint64_t ping[3];
+			int64_t offset_ns = 0;
+			uint64_t rtt_ns = 0;
 
-			messenger_wifi->send_unformatted_data(
-				Device::return_enabled_global_key_states().return_vector().data(),
-				sizeof(uint64_t),
-				Device::return_enabled_global_key_states().return_vector().size()
-			);
+			switch (Event_Codec::return_frame_kind(p_frame, *p_data))
+			{
+				case Event_Codec::FRAME_PING:
+					if (Event_Codec::decode_ping(p_frame, *p_data, ping[0]))
+					{
+						ping[1] = receive_ns;
+						ping[2] = Clock_Sync::now_ns();
+						server.send_reply(ping, sizeof(ping));
+					}
+					break;
+				case Event_Codec::FRAME_CLOCK:
+					if (Event_Codec::decode_clock(p_frame, *p_data, offset_ns, rtt_ns))
+						Clock_Sync::set_peer_estimate(offset_ns, rtt_ns);
+					break;
+				default:
+					if (decoder.decode(p_frame, *p_data, ev_list, &capture_ns))
+					{
+						Metrics::add(Metrics::FRAMES_RECEIVED);
+						capture_ns = Clock_Sync::to_local_clock(capture_ns);
+						TRACEPOINT(frame_parsed, capture_ns, ev_list.size(), receive_ns);
+						Flight_Recorder::record(Flight_Recorder::RECEIVE, capture_ns, (capture_ns != 0 && receive_ns >= capture_ns) ? receive_ns - capture_ns : 0,
+							ev_list.data(), ev_list.size(), receive_ns);
+						if (!jitter_buffer.push(ev_list, capture_ns, receive_ns))
+						{
+							// Key transitions and late frames go out now, behind everything buffered before them
+							uint64_t buffered_capture_ns = 0;
+							while (jitter_buffer.pop(buffered_list, buffered_capture_ns))
+								inject(buffered_list, buffered_capture_ns);
+							inject(ev_list, capture_ns);
+						}
+					}
+					break;
+			}
+			free(p_data);
 		}
-	);
-	send_init_virtual_device_data.detach();
+	}
+	virt_dev.set_io_engine(nullptr);
+	Thread_Policy::leave(Thread_Policy::RECEIVER);
+}
+
+void register_metrics_collectors()
+{
+	Metrics::add_collector([](std::string& text)
+	{
+		std::vector<device_stats> stats = Device::return_device_stats();
+		auto device_labels = [](const device_stats& device)
+		{
+			return "device=\"" + Metrics::escape_label(device.name) + "\",devnum=\""
+				+ std::to_string(major(device.devnum)) + ':' + std::to_string(minor(device.devnum)) + '"';
+		};
+
+		Metrics::append_header(text, "unikey_input_devices", "gauge", "Input devices being captured");
+		Metrics::append_sample(text, "unikey_input_devices", "", stats.size());
+		Metrics::append_header(text, "unikey_queue_depth", "gauge", "Captured frames waiting to be forwarded");
+		Metrics::append_sample(text, "unikey_queue_depth", "", Device::return_queue_depth());
+
+		Metrics::append_header(text, "unikey_device_frames_captured_total", "counter", "Frames read from each input device");
+		for (const device_stats& device : stats)
+			Metrics::append_sample(text, "unikey_device_frames_captured_total", device_labels(device), device.frame_count);
+		Metrics::append_header(text, "unikey_device_resyncs_total", "counter", "Kernel buffer overflows on each input device");
+		for (const device_stats& device : stats)
+			Metrics::append_sample(text, "unikey_device_resyncs_total", device_labels(device), device.drop_count);
+	});
+}
+
+static void use_target_event_processor()
+{
+	static std::atomic_bool processor_is_set = false;
+
+	if (processor_is_set.exchange(true, std::memory_order_acq_rel) == false)
+	{
+		Target_Manager::set_handshake_process(&send_virtual_device_config);
+		Device::set_event_processor(&Target_Manager::send_to_active);
+	}
+}
+
+void dbus_connect_to_ip(sdbus::MethodCall call)
+{
+	std::string ip_addr_str;
+	call >> ip_addr_str;
+	call.createReply().send();
+
+	use_target_event_processor();
+	if (Target_Manager::add_target(ip_addr_str) < 0)
+	{
+		Logger::log(Logger::ERROR, "Could not add target %s (invalid address or no free slot)", ip_addr_str.c_str());
+		return;
+	}
+	Target_Manager::switch_to(ip_addr_str);
+}
+
+void dbus_add_target(sdbus::MethodCall call)
+{
+	std::string ip_addr_str;
+	call >> ip_addr_str;
+	call.createReply().send();
+
+	use_target_event_processor();
+	if (Target_Manager::add_target(ip_addr_str) < 0)
+		Logger::log(Logger::ERROR, "Could not add target %s (invalid address or no free slot)", ip_addr_str.c_str());
+}
+
+void dbus_remove_target(sdbus::MethodCall call)
+{
+	std::string ip_addr_str;
+	call >> ip_addr_str;
+	call.createReply().send();
+
+	Target_Manager::remove_target(ip_addr_str);
+}
+
+void dbus_set_target_profile(sdbus::MethodCall call)
+{
+	std::string ip_addr_str;
+	std::string profile_name;
+	call >> ip_addr_str >> profile_name;
+
+	auto reply = call.createReply();
+	reply << Target_Manager::set_target_profile(ip_addr_str, profile_name);
+	reply.send();
+}
+
+void dbus_set_target_timeout(sdbus::MethodCall call)
+{
+	std::string ip_addr_str;
+	uint32_t seconds;
+	call >> ip_addr_str >> seconds;
+
+	auto reply = call.createReply();
+	reply << Target_Manager::set_target_timeout(ip_addr_str, seconds);
+	reply.send();
+}
+
+void dbus_switch_target(sdbus::MethodCall call)
+{
+	std::string ip_addr_str;
+	call >> ip_addr_str;
+
+	bool switched = (ip_addr_str.size() != 0)
+		? Target_Manager::switch_to(ip_addr_str)
+		: Target_Manager::switch_to_next();
+	call.createReply().send();
+
+	if (switched)
+		Logger::log(Logger::INFO, "Switched to %s", Target_Manager::return_active_target().c_str());
 }
 
-void dbus_toggle_unikey_server()
+void dbus_toggle_unikey_server(const std::string& address)
 {
 	static std::atomic_bool unikey_server_status = false;
-	static WiFi_Server dev_server(42069);
+	static WiFi_Server dev_server;
 	auto launch_server = [&]
 	{
 		std::thread server_event_loop([&]
 		{
 			Virtual_Device virt_unikey("Unikey HID Device");
-			uint64_t* p_data = nullptr;
 
-			while(unikey_server_status.load(std::memory_order_acquire) == false)
+			while (unikey_server_status.load(std::memory_order_acquire) == true)
 			{
 				dev_server.begin_listening().wait_for_connection();
-				std::cout << "Device Connected" << std::endl;
-				p_data = (uint64_t*)dev_server.read_sent_data();	// Get enabled EV_KEY codes
-				virt_unikey.enable_codes(EV_KEY, std::vector<uint64_t>(1 + p_data, *p_data + p_data));
-				free(p_data);
-				
-				p_data = (uint64_t*)dev_server.read_sent_data();	// Get Enabled EV_REL codes
-				virt_unikey.enable_codes(EV_REL, std::vector<uint64_t>(1 + p_data, *p_data + p_data));	// Enables 
-				free(p_data);
-
-				while (dev_server.is_connected_to_client())
-				{
-					if ((p_data = (uint64_t*)dev_server.read_sent_data()) != nullptr)
-					{
-						virt_unikey.write_event((struct input_event*)(1 + p_data), *p_data);	// Write received inputs
-						virt_unikey.write_event();	// Sends SYN_REPORT as default arguments
-						free(p_data);
-					}
-				}
+				Logger::log(Logger::INFO, "Device connected");
+				is_sender_connected.store(dev_server.is_connected_to_client(), std::memory_order_release);
+				State_Notifier::mark_changed(State_Notifier::SENDER_CONNECTION);
+
+				if (receive_virtual_device_config(dev_server, virt_unikey))
+					forward_to_virtual_device(dev_server, virt_unikey);
+				else
+					dev_server.close_connection();
+				is_sender_connected.store(false, std::memory_order_release);
+				State_Notifier::mark_changed(State_Notifier::SENDER_CONNECTION);
+
 				virt_unikey.clear();
 				virt_unikey.set_device_name("Unikey HID Device");
 			}
@@ -167,13 +711,19 @@ void dbus_toggle_unikey_server()
 
 	if (unikey_server_status.load(std::memory_order_acquire) == false)
 	{
-		std::cout << "Server launched" << std::endl;
+		std::string listen_address = address.empty() ? "tcp:0.0.0.0:" + std::to_string(Socket_Address::DEFAULT_PORT) : address;
+		Socket_Address parsed_address;
+		if (!parsed_address.parse(listen_address))
+			throw sdbus::Error("io.unikey.Error.InvalidAddress", "Not a tcp:, tls:, unix: or vsock: address: " + listen_address);
+
+		dev_server.init_server(listen_address.c_str());
+		Logger::log(Logger::INFO, "Server launched on %s", listen_address.c_str());
 		unikey_server_status.store(true, std::memory_order_release);
 		launch_server();
 	}
 	else
 	{
-		std::cout << "Closing server" << std::endl;
+		Logger::log(Logger::INFO, "Closing server");
 
 		unikey_server_status.store(false, std::memory_order_release);
 		dev_server.close_connection();
@@ -186,13 +736,13 @@ int change_group_permissions()
 	auto grp = getgrnam("input");
 	if (grp == NULL)
 	{
-		std::cerr << "getgrnam(\"input\") failed" << std::endl;
+		Logger::log(Logger::ERROR, "getgrnam(\"input\") failed");
 		return -1;
 	}
 	int oldgid = getgid();
 	if (setgid(grp->gr_gid) < 0)
 	{
-		std::cerr << "Failed to change group to input" << std::endl;
+		Logger::log(Logger::ERROR, "Failed to change group to input: %s", strerror(errno));
 		return -1;
 	}
 	
@@ -203,7 +753,7 @@ int return_to_original_group_permissions(int gid)
 {
 	if (setgid(gid) < 0)
 	{
-		std::cerr << "Could not return Group ID back to original" << std::endl;
+		Logger::log(Logger::ERROR, "Could not return group ID back to original: %s", strerror(errno));
 		return -1;
 	}
 	return 0;